@@ -0,0 +1,56 @@
+#ifndef TLO_FS_CLUSTER_HPP
+#define TLO_FS_CLUSTER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tfs {
+// Union-find over the elements 0 .. size - 1. All member functions can be
+// called concurrently without further synchronization.
+class ConcurrentDisjointSets {
+ private:
+  std::vector<std::atomic<std::size_t>> parents;
+
+ public:
+  explicit ConcurrentDisjointSets(std::size_t size = 0);
+
+  std::size_t size() const;
+
+  // Returns the representative of the set containing element. The
+  // representative of a set is the smallest element in the set.
+  std::size_t find(std::size_t element);
+
+  // Merges the sets containing element1 and element2. Returns false if they
+  // were already in the same set.
+  bool unite(std::size_t element1, std::size_t element2);
+
+  bool areConnected(std::size_t element1, std::size_t element2);
+};
+
+// File paths of files similar to each other. The first path is the
+// representative of the cluster.
+using Cluster = std::vector<std::string>;
+
+// Builds a cluster for each set in sets that has more than one element, where
+// paths[i] is the file path of element i. Expects paths.size() to be
+// sets.size(). paths[i] may be nullptr if element i is in a set by itself. The
+// paths in each cluster are sorted, and the clusters are sorted by
+// representative.
+std::vector<Cluster> collectClusters(
+    ConcurrentDisjointSets &sets,
+    const std::vector<const std::string *> &paths);
+
+// Prints the cluster as comma-separated quoted paths. Quotes inside a path are
+// doubled, as in CSV.
+void printCluster(std::ostream &os, const Cluster &cluster);
+
+// Given string should have the format "<path>","<path>",... as printed by
+// printCluster(), with quotes inside a path doubled. Throws std::runtime_error
+// on error.
+Cluster parseCluster(const std::string &string);
+}  // namespace tfs
+
+#endif  // TLO_FS_CLUSTER_HPP
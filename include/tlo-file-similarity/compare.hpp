@@ -1,17 +1,30 @@
 #ifndef TLO_FS_COMPARE_HPP
 #define TLO_FS_COMPARE_HPP
 
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 
 #include "tlo-file-similarity/fuzzy.hpp"
 
 namespace tfs {
+// Only used by compareHashesInDatabase(), so including this header does not
+// pull in database.hpp and SQLite.
+class FuzzyHashDatabase;
+
 // Returns score from 0 to 100 of how similar the given strings are. A score
 // closer to 100 means the hashes are more similar.
 double compareWithLcsDistance(const std::string &string1,
                               const std::string &string2);
 
+// Same as above, except that the comparison stops early once the score is
+// known to be less than minSimilarityScore. In that case, returns some score
+// less than minSimilarityScore instead of the exact score.
+double compareWithLcsDistance(const std::string &string1,
+                              const std::string &string2,
+                              double minSimilarityScore);
+
 // Returns score from 0 to 100 of how similar the given strings are. A score
 // closer to 100 means the hashes are more similar.
 double compareWithLevenshteinDistance(const std::string &string1,
@@ -22,17 +35,32 @@ double compareWithLevenshteinDistance(const std::string &string1,
 double compareWithDamerLevenDistance(const std::string &string1,
                                      const std::string &string2);
 
+// Returns score from 0 to 100 of how similar the given strings are. A score
+// closer to 100 means the hashes are more similar. Uses the optimal string
+// alignment distance, which is faster to compute than the Damerau-Levenshtein
+// distance but can be greater than it.
+double compareWithOsaDistance(const std::string &string1,
+                              const std::string &string2);
+
+// Which of the above functions is used to score the parts of a pair of hashes.
+enum class ComparisonMetric { LCS, LEVENSHTEIN, DAMERAU_LEVENSHTEIN, OSA };
+
 bool hashesAreComparable(const FuzzyHash &hash1, const FuzzyHash &hash2);
 
 // Returns score from 0 to 100 of how similar the given hashes are. A score
 // closer to 100 means the hashes are more similar. Throws std::runtime_error
 // if hashes are not comparable.
-double compareHashes(const FuzzyHash &hash1, const FuzzyHash &hash2);
+double compareHashes(const FuzzyHash &hash1, const FuzzyHash &hash2,
+                     ComparisonMetric metric = ComparisonMetric::LCS);
 
 struct FuzzyHashFromFile : public FuzzyHash {
   // Index (within a vector of paths) of the text file this hash came from.
   std::size_t fileIndex = 0;
 
+  // Index of this hash among all the hashes read by readHashesForComparison().
+  // Hashes are numbered from 0 in the order they were read.
+  std::size_t hashIndex = 0;
+
   explicit FuzzyHashFromFile(FuzzyHash &&hash);
 };
 
@@ -51,13 +79,21 @@ using HashComparisonMap =
 // size. Returns the map and also the number of hashes. If recordingSources is
 // true, the fileIndex variable of each hash will be set to the index (within
 // textFilePaths) of the text file the hash came from. The fileIndex variable
-// will be set to 0 otherwise.
+// will be set to 0 otherwise. The hashIndex variable of each hash will be set
+// to a number from 0 to the number of hashes - 1. Hashes with identical parts
+// will be next to each other in their vector, and among those, hashes with the
+// same fileIndex will be next to each other. Each file is read in large
+// blocks, and the lines of each block are parsed using numThreads threads.
 std::pair<HashComparisonMap, std::size_t> readHashesForComparison(
     const std::vector<std::filesystem::path> &textFilePaths,
-    bool recordingSources = false);
+    bool recordingSources = false, std::size_t numThreads = 1);
 
 class HashComparisonEventHandler {
  public:
+  // Called before comparing a pair of comparable hashes. The pair is skipped if
+  // this returns false. Returns true by default.
+  virtual bool shouldCompare(const FuzzyHashFromFile &hash1,
+                             const FuzzyHashFromFile &hash2);
   virtual void onSimilarPairFound(const FuzzyHashFromFile &hash1,
                                   const FuzzyHashFromFile &hash2,
                                   double similarityScore) = 0;
@@ -65,14 +101,113 @@ class HashComparisonEventHandler {
   virtual ~HashComparisonEventHandler();
 };
 
+// Identifies one of count disjoint parts of the work done by compareHashes().
+// Work is split deterministically, so count independent calls to
+// compareHashes() on the same hashes, with index going from 0 to count - 1,
+// together compare every comparable pair of hashes exactly once.
+struct ComparisonShard {
+  std::size_t index = 0;
+  std::size_t count = 1;
+};
+
+// Given string should have the format <index>/<count> where index < count.
+// Throws std::runtime_error on error.
+ComparisonShard parseShard(const std::string &string);
+
+// Returns the number of times compareHashes() will call handler.onHashDone()
+// when given the map, the given shard, and the given crossSourcesOnly.
+std::size_t numHashesInShard(const HashComparisonMap &blockSizesToHashes,
+                             const ComparisonShard &shard,
+                             bool crossSourcesOnly = false);
+
 // Compares hashes in the the map. Calls handler.onSimilarPairFound() whenever
 // a pair of hashes has a similarity score >= similarityThreshold. Calls
 // handler.onHashDone() whenever the function is done comparing a hash to
 // comparable hashes. If numThreads > 1, make sure that the handler's member
-// functions are synchronized.
+// functions are synchronized. Only does the part of the work that belongs to
+// the given shard. Consecutive hashes in a vector with identical parts are
+// scored as one hash. Pairs of those hashes are reported with a similarity
+// score of 100 without scoring, and handler.shouldCompare() is only called
+// with the first hash of each such group when scoring it with other hashes.
+// If crossSourcesOnly is true, only compares pairs of hashes with different
+// fileIndex variables, and hashes are only grouped with consecutive hashes
+// with the same fileIndex. Pairs are scored using the given metric, which is
+// chosen once per call rather than once per pair.
 void compareHashes(const HashComparisonMap &blockSizesToHashes,
                    int similarityThreshold, HashComparisonEventHandler &handler,
-                   std::size_t numThreads = 1);
+                   std::size_t numThreads = 1,
+                   const ComparisonShard &shard = ComparisonShard(),
+                   bool crossSourcesOnly = false,
+                   ComparisonMetric metric = ComparisonMetric::LCS);
+
+// Compares each hash in blockSizesToHashes with each comparable hash in
+// otherBlockSizesToHashes. Hashes within the same map are not compared with
+// each other. Calls handler.onSimilarPairFound() with the hash from
+// blockSizesToHashes first whenever a pair of hashes has a similarity score >=
+// similarityThreshold. Calls handler.onHashDone() whenever the function is done
+// comparing a hash from blockSizesToHashes to comparable hashes. Hashes are
+// grouped and scored the same way as in compareHashes(). If numThreads > 1,
+// make sure that the handler's member functions are synchronized.
+void compareHashesWithOthers(const HashComparisonMap &blockSizesToHashes,
+                             const HashComparisonMap &otherBlockSizesToHashes,
+                             int similarityThreshold,
+                             HashComparisonEventHandler &handler,
+                             std::size_t numThreads = 1,
+                             ComparisonMetric metric = ComparisonMetric::LCS);
+
+// Keeps hashes sorted and grouped the way compareHashesWithOthers() groups the
+// other hashes, so hashes can be compared with them repeatedly without
+// regrouping them each time. Only the block sizes that are inserted into are
+// regrouped. compare() does not modify the index, so it can be called from
+// multiple threads at once, as long as no thread is inserting or erasing.
+class HashComparisonIndex {
+ private:
+  HashComparisonMap blockSizesToHashes;
+  std::size_t numHashes = 0;
+
+  struct Buckets;
+  std::unique_ptr<Buckets> buckets;
+
+ public:
+  HashComparisonIndex();
+  HashComparisonIndex(const HashComparisonIndex &) = delete;
+  HashComparisonIndex &operator=(const HashComparisonIndex &) = delete;
+  ~HashComparisonIndex();
+
+  std::size_t size() const;
+  const HashComparisonMap &hashes() const;
+
+  // Adds the hashes in newBlockSizesToHashes to the index. Does not check
+  // for hashes that are already in the index.
+  void insert(HashComparisonMap &&newBlockSizesToHashes);
+
+  // Removes the hashes whose filePath is in filePaths. Returns the number of
+  // hashes removed. Linear in the number of hashes in the index.
+  std::size_t erase(const std::unordered_set<std::string> &filePaths);
+
+  // Same as compareHashesWithOthers(), with the hashes in newBlockSizesToHashes
+  // as the first hashes of each pair and the hashes in the index as the other
+  // hashes.
+  void compare(const HashComparisonMap &newBlockSizesToHashes,
+               int similarityThreshold, HashComparisonEventHandler &handler,
+               std::size_t numThreads = 1,
+               ComparisonMetric metric = ComparisonMetric::LCS) const;
+};
+
+// Compares the hashes stored in the database the same way compareHashes()
+// compares the hashes in a map, without reading all of them into memory.
+// Block sizes are visited in ascending order, and only the hashes with the
+// current block size and with twice the current block size are kept in
+// memory at a time. The hashIndex variable of each hash will be set to a
+// number from 0 to database.getNumHashes() - 1, in ascending order of block
+// size, then in the order given by database.getHashesWithBlockSize(). If
+// numThreads > 1, make sure that the handler's member functions are
+// synchronized.
+void compareHashesInDatabase(FuzzyHashDatabase &database,
+                             int similarityThreshold,
+                             HashComparisonEventHandler &handler,
+                             std::size_t numThreads = 1,
+                             ComparisonMetric metric = ComparisonMetric::LCS);
 }  // namespace tfs
 
 #endif  // TLO_FS_COMPARE_HPP
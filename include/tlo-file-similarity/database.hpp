@@ -1,7 +1,11 @@
 #ifndef TLO_FS_DATABASE_HPP
 #define TLO_FS_DATABASE_HPP
 
+#include <exception>
+#include <memory>
+#include <string>
 #include <tlo-cpp/sqlite3.hpp>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "tlo-file-similarity/fuzzy.hpp"
@@ -20,55 +24,228 @@ struct FuzzyHashRow : public FuzzyHash {
 using FuzzyHashRowSet =
     std::unordered_set<FuzzyHashRow, HashFuzzyHashPath, EqualFuzzyHashPath>;
 
+// Number of rows insertHashes(), updateHashes(), and upsertHashes() write per
+// transaction by default.
+constexpr std::size_t DEFAULT_DATABASE_BATCH_SIZE = 10000;
+
+// Number of hashes queueHash() lets wait for the writer thread by default.
+constexpr std::size_t DEFAULT_WRITE_QUEUE_CAPACITY = 10000;
+
+// Stores a row per file in a FileHash table keyed by the id of the file's
+// directory and the file's name. The path of each directory is stored once in
+// a Directory table. Databases created with a single table of full file paths,
+// or with the parent and name of each directory, are migrated by open().
 class FuzzyHashDatabase {
  public:
   class EventHandler {
    public:
-    virtual void onRowInsert() = 0;
-    virtual void onRowUpdate() = 0;
+    virtual void onRowInsert();
+    virtual void onRowUpdate();
+    virtual void onRowUpsert();
     virtual ~EventHandler();
   };
 
  private:
+  std::filesystem::path filePath;
   tlo::Sqlite3Connection connection;
+  tlo::Sqlite3Statement insertFilePathToFind;
+  tlo::Sqlite3Statement deleteFilePathsToFind;
+  tlo::Sqlite3Statement selectDirectoryId;
+  tlo::Sqlite3Statement insertDirectory;
   tlo::Sqlite3Statement insertFuzzyHash;
-  tlo::Sqlite3Statement selectFuzzyHashesGlob;
+  tlo::Sqlite3Statement upsertFuzzyHash;
+  tlo::Sqlite3Statement selectFuzzyHash;
+  tlo::Sqlite3Statement selectFuzzyHashesToFind;
+  tlo::Sqlite3Statement selectFuzzyHashesInRange;
+  tlo::Sqlite3Statement selectFuzzyHashesWithBlockSize;
   tlo::Sqlite3Statement updateFuzzyHash;
+  tlo::Sqlite3Statement deleteFuzzyHash;
+  tlo::Sqlite3Statement deleteFuzzyHashesToFind;
   EventHandler *handler = nullptr;
+  std::size_t batchSize = DEFAULT_DATABASE_BATCH_SIZE;
+
+  struct Writer;
+  std::unique_ptr<Writer> writer;
+
+  struct ReadTasks;
+
+  // Rolls back the transaction it began when it is destroyed, unless it was
+  // committed, so an exception never leaves the connection in a transaction.
+  // Clears directoryIds when it rolls back.
+  class Transaction;
+
+  // Extra connections to the same database used by getHashesForPaths() to
+  // read on several threads at once. Opened the first time they are needed.
+  std::vector<std::unique_ptr<FuzzyHashDatabase>> readers;
+
+  // Ids of directories known to be stored, by path.
+  std::unordered_map<std::string, sqlite3_int64> directoryIds;
+
+  // Copies the rows of the table of full file paths used before directories
+  // were stored separately, if there is one, then drops it. Marks the database
+  // as using the current schema.
+  void migrateFromVersion0();
+
+  // Sets PRAGMA user_version to the current schema version.
+  void setSchemaVersion();
+
+  // Returns the id of the directory with the given path, which ends with a
+  // separator. Inserts the directory if it is not stored.
+  sqlite3_int64 getDirectoryId(const std::string &directoryPath);
+
+  // Binds the columns of hash to the named parameters of statement, inserting
+  // the directory of hash if it is not stored.
+  void resetClearBindingsAndBindHash(tlo::Sqlite3Statement &statement,
+                                     const FuzzyHashRow &hash);
+
+  // Executes statement for hash, beginning transaction if it is not open and
+  // committing it once it has batchSize rows. If handler is not nullptr, calls
+  // onRowWrite on it.
+  void writeHash(tlo::Sqlite3Statement &statement, const FuzzyHashRow &hash,
+                 void (EventHandler::*onRowWrite)(), Transaction &transaction);
+
+  // Calls writeHash() for each hash and commits the last transaction. Stops
+  // early if tlo::stopRequested is set, keeping the rows written so far.
+  void writeHashes(tlo::Sqlite3Statement &statement,
+                   const FuzzyHashRowSet &hashes,
+                   void (EventHandler::*onRowWrite)());
+
+  // Body of the writer thread started by startWriting().
+  void writeQueuedHashes();
+
+  // Replaces the contents of the temporary FilePathToFind table with
+  // filePaths[begin] to filePaths[end - 1].
+  void storeFilePathsToFind(const std::vector<std::filesystem::path> &filePaths,
+                            std::size_t begin, std::size_t end);
+
+  // Reads directories and chunks of file paths from tasks until there are
+  // none left, storing found hashes in results. Stores the exception that
+  // stops it, if any, in exception.
+  void readTasks(ReadTasks &tasks, FuzzyHashRowSet &results,
+                 std::exception_ptr &exception);
+
+  // Stores the found hashes of filePaths[begin] to filePaths[end - 1] in
+  // results.
+  void getHashesForFileChunk(
+      FuzzyHashRowSet &results,
+      const std::vector<std::filesystem::path> &filePaths, std::size_t begin,
+      std::size_t end);
 
  public:
+  FuzzyHashDatabase();
+  FuzzyHashDatabase(const FuzzyHashDatabase &) = delete;
+  FuzzyHashDatabase &operator=(const FuzzyHashDatabase &) = delete;
+
+  // Calls finishWriting() if the writer thread is running, ignoring any
+  // exception it throws.
+  ~FuzzyHashDatabase();
+
+  // Opens the database in write-ahead logging mode.
   void open(const std::filesystem::path &dbFilePath);
   bool isOpen() const;
   void setEventHandler(EventHandler &handler_);
 
+  // Sets the number of rows insertHashes(), updateHashes(), and upsertHashes()
+  // write per transaction. A batch size of 0 is treated as 1.
+  void setBatchSize(std::size_t batchSize_);
+
+  void beginTransaction();
+  void commitTransaction();
+
   // If handler is not nullptr, calls handler->onRowInsert().
   void insertHash(const FuzzyHashRow &newHash);
 
-  // If handler is not nullptr, calls handler->onRowInsert().
+  // If handler is not nullptr, calls handler->onRowInsert() for each row.
+  // Writes the rows in transactions of batchSize rows.
   void insertHashes(const FuzzyHashRowSet &newHashes);
 
-  // Stores found hashes in results.
+  // Looks up the hash of a single file using the primary key indexes. Returns
+  // true and stores the hash in result if it is found.
+  bool getHashForFile(FuzzyHashRow &result,
+                      const std::filesystem::path &filePath);
+
+  // Stores found hashes in results. Works on any number of file paths by
+  // joining FuzzyHash with a temporary table of the paths, a chunk at a time.
   void getHashesForFiles(FuzzyHashRowSet &results,
                          const std::vector<std::filesystem::path> &filePaths);
 
   // Gets hashes whose filePath is under the given directoryPath or a
   // subdirectory of the given directoryPath. Stores found hashes in results.
+  // Only reads the range of the filePath index that starts with directoryPath
+  // followed by a separator.
   void getHashesForDirectory(FuzzyHashRowSet &results,
                              const std::filesystem::path &directoryPath);
 
   // Calls getHashesForFiles() with all the file paths in paths. Calls
-  // getHashesForDirectory() for each directory path in paths.
+  // getHashesForDirectory() for each directory path in paths. If numThreads is
+  // more than 1, the directories and chunks of file paths are read in
+  // parallel, each extra thread using its own connection to the database.
+  // Each thread stores the hashes it finds in its own set, and the sets are
+  // merged into results once all the threads are done. Must not be called
+  // while the writer thread is running.
   void getHashesForPaths(FuzzyHashRowSet &results,
-                         const std::vector<std::filesystem::path> &paths);
+                         const std::vector<std::filesystem::path> &paths,
+                         std::size_t numThreads = 1);
+
+  // Returns the distinct block sizes of the stored hashes in ascending order.
+  std::vector<std::size_t> getBlockSizes();
+
+  // Appends the hashes with the given block size to results, sorted by part1,
+  // then part2, then filePath. Uses the index on blockSize, so only the
+  // matching rows are read.
+  void getHashesWithBlockSize(std::vector<FuzzyHash> &results,
+                              std::size_t blockSize);
+
+  std::size_t getNumHashes();
 
   // If handler is not nullptr, calls handler->onRowUpdate().
   void updateHash(const FuzzyHashRow &modifiedHash);
 
-  // If handler is not nullptr, calls handler->onRowUpdate().
+  // If handler is not nullptr, calls handler->onRowUpdate() for each row.
+  // Writes the rows in transactions of batchSize rows.
   void updateHashes(const FuzzyHashRowSet &modifiedHashes);
 
+  // Inserts each hash, or replaces the stored hash with the same filePath if
+  // there is one. If handler is not nullptr, calls handler->onRowUpsert() for
+  // each row. Writes the rows in transactions of batchSize rows.
+  void upsertHashes(const FuzzyHashRowSet &hashes);
+
+  // Starts a thread that upserts the hashes passed to queueHash() while the
+  // caller keeps working, committing a transaction every batchSize rows. Until
+  // finishWriting() returns, the database must not be used except through
+  // isOpen() and queueHash(). If handler is not nullptr, calls
+  // handler->onRowUpsert() for each row on the writer thread.
+  void startWriting(
+      std::size_t queueCapacity = DEFAULT_WRITE_QUEUE_CAPACITY);
+
+  // Can be called from multiple threads. Blocks while queueCapacity hashes
+  // are waiting to be written, so memory use stays bounded. Discards hash if
+  // the writer thread has failed.
+  void queueHash(FuzzyHashRow &&hash);
+
+  // Waits for the queued hashes to be written, commits them, and stops the
+  // writer thread. Rethrows the exception that made the writer thread fail, if
+  // any.
+  void finishWriting();
+
+  // Like getHashesForFiles(), works on any number of file paths.
   void deleteHashesForFiles(
       const std::vector<std::filesystem::path> &filePaths);
+
+  // Deletes the hashes of the files under each of directoryPaths that are not
+  // in filePaths, which should list every file that exists under them. Walks
+  // the sorted filePaths alongside an ordered scan of the stored hashes under
+  // each directory, then deletes the missing files' hashes in transactions of
+  // batchSize rows. Deletes nothing if tlo::stopRequested is set during the
+  // scan. Returns the number of hashes deleted.
+  std::size_t deleteHashesForMissingFiles(
+      const std::vector<std::filesystem::path> &directoryPaths,
+      const std::vector<std::filesystem::path> &filePaths);
+
+  // Gives the pages freed by deleted rows back to the file system. Databases
+  // created before incremental vacuuming was enabled are rebuilt the first
+  // time, which takes longer.
+  void vacuum();
 };
 }  // namespace tfs
 
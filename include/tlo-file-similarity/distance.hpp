@@ -0,0 +1,39 @@
+#ifndef TLO_FS_DISTANCE_HPP
+#define TLO_FS_DISTANCE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace tfs {
+// Strings up to this length fit in one machine word, so distances involving at
+// least one such string are computed with bit-parallel algorithms that process
+// a whole column of the dynamic programming matrix per character. Both parts of
+// a fuzzy hash are always short enough.
+constexpr std::size_t MAX_BIT_PARALLEL_LENGTH = 64;
+
+// Returns the length of the longest common subsequence of the given strings.
+// Uses the bit-parallel algorithm by Lloyd Allison and Trevor Dix (1986) if
+// either string is short enough. Otherwise uses tlo::lcsLength3(). If, partway
+// through, the remaining characters can no longer bring the length up to
+// minLcsLength, stops early and returns a length less than minLcsLength.
+std::size_t lcsLength(const std::string &string1, const std::string &string2,
+                      std::size_t minLcsLength = 0);
+
+// Returns the Levenshtein distance between the given strings. Uses the
+// bit-parallel algorithm by Gene Myers (1999) as formulated by Heikki Hyyrö
+// (2001) if either string is short enough. Otherwise uses
+// tlo::levenshteinDistance3().
+std::size_t levenshteinDistance(const std::string &string1,
+                                const std::string &string2);
+
+// Returns the optimal string alignment distance between the given strings.
+// This is the Levenshtein distance with a transposition of adjacent characters
+// also counting as one edit, except that no substring is edited more than
+// once, so it can be greater than the Damerau-Levenshtein distance. Uses the
+// bit-parallel algorithm by Heikki Hyyrö (2002) if either string is short
+// enough. Otherwise uses dynamic programming.
+std::size_t osaDistance(const std::string &string1,
+                        const std::string &string2);
+}  // namespace tfs
+
+#endif  // TLO_FS_DISTANCE_HPP
@@ -6,6 +6,8 @@
 #include <filesystem>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace tfs {
@@ -56,6 +58,18 @@ class FuzzyHashEventHandler {
 
 constexpr char BAD_FUZZY_HASH_CHAR = '!';
 
+// Smallest block size fuzzyHash() uses. Every block size it uses is
+// MIN_BLOCK_SIZE times a power of 2.
+constexpr std::size_t MIN_BLOCK_SIZE = 3;
+
+// Number of characters fuzzyHash() aims for part1 to have. The block size is
+// halved while part1 has fewer than SPAMSUM_LENGTH / 2 characters.
+constexpr std::size_t SPAMSUM_LENGTH = 64;
+
+// Characters the parts of a fuzzy hash are made of.
+constexpr std::string_view BASE64_ALPHABET =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
 // Based on spamsum and ssdeep. Throws std::runtime_error on error. Will call
 // handler.onBlockHash() whenever a file block has just been hashed. Also, will
 // call handler.onFileHash() whenever a file has just been hashed. Expects
@@ -67,6 +81,13 @@ FuzzyHash fuzzyHash(const std::filesystem::path &filePath,
                     FuzzyHashEventHandler &handler);
 FuzzyHash fuzzyHash(const std::filesystem::path &filePath);
 
+// Returns part1 and part2 of the fuzzy hash of bytes using the given block
+// size. These are the parts fuzzyHash() would compute for a file with the same
+// contents if it settled on blockSize. Regularly checks tlo::stopRequested like
+// fuzzyHash() does, but does not append BAD_FUZZY_HASH_CHAR.
+std::pair<std::string, std::string> hashUsingBlockSize(std::string_view bytes,
+                                                       std::size_t blockSize);
+
 // Expects filePaths to be paths to files. If a path refers to a file, will hash
 // the file. If a path is not a file, will throw std::runtime_error. Each file
 // is hashed as if by calling fuzzyHash(path, &handler). Before hashing a file,
@@ -79,7 +100,7 @@ void fuzzyHash(const std::vector<std::filesystem::path> &filePaths,
 
 // Given string should have the format <blockSize>:<part1>:<part2>,<path>.
 // Throws std::runtime_error on error.
-FuzzyHash parseHash(const std::string &hash);
+FuzzyHash parseHash(std::string_view hash);
 }  // namespace tfs
 
 #endif  // TLO_FS_FUZZY_HPP
@@ -0,0 +1,73 @@
+#ifndef TLO_FS_HASHERS_HPP
+#define TLO_FS_HASHERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tfs {
+/*
+ * Rolling hash algorithm from the paper "Identifying Almost Identical Files
+ * Using Context Triggered Piecewise Hashing" by Jesse Kornblum (2006). The
+ * paper is available at any of the following links:
+ * https://www.dfrws.org/sites/default/files/session-files/paper-identifying_almost_identical_files_using_context_triggered_piecewise_hashing.pdf
+ * https://doi.org/10.1016/j.diin.2006.06.015
+ *
+ * Constant WINDOW_SIZE from source file "ssdeep/fuzzy.c" available at:
+ * https://github.com/ssdeep-project/ssdeep/blob/master/fuzzy.c (Retrieved
+ * January 20, 2020)
+ *
+ * FNV-1 hash algorithm and constants OFFSET_BASIS and FNV_PRIME from web page
+ * "FNV Hash" by Landon Curt Noll available at:
+ * http://www.isthe.com/chongo/tech/comp/fnv/ (Retrieved January 20, 2020)
+ */
+
+constexpr std::size_t WINDOW_SIZE = 7;
+
+class RollingHasher {
+ private:
+  uint32_t x = 0;
+  uint32_t y = 0;
+  uint32_t z = 0;
+  uint32_t c = 0;
+  uint32_t window[WINDOW_SIZE] = {0};
+  bool bytesWereAdded_ = false;
+
+ public:
+  void addByte(unsigned char byte) {
+    y -= x;
+    y += WINDOW_SIZE * byte;
+    x += byte;
+    x -= window[c % WINDOW_SIZE];
+    window[c % WINDOW_SIZE] = byte;
+    c++;
+    z <<= 5;
+    z ^= byte;
+    bytesWereAdded_ = true;
+  }
+
+  uint32_t getHash() const { return x + y + z; }
+
+  bool bytesWereAdded() { return bytesWereAdded_; }
+};
+
+constexpr uint32_t OFFSET_BASIS = 2166136261U;
+constexpr uint32_t FNV_PRIME = 16777619U;
+
+class Fnv1Hasher {
+ private:
+  uint32_t hash = OFFSET_BASIS;
+  bool bytesWereAdded_ = false;
+
+ public:
+  void addByte(unsigned char byte) {
+    hash = (hash * FNV_PRIME) ^ byte;
+    bytesWereAdded_ = true;
+  }
+
+  uint32_t getHash() const { return hash; }
+
+  bool bytesWereAdded() { return bytesWereAdded_; }
+};
+}  // namespace tfs
+
+#endif  // TLO_FS_HASHERS_HPP
@@ -0,0 +1,109 @@
+#ifndef TLO_FS_PAIRS_HPP
+#define TLO_FS_PAIRS_HPP
+
+#include <tlo-cpp/sqlite3.hpp>
+#include <unordered_set>
+
+#include "tlo-file-similarity/compare.hpp"
+
+namespace tfs {
+using FuzzyHashSet =
+    std::unordered_set<FuzzyHash, HashFuzzyHashPath, EqualFuzzyHashPath>;
+
+// Remembers which hashes have already been compared with each other and which
+// pairs of them were similar, so later comparisons only need to compare new
+// and modified hashes. Hashes are identified by filePath.
+class SimilarPairDatabase {
+ public:
+  class EventHandler {
+   public:
+    virtual void onStoredPair(const std::string &filePath1,
+                              const std::string &filePath2,
+                              double similarityScore) = 0;
+    virtual ~EventHandler();
+  };
+
+  // Begins a transaction on the database when it is constructed and rolls it
+  // back when it is destroyed, unless it was committed, so an exception never
+  // leaves the connection in a transaction.
+  class Transaction;
+
+ private:
+  tlo::Sqlite3Connection connection;
+  tlo::Sqlite3Statement selectSetting;
+  tlo::Sqlite3Statement upsertSetting;
+  tlo::Sqlite3Statement insertComparedHash;
+  tlo::Sqlite3Statement deleteComparedHash;
+  tlo::Sqlite3Statement deleteSimilarPairsForFile;
+  tlo::Sqlite3Statement insertSimilarPair;
+
+ public:
+  void open(const std::filesystem::path &dbFilePath);
+  bool isOpen() const;
+
+  void beginTransaction();
+  void commitTransaction();
+
+  // Returns the similarity threshold the stored pairs were found with, or -1
+  // if nothing has been stored yet.
+  int getSimilarityThreshold();
+  void setSimilarityThreshold(int similarityThreshold);
+
+  // Returns the metric the stored pairs were scored with, or -1 if nothing has
+  // been stored yet. Otherwise, the returned value can be cast to
+  // ComparisonMetric.
+  int getComparisonMetric();
+  void setComparisonMetric(ComparisonMetric metric);
+
+  // Stores the previously compared hashes in results.
+  void getHashes(FuzzyHashSet &results);
+
+  // Remembers that hash was compared. Replaces the stored hash with the same
+  // filePath if there is one.
+  void insertHash(const FuzzyHash &hash);
+
+  // Forgets the stored hash with the given filePath and every stored pair
+  // that includes the filePath.
+  void deleteHash(const std::string &filePath);
+
+  // Forgets all stored hashes and pairs.
+  void deleteAll();
+
+  void insertPair(const std::string &filePath1, const std::string &filePath2,
+                  double similarityScore);
+
+  // Calls handler.onStoredPair() for each stored pair.
+  void getPairs(EventHandler &handler);
+};
+
+// Compares pairDatabase's stored hashes with the hashes in the map, and
+// returns the hashes in the map that need to be compared. These are the
+// hashes whose filePath is not stored, or is stored with a different block
+// size or parts. Stored pairs that include a returned hash, or a filePath no
+// longer in the map, are deleted. If similarityThreshold or metric is
+// different from the one the stored pairs were found with, everything is
+// deleted and all hashes are returned. Expects filePaths in the map to be
+// unique.
+HashComparisonMap prepareIncrementalComparison(
+    SimilarPairDatabase &pairDatabase,
+    const HashComparisonMap &blockSizesToHashes, int similarityThreshold,
+    ComparisonMetric metric = ComparisonMetric::LCS);
+
+// Compares each hash in newBlockSizesToHashes (as returned by
+// prepareIncrementalComparison()) with each comparable hash in
+// blockSizesToHashes, stores the similar pairs found in pairDatabase, and
+// remembers the new hashes as compared. Then calls
+// handler.onSimilarPairFound() for every stored pair, old and new, using the
+// hashes in blockSizesToHashes. Calls handler.onHashDone() whenever the
+// function is done comparing a new hash to comparable hashes. If
+// numThreads > 1, make sure that the handler's member functions are
+// synchronized.
+void compareHashesIncrementally(
+    SimilarPairDatabase &pairDatabase,
+    const HashComparisonMap &blockSizesToHashes,
+    const HashComparisonMap &newBlockSizesToHashes, int similarityThreshold,
+    HashComparisonEventHandler &handler, std::size_t numThreads = 1,
+    ComparisonMetric metric = ComparisonMetric::LCS);
+}  // namespace tfs
+
+#endif  // TLO_FS_PAIRS_HPP
@@ -0,0 +1,92 @@
+#ifndef TLO_FS_STATS_HPP
+#define TLO_FS_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace tfs {
+// Counts of the work done by the library. Each thread has its own counters,
+// so incrementing them needs no synchronization.
+struct StatCounters {
+  // Bytes read from files while hashing, including bytes read again when a
+  // file is rehashed with a smaller block size.
+  std::uint64_t bytesRead = 0;
+
+  // Files that were hashed, not counting files whose hashes were reused.
+  std::uint64_t filesHashed = 0;
+
+  // Times a file was hashed again because its hash had too few characters for
+  // the block size.
+  std::uint64_t rehashes = 0;
+
+  // Files whose hashes were reused from the database because their size and
+  // last write time did not change, and files that had to be hashed while a
+  // database was in use.
+  std::uint64_t databaseHits = 0;
+  std::uint64_t databaseMisses = 0;
+
+  // Pairs of hashes considered for scoring, pairs skipped without scoring
+  // because their block sizes are not comparable or the handler declined them,
+  // and scored pairs with a similarity score at or above the threshold.
+  // Identical hashes are grouped, so each pair here may stand for several pairs
+  // of files.
+  std::uint64_t comparisonsAttempted = 0;
+  std::uint64_t comparisonsPruned = 0;
+  std::uint64_t comparisonsMatched = 0;
+
+  StatCounters &operator+=(const StatCounters &other);
+};
+
+// Returns the counters of the calling thread.
+StatCounters &threadStatCounters();
+
+// Returns the sum of the counters of all threads, including threads that have
+// exited. Counters of running threads are read without synchronization, so
+// this should be called when no other thread is using the library.
+StatCounters totalStatCounters();
+
+// Returns the peak resident set size of the process in bytes, or 0 if it is
+// not available on this platform.
+std::uint64_t peakResidentSetSize();
+
+struct PhaseTime {
+  std::string name;
+  double wallSeconds = 0.0;
+
+  // Processor time used by all threads of the process during the phase.
+  double cpuSeconds = 0.0;
+};
+
+// Measures the wall and processor time of consecutive phases of a program.
+class PhaseTimer {
+ private:
+  std::vector<PhaseTime> phases;
+  bool timingPhase = false;
+  std::chrono::steady_clock::time_point wallStart;
+  std::clock_t cpuStart = 0;
+
+ public:
+  // Ends the current phase, if any, and starts a phase with the given name.
+  void startPhase(std::string name);
+
+  // Ends the current phase, if any.
+  void endPhase();
+
+  const std::vector<PhaseTime> &getPhases() const;
+};
+
+// Ends the current phase of phaseTimer and writes the phase times, the total
+// counters, and the peak resident set size to os as a JSON object.
+void writeStats(std::ostream &os, PhaseTimer &phaseTimer);
+
+// Same as above, but writes to the file at filePath. Throws std::runtime_error
+// if the file cannot be opened.
+void writeStats(const std::filesystem::path &filePath, PhaseTimer &phaseTimer);
+}  // namespace tfs
+
+#endif  // TLO_FS_STATS_HPP
@@ -0,0 +1,63 @@
+#ifndef TLO_FS_TRACE_HPP
+#define TLO_FS_TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+namespace tfs {
+// Number of spans each thread keeps. Once a thread has recorded this many
+// spans, each new span replaces its oldest one.
+constexpr std::size_t TRACE_BUFFER_CAPACITY = 65536;
+
+// Whether spans are being recorded. Set by startTracing().
+extern std::atomic<bool> tracing;
+
+// Starts recording spans. Timestamps of spans are relative to the time this
+// was called.
+void startTracing();
+
+// Records the time from its construction to its destruction as a span on the
+// calling thread. Does nothing beyond checking tracing if tracing is off, so
+// it is cheap enough to put around small units of work. name and category
+// must be string literals or otherwise outlive the program's use of tracing.
+class TraceSpan {
+ private:
+  const char *name;
+  const char *category;
+  std::string detail;
+  std::int64_t startTime = -1;
+
+ public:
+  TraceSpan(const char *name_, const char *category_);
+
+  // Same as above, but the span is also labeled with detail, such as the path
+  // of the file being worked on. detail is only built if tracing is on.
+  template <typename MakeDetail>
+  TraceSpan(const char *name_, const char *category_, MakeDetail &&makeDetail)
+      : TraceSpan(name_, category_) {
+    if (startTime >= 0) {
+      detail = makeDetail();
+    }
+  }
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+  ~TraceSpan();
+};
+
+// Writes the spans recorded by all threads, including threads that have
+// exited, to os in the Chrome trace event format, which can be loaded in
+// Perfetto or chrome://tracing. Should be called when no other thread is
+// recording spans.
+void writeTrace(std::ostream &os);
+
+// Same as above, but writes to the file at filePath. Throws std::runtime_error
+// if the file cannot be opened.
+void writeTrace(const std::filesystem::path &filePath);
+}  // namespace tfs
+
+#endif  // TLO_FS_TRACE_HPP
@@ -0,0 +1,52 @@
+#ifndef TLO_FS_WRITER_HPP
+#define TLO_FS_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace tfs {
+// Collects output in a buffer and writes it to a stream in large blocks.
+// Numbers are formatted with std::to_chars() instead of the stream.
+class BufferedWriter {
+ private:
+  std::ostream &os;
+  const std::size_t capacity;
+  std::string buffer;
+
+  void flushIfFull();
+
+ public:
+  // Output is written to os whenever more than capacity bytes are buffered.
+  explicit BufferedWriter(std::ostream &os_, std::size_t capacity_ = 1 << 20);
+  BufferedWriter(const BufferedWriter &) = delete;
+  BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+  // Flushes the buffer.
+  ~BufferedWriter();
+
+  void write(char character);
+  void write(std::string_view string);
+  void writeUnsigned(std::uint64_t value);
+
+  // Formats value the same way a stream with default flags and precision
+  // does.
+  void writeDouble(double value);
+
+  // Writes string as a JSON string, with surrounding quotes and with quotes,
+  // backslashes, and control characters escaped.
+  void writeJsonString(std::string_view string);
+
+  // Writes value as 8 bytes in little-endian order. The double is written in
+  // its IEEE 754 binary64 representation.
+  void writeLittleEndian(std::uint64_t value);
+  void writeLittleEndian(double value);
+
+  // Writes the buffer to the stream and flushes the stream.
+  void flush();
+};
+}  // namespace tfs
+
+#endif  // TLO_FS_WRITER_HPP
@@ -0,0 +1,179 @@
+#include "tlo-file-similarity/cluster.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace tfs {
+ConcurrentDisjointSets::ConcurrentDisjointSets(std::size_t size)
+    : parents(size) {
+  for (std::size_t i = 0; i < parents.size(); ++i) {
+    parents[i].store(i);
+  }
+}
+
+std::size_t ConcurrentDisjointSets::size() const { return parents.size(); }
+
+std::size_t ConcurrentDisjointSets::find(std::size_t element) {
+  for (;;) {
+    std::size_t parent = parents[element].load();
+
+    if (parent == element) {
+      return element;
+    }
+
+    std::size_t grandparent = parents[parent].load();
+
+    // Path halving. Failing to update is fine because it only means another
+    // thread has already moved element closer to the root.
+    if (parent != grandparent) {
+      parents[element].compare_exchange_weak(parent, grandparent);
+    }
+
+    element = grandparent;
+  }
+}
+
+bool ConcurrentDisjointSets::unite(std::size_t element1,
+                                   std::size_t element2) {
+  for (;;) {
+    std::size_t root1 = find(element1);
+    std::size_t root2 = find(element2);
+
+    if (root1 == root2) {
+      return false;
+    }
+
+    if (root1 > root2) {
+      std::swap(root1, root2);
+    }
+
+    // Link the larger root under the smaller root, but only if it is still a
+    // root. Otherwise, another thread linked it first, so try again.
+    std::size_t expected = root2;
+
+    if (parents[root2].compare_exchange_strong(expected, root1)) {
+      return true;
+    }
+  }
+}
+
+bool ConcurrentDisjointSets::areConnected(std::size_t element1,
+                                          std::size_t element2) {
+  for (;;) {
+    std::size_t root1 = find(element1);
+    std::size_t root2 = find(element2);
+
+    if (root1 == root2) {
+      return true;
+    }
+
+    // If root1 is still a root, root2 was a different root at some point
+    // after root1 was found, so the elements were not connected.
+    if (parents[root1].load() == root1) {
+      return false;
+    }
+  }
+}
+
+std::vector<Cluster> collectClusters(
+    ConcurrentDisjointSets &sets,
+    const std::vector<const std::string *> &paths) {
+  std::vector<std::vector<std::size_t>> rootsToElements(sets.size());
+
+  for (std::size_t i = 0; i < sets.size(); ++i) {
+    rootsToElements[sets.find(i)].push_back(i);
+  }
+
+  std::vector<Cluster> clusters;
+
+  for (const auto &elements : rootsToElements) {
+    if (elements.size() < 2) {
+      continue;
+    }
+
+    Cluster cluster;
+
+    for (const auto element : elements) {
+      cluster.push_back(*paths[element]);
+    }
+
+    std::sort(cluster.begin(), cluster.end());
+    clusters.push_back(std::move(cluster));
+  }
+
+  std::sort(clusters.begin(), clusters.end());
+  return clusters;
+}
+
+void printCluster(std::ostream &os, const Cluster &cluster) {
+  for (std::size_t i = 0; i < cluster.size(); ++i) {
+    if (i > 0) {
+      os << ',';
+    }
+
+    os << '"';
+
+    for (const char character : cluster[i]) {
+      if (character == '"') {
+        os << '"';
+      }
+
+      os << character;
+    }
+
+    os << '"';
+  }
+}
+
+namespace {
+std::runtime_error makeParseClusterError(const std::string &string) {
+  return std::runtime_error("Error: Cluster \"" + string +
+                            "\" is not a list of quoted paths.");
+}
+}  // namespace
+
+Cluster parseCluster(const std::string &string) {
+  Cluster cluster;
+  std::size_t i = 0;
+
+  for (;;) {
+    if (i >= string.size() || string[i] != '"') {
+      throw makeParseClusterError(string);
+    }
+
+    std::string path;
+
+    // A quote inside a path is written as two quotes.
+    for (++i;; ++i) {
+      if (i >= string.size()) {
+        throw makeParseClusterError(string);
+      }
+
+      if (string[i] == '"') {
+        if (i + 1 < string.size() && string[i + 1] == '"') {
+          path.push_back('"');
+          ++i;
+        } else {
+          break;
+        }
+      } else {
+        path.push_back(string[i]);
+      }
+    }
+
+    cluster.push_back(std::move(path));
+    ++i;
+
+    if (i == string.size()) {
+      return cluster;
+    }
+
+    if (string[i] != ',') {
+      throw makeParseClusterError(string);
+    }
+
+    ++i;
+  }
+}
+}  // namespace tfs
@@ -1,10 +1,16 @@
 #include "tlo-file-similarity/compare.hpp"
+#include "tlo-file-similarity/database.hpp"
+#include "tlo-file-similarity/distance.hpp"
+#include "tlo-file-similarity/stats.hpp"
+#include "tlo-file-similarity/trace.hpp"
 
 #include <algorithm>
 #include <exception>
 #include <fstream>
 #include <functional>
 #include <mutex>
+#include <stdexcept>
+#include <string_view>
 #include <thread>
 #include <tlo-cpp/damerau-levenshtein.hpp>
 #include <tlo-cpp/filesystem.hpp>
@@ -13,27 +19,40 @@
 #include <tlo-cpp/levenshtein.hpp>
 #include <tlo-cpp/stop.hpp>
 #include <tlo-cpp/string.hpp>
-#include <unordered_set>
+#include <tuple>
 
 namespace fs = std::filesystem;
 
 namespace tfs {
 double compareWithLcsDistance(const std::string &string1,
                               const std::string &string2) {
-  auto lcsDistance = tlo::lcsLength3(string1, string2).lcsDistance;
+  return compareWithLcsDistance(string1, string2, 0.0);
+}
+
+double compareWithLcsDistance(const std::string &string1,
+                              const std::string &string2,
+                              double minSimilarityScore) {
   auto maxLcsDistance = tlo::maxLcsDistance(string1.size(), string2.size());
 
   if (maxLcsDistance == 0) {
     return 100.0;
   }
 
+  // The score is 2 * lcsLength / maxLcsDistance * 100, so this is the
+  // smallest length that can reach minSimilarityScore, rounded down to stay
+  // on the safe side of floating point error.
+  auto minLcsLength = static_cast<std::size_t>(
+      std::max(0.0, minSimilarityScore * maxLcsDistance / 200.0));
+  auto lcsDistance = string1.size() + string2.size() -
+                     2 * lcsLength(string1, string2, minLcsLength);
+
   return static_cast<double>(maxLcsDistance - lcsDistance) / maxLcsDistance *
          100.0;
 }
 
 double compareWithLevenshteinDistance(const std::string &string1,
                                       const std::string &string2) {
-  auto levenshteinDistance = tlo::levenshteinDistance3(string1, string2);
+  auto levenshteinDistance = tfs::levenshteinDistance(string1, string2);
   auto maxLevenshteinDistance =
       tlo::maxLevenshteinDistance(string1.size(), string2.size());
 
@@ -59,6 +78,23 @@ double compareWithDamerLevenDistance(const std::string &string1,
          maxDamerLevenDistance * 100.0;
 }
 
+double compareWithOsaDistance(const std::string &string1,
+                              const std::string &string2) {
+  auto osaDistance = tfs::osaDistance(string1, string2);
+
+  // A string can always be turned into another with at most as many edits as
+  // there are characters in the longer string, with or without transpositions.
+  auto maxOsaDistance =
+      tlo::maxDamerLevenDistance(string1.size(), string2.size());
+
+  if (maxOsaDistance == 0) {
+    return 100.0;
+  }
+
+  return static_cast<double>(maxOsaDistance - osaDistance) / maxOsaDistance *
+         100.0;
+}
+
 bool hashesAreComparable(const FuzzyHash &hash1, const FuzzyHash &hash2) {
   if (hash1.blockSize == hash2.blockSize) {
     return true;
@@ -71,21 +107,99 @@ bool hashesAreComparable(const FuzzyHash &hash1, const FuzzyHash &hash2) {
   }
 }
 
-double compareHashes(const FuzzyHash &hash1, const FuzzyHash &hash2) {
+namespace {
+// Each metric returns the exact score if it is >= minSimilarityScore, and
+// otherwise may return any lower score.
+struct LcsMetric {
+  static double compare(const std::string &string1, const std::string &string2,
+                        double minSimilarityScore) {
+    return compareWithLcsDistance(string1, string2, minSimilarityScore);
+  }
+};
+
+struct LevenshteinMetric {
+  static double compare(const std::string &string1, const std::string &string2,
+                        double) {
+    return compareWithLevenshteinDistance(string1, string2);
+  }
+};
+
+struct DamerLevenMetric {
+  static double compare(const std::string &string1, const std::string &string2,
+                        double) {
+    return compareWithDamerLevenDistance(string1, string2);
+  }
+};
+
+struct OsaMetric {
+  static double compare(const std::string &string1, const std::string &string2,
+                        double) {
+    return compareWithOsaDistance(string1, string2);
+  }
+};
+
+// Calls function with a default-constructed metric type corresponding to the
+// given metric, so code templated on the metric type only has to branch on
+// the metric once.
+template <typename Function>
+void withMetric(ComparisonMetric metric, Function &&function) {
+  switch (metric) {
+    case ComparisonMetric::LEVENSHTEIN:
+      function(LevenshteinMetric());
+      break;
+    case ComparisonMetric::DAMERAU_LEVENSHTEIN:
+      function(DamerLevenMetric());
+      break;
+    case ComparisonMetric::OSA:
+      function(OsaMetric());
+      break;
+    default:
+      function(LcsMetric());
+      break;
+  }
+}
+
+// Returns the exact score if it is >= minSimilarityScore, and otherwise may
+// return any lower score.
+template <typename Metric>
+double compareHashesWithMetric(const FuzzyHash &hash1, const FuzzyHash &hash2,
+                               double minSimilarityScore) {
   if (hash1.blockSize == hash2.blockSize) {
-    double part1Similarity = compareWithLcsDistance(hash1.part1, hash2.part1);
-    double part2Similarity = compareWithLcsDistance(hash1.part2, hash2.part2);
+    double part1Similarity =
+        Metric::compare(hash1.part1, hash2.part1, minSimilarityScore);
+
+    // part2 only matters if it scores higher than part1.
+    if (part1Similarity >= 100.0) {
+      return part1Similarity;
+    }
+
+    double part2Similarity =
+        Metric::compare(hash1.part2, hash2.part2,
+                        std::max(minSimilarityScore, part1Similarity));
 
     return std::max(part1Similarity, part2Similarity);
   } else if (hash1.blockSize == 2 * hash2.blockSize) {
-    return compareWithLcsDistance(hash1.part1, hash2.part2);
+    return Metric::compare(hash1.part1, hash2.part2, minSimilarityScore);
   } else if (2 * hash1.blockSize == hash2.blockSize) {
-    return compareWithLcsDistance(hash1.part2, hash2.part1);
+    return Metric::compare(hash1.part2, hash2.part1, minSimilarityScore);
   } else {
     throw std::runtime_error("Error: \"" + tlo::toString(hash1) + "\" and \"" +
                              tlo::toString(hash2) + "\" are not comparable.");
   }
 }
+}  // namespace
+
+double compareHashes(const FuzzyHash &hash1, const FuzzyHash &hash2,
+                     ComparisonMetric metric) {
+  double similarityScore = 0.0;
+
+  withMetric(metric, [&](auto metricType) {
+    similarityScore =
+        compareHashesWithMetric<decltype(metricType)>(hash1, hash2, 0.0);
+  });
+
+  return similarityScore;
+}
 
 FuzzyHashFromFile::FuzzyHashFromFile(FuzzyHash &&hash)
     : FuzzyHash(std::move(hash)) {}
@@ -99,38 +213,215 @@ std::size_t HashFuzzyHashFromFile::operator()(
       .getHash();
 }
 
-using HashSet = std::unordered_set<FuzzyHashFromFile, HashFuzzyHashFromFile>;
-
 namespace {
+// Hashes are read from a text file this many bytes at a time.
+constexpr std::size_t READ_BUFFER_SIZE = 16 * 1024 * 1024;
+
+// Text is not split into chunks smaller than this for parallel parsing.
+constexpr std::size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+// Parses each line of text as a hash. Lines may end in "\r\n", since the
+// file is read in binary mode.
+void parseHashes(std::vector<FuzzyHashFromFile> &hashes, std::string_view text,
+                 std::size_t fileIndex, bool recordingSources,
+                 std::exception_ptr &exception) {
+  try {
+    while (!text.empty()) {
+      auto newlinePosition = text.find('\n');
+      std::string_view line = text.substr(0, newlinePosition);
+
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+
+      FuzzyHashFromFile hash(parseHash(line));
+
+      if (recordingSources) {
+        hash.fileIndex = fileIndex;
+      }
+
+      hashes.push_back(std::move(hash));
+
+      if (newlinePosition == std::string_view::npos) {
+        break;
+      }
+
+      text.remove_prefix(newlinePosition + 1);
+    }
+  } catch (...) {
+    exception = std::current_exception();
+  }
+}
+
+// Splits text into at most numThreads chunks that end at line boundaries and
+// parses the chunks in parallel. Adds the hashes to the map in the order they
+// appear in text, numbering them starting from numHashesRead.
+void addHashesInText(HashComparisonMap &blockSizesToHashes,
+                     std::size_t &numHashesRead, std::string_view text,
+                     std::size_t fileIndex, bool recordingSources,
+                     std::size_t numThreads) {
+  std::vector<std::string_view> chunks;
+  const std::size_t chunkSize =
+      std::max(text.size() / std::max(numThreads, std::size_t(1)) + 1,
+               MIN_CHUNK_SIZE);
+
+  while (!text.empty()) {
+    auto newlinePosition =
+        chunkSize < text.size() ? text.find('\n', chunkSize - 1)
+                                : std::string_view::npos;
+
+    if (newlinePosition == std::string_view::npos) {
+      chunks.push_back(text);
+      break;
+    }
+
+    chunks.push_back(text.substr(0, newlinePosition + 1));
+    text.remove_prefix(newlinePosition + 1);
+  }
+
+  std::vector<std::vector<FuzzyHashFromFile>> chunksOfHashes(chunks.size());
+  std::vector<std::exception_ptr> exceptions(chunks.size());
+  std::vector<std::thread> threads(chunks.empty() ? 0 : chunks.size() - 1);
+
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i] = std::thread(parseHashes, std::ref(chunksOfHashes[i + 1]),
+                             chunks[i + 1], fileIndex, recordingSources,
+                             std::ref(exceptions[i + 1]));
+  }
+
+  if (!chunks.empty()) {
+    parseHashes(chunksOfHashes[0], chunks[0], fileIndex, recordingSources,
+                exceptions[0]);
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &exception : exceptions) {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  for (auto &hashes : chunksOfHashes) {
+    for (auto &hash : hashes) {
+      hash.hashIndex = numHashesRead;
+      numHashesRead++;
+      blockSizesToHashes[hash.blockSize].push_back(std::move(hash));
+    }
+  }
+}
+
 void readHashesFromFile(HashComparisonMap &blockSizesToHashes,
-                        HashSet &hashesAdded, const fs::path &textFilePath,
-                        std::size_t fileIndex, bool recordingSources) {
-  std::ifstream ifstream(textFilePath, std::ifstream::in);
+                        std::size_t &numHashesRead,
+                        const fs::path &textFilePath,
+                        std::size_t fileIndex, bool recordingSources,
+                        std::size_t numThreads) {
+  std::ifstream ifstream(textFilePath,
+                         std::ifstream::in | std::ifstream::binary);
 
   if (!ifstream.is_open()) {
     throw std::runtime_error("Error: Failed to open \"" +
                              textFilePath.u8string() + "\".");
   }
 
-  std::string line;
+  // Holds a partial line left over from the previous read followed by the
+  // bytes of the current read.
+  std::string text;
+
+  for (;;) {
+    const std::size_t leftoverSize = text.size();
+
+    text.resize(leftoverSize + READ_BUFFER_SIZE);
+    ifstream.read(text.data() + leftoverSize,
+                  static_cast<std::streamsize>(READ_BUFFER_SIZE));
+    text.resize(leftoverSize + static_cast<std::size_t>(ifstream.gcount()));
+
+    const bool reachedEnd = !ifstream;
+    std::size_t end = text.size();
 
-  while (std::getline(ifstream, line)) {
-    FuzzyHashFromFile hash(parseHash(line));
+    if (!reachedEnd) {
+      auto newlinePosition = text.rfind('\n');
 
-    if (recordingSources) {
-      hash.fileIndex = fileIndex;
+      end = newlinePosition == std::string::npos ? 0 : newlinePosition + 1;
     }
 
-    if (hashesAdded.find(hash) == hashesAdded.end()) {
-      blockSizesToHashes[hash.blockSize].push_back(hash);
-      hashesAdded.insert(std::move(hash));
+    addHashesInText(blockSizesToHashes, numHashesRead,
+                    std::string_view(text.data(), end), fileIndex,
+                    recordingSources, numThreads);
+    text.erase(0, end);
+
+    if (reachedEnd) {
+      break;
     }
   }
 }
+
+// Orders hashes so that hashes with identical parts are next to each other,
+// and among those, hashes with the same fileIndex are next to each other.
+bool hashComesBefore(const FuzzyHashFromFile &hash1,
+                     const FuzzyHashFromFile &hash2) {
+  return std::tie(hash1.part1, hash1.part2, hash1.fileIndex, hash1.filePath,
+                  hash1.hashIndex) <
+         std::tie(hash2.part1, hash2.part2, hash2.fileIndex, hash2.filePath,
+                  hash2.hashIndex);
+}
+
+// Sorts the hashes in each vector with hashComesBefore(). Then removes all but
+// the first read of each hash with the same parts, filePath, and fileIndex.
+// Each hash is only stored in its vector, so no other copy of the hashes is
+// needed to find duplicates. Renumbers the remaining hashes so their hashIndex
+// variables go from 0 to the number of hashes - 1 in the order they were read.
+// Returns the number of hashes.
+std::size_t removeDuplicateHashes(HashComparisonMap &blockSizesToHashes) {
+  std::size_t numHashes = 0;
+
+  for (auto &pair : blockSizesToHashes) {
+    std::vector<FuzzyHashFromFile> &hashes = pair.second;
+
+    std::sort(hashes.begin(), hashes.end(), hashComesBefore);
+
+    auto end = std::unique(
+        hashes.begin(), hashes.end(),
+        [](const FuzzyHashFromFile &hash1, const FuzzyHashFromFile &hash2) {
+          return std::tie(hash1.part1, hash1.part2, hash1.fileIndex,
+                          hash1.filePath) ==
+                 std::tie(hash2.part1, hash2.part2, hash2.fileIndex,
+                          hash2.filePath);
+        });
+
+    hashes.erase(end, hashes.end());
+    hashes.shrink_to_fit();
+    numHashes += hashes.size();
+  }
+
+  std::vector<FuzzyHashFromFile *> hashesInReadOrder;
+
+  hashesInReadOrder.reserve(numHashes);
+
+  for (auto &pair : blockSizesToHashes) {
+    for (auto &hash : pair.second) {
+      hashesInReadOrder.push_back(&hash);
+    }
+  }
+
+  std::sort(hashesInReadOrder.begin(), hashesInReadOrder.end(),
+            [](const FuzzyHashFromFile *hash1, const FuzzyHashFromFile *hash2) {
+              return hash1->hashIndex < hash2->hashIndex;
+            });
+
+  for (std::size_t i = 0; i < hashesInReadOrder.size(); ++i) {
+    hashesInReadOrder[i]->hashIndex = i;
+  }
+
+  return numHashes;
+}
 }  // namespace
 
 std::pair<HashComparisonMap, std::size_t> readHashesForComparison(
-    const std::vector<fs::path> &textFilePaths, bool recordingSources) {
+    const std::vector<fs::path> &textFilePaths, bool recordingSources,
+    std::size_t numThreads) {
   const auto [allFiles, iterator] = tlo::allFiles(textFilePaths);
   if (!allFiles) {
     throw std::runtime_error("Error: \"" + iterator->string() +
@@ -138,96 +429,393 @@ std::pair<HashComparisonMap, std::size_t> readHashesForComparison(
   }
 
   HashComparisonMap blockSizesToHashes;
-  HashSet hashesAdded;
+  std::size_t numHashesRead = 0;
 
   for (std::size_t i = 0; i < textFilePaths.size(); ++i) {
-    readHashesFromFile(blockSizesToHashes, hashesAdded, textFilePaths[i], i,
-                       recordingSources);
+    readHashesFromFile(blockSizesToHashes, numHashesRead, textFilePaths[i], i,
+                       recordingSources, numThreads);
   }
 
-  return std::pair(std::move(blockSizesToHashes), hashesAdded.size());
+  std::size_t numHashes = removeDuplicateHashes(blockSizesToHashes);
+
+  return std::pair(std::move(blockSizesToHashes), numHashes);
+}
+
+bool HashComparisonEventHandler::shouldCompare(const FuzzyHashFromFile &,
+                                               const FuzzyHashFromFile &) {
+  return true;
 }
 
 HashComparisonEventHandler::~HashComparisonEventHandler() = default;
 
-namespace {
-// Compare hash with hashes[startIndex .. end].
-void compareHashWithOthers(const FuzzyHashFromFile &hash,
-                           const std::vector<FuzzyHashFromFile> &hashes,
-                           std::size_t startIndex, int similarityThreshold,
-                           HashComparisonEventHandler &handler) {
-  for (std::size_t j = startIndex; j < hashes.size(); ++j) {
-    if (hashesAreComparable(hash, hashes[j])) {
-      double similarityScore = compareHashes(hash, hashes[j]);
+ComparisonShard parseShard(const std::string &string) {
+  auto slashPosition = string.find('/');
 
-      if (similarityScore >= similarityThreshold) {
-        handler.onSimilarPairFound(hash, hashes[j], similarityScore);
-      }
+  if (slashPosition == std::string::npos) {
+    throw std::runtime_error("Error: Shard \"" + string +
+                             "\" does not have a slash.");
+  }
+
+  ComparisonShard shard;
+
+  try {
+    std::size_t numCharsParsed = 0;
+    std::string index = string.substr(0, slashPosition);
+    std::string count = string.substr(slashPosition + 1);
+
+    shard.index = std::stoull(index, &numCharsParsed);
+
+    if (numCharsParsed != index.size()) {
+      throw std::invalid_argument(index);
+    }
+
+    shard.count = std::stoull(count, &numCharsParsed);
+
+    if (numCharsParsed != count.size()) {
+      throw std::invalid_argument(count);
     }
+  } catch (const std::exception &) {
+    throw std::runtime_error("Error: Shard \"" + string +
+                             "\" has non-integer index or count.");
   }
+
+  if (shard.count == 0 || shard.index >= shard.count) {
+    throw std::runtime_error("Error: Shard \"" + string +
+                             "\" does not have index < count.");
+  }
+
+  return shard;
 }
 
-void compareHashesWithSingleThread(const HashComparisonMap &blockSizesToHashes,
-                                   int similarityThreshold,
-                                   HashComparisonEventHandler &handler) {
-  std::vector<std::size_t> blockSizes;
+namespace {
+// Hashes at indexes [begin, end) of a vector of hashes have identical block
+// sizes and parts, so they only need to be compared with other hashes once.
+struct HashGroup {
+  std::size_t begin;
+  std::size_t end;
+};
+
+// A vector of hashes with the same block size, split into groups of
+// consecutive hashes with identical parts. If crossSourcesOnly is true, the
+// hashes in a group also have the same fileIndex, and sourcesToGroups[i] has
+// the groups whose hashes have fileIndex i. Otherwise, sourcesToGroups[0] has
+// all the groups.
+struct Bucket {
+  std::size_t blockSize;
+  const std::vector<FuzzyHashFromFile> &hashes;
+  std::vector<std::vector<HashGroup>> sourcesToGroups;
+
+  Bucket(std::size_t blockSize_, const std::vector<FuzzyHashFromFile> &hashes_,
+         bool crossSourcesOnly)
+      : blockSize(blockSize_), hashes(hashes_), sourcesToGroups(1) {
+    std::size_t begin = 0;
+
+    while (begin < hashes.size()) {
+      const FuzzyHashFromFile &hash = hashes[begin];
+      std::size_t end = begin + 1;
+
+      while (end < hashes.size() && hashes[end].part1 == hash.part1 &&
+             hashes[end].part2 == hash.part2 &&
+             (!crossSourcesOnly || hashes[end].fileIndex == hash.fileIndex)) {
+        end++;
+      }
+
+      const std::size_t sourceIndex = crossSourcesOnly ? hash.fileIndex : 0;
 
-  for (const auto &pair : blockSizesToHashes) {
-    blockSizes.push_back(pair.first);
+      if (sourceIndex >= sourcesToGroups.size()) {
+        sourcesToGroups.resize(sourceIndex + 1);
+      }
+
+      sourcesToGroups[sourceIndex].push_back({begin, end});
+      begin = end;
+    }
   }
+};
 
-  std::sort(blockSizes.begin(), blockSizes.end());
+// A bucket and the bucket with twice its block size, if there is one. These
+// are the only buckets whose hashes are comparable with the hashes of bucket.
+struct BucketPair {
+  const Bucket &bucket;
+  const Bucket *doubleBucket;
+};
+
+// Buckets for all the vectors in the map, in ascending order of block size.
+class BucketList {
+ private:
+  std::vector<Bucket> buckets;
 
-  for (const auto blockSize : blockSizes) {
-    const std::vector<FuzzyHashFromFile> &hashes =
-        blockSizesToHashes.at(blockSize);
-    const std::vector<FuzzyHashFromFile> *moreHashes = nullptr;
-    const auto iterator = blockSizesToHashes.find(2 * blockSize);
+ public:
+  std::vector<BucketPair> pairs;
 
-    if (iterator != blockSizesToHashes.end()) {
-      moreHashes = &iterator->second;
+  BucketList(const HashComparisonMap &blockSizesToHashes,
+             bool crossSourcesOnly) {
+    std::vector<std::size_t> blockSizes;
+
+    for (const auto &pair : blockSizesToHashes) {
+      blockSizes.push_back(pair.first);
     }
 
-    for (std::size_t i = 0; i < hashes.size(); ++i) {
-      if (tlo::stopRequested.load()) {
+    std::sort(blockSizes.begin(), blockSizes.end());
+    buckets.reserve(blockSizes.size());
+
+    for (const auto blockSize : blockSizes) {
+      buckets.emplace_back(blockSize, blockSizesToHashes.at(blockSize),
+                           crossSourcesOnly);
+    }
+
+    std::size_t j = 0;
+
+    for (const auto &bucket : buckets) {
+      while (j < buckets.size() &&
+             buckets[j].blockSize < 2 * bucket.blockSize) {
+        j++;
+      }
+
+      if (j < buckets.size() && buckets[j].blockSize == 2 * bucket.blockSize) {
+        pairs.push_back({bucket, &buckets[j]});
+      } else {
+        pairs.push_back({bucket, nullptr});
+      }
+    }
+  }
+
+  // Returns nullptr if there is no bucket with the given block size.
+  const Bucket *find(std::size_t blockSize) const {
+    auto iterator = std::lower_bound(
+        buckets.begin(), buckets.end(), blockSize,
+        [](const Bucket &bucket, std::size_t value) {
+          return bucket.blockSize < value;
+        });
+
+    if (iterator == buckets.end() || iterator->blockSize != blockSize) {
+      return nullptr;
+    }
+
+    return &*iterator;
+  }
+};
+
+// Work is split into units where each unit is a group of hashes (in ascending
+// order of block size, then in order of source, then in order within its
+// vector) compared with the comparable groups after it. Unit k belongs to
+// shard k % count. Consecutive units have similar amounts of work, so each
+// shard gets about the same amount of work.
+struct UnitCursor {
+  std::size_t pairIndex = 0;
+  std::size_t sourceIndex = 0;
+  std::size_t groupIndex = 0;
+  std::size_t unitIndex = 0;
+
+  // Moves forward until the cursor is at a group or at the end.
+  void skipEmptySources(const std::vector<BucketPair> &pairs) {
+    while (pairIndex < pairs.size()) {
+      const auto &sourcesToGroups = pairs[pairIndex].bucket.sourcesToGroups;
+
+      if (sourceIndex >= sourcesToGroups.size()) {
+        pairIndex++;
+        sourceIndex = 0;
+        groupIndex = 0;
+      } else if (groupIndex >= sourcesToGroups[sourceIndex].size()) {
+        sourceIndex++;
+        groupIndex = 0;
+      } else {
         break;
       }
+    }
+  }
+
+  bool isAtEnd(const std::vector<BucketPair> &pairs) const {
+    return pairIndex >= pairs.size();
+  }
+
+  void moveToNextUnit(const std::vector<BucketPair> &pairs) {
+    groupIndex++;
+    unitIndex++;
+    skipEmptySources(pairs);
+  }
+
+  bool isInShard(const ComparisonShard &shard) const {
+    return unitIndex % shard.count == shard.index;
+  }
+};
+}  // namespace
+
+std::size_t numHashesInShard(const HashComparisonMap &blockSizesToHashes,
+                             const ComparisonShard &shard,
+                             bool crossSourcesOnly) {
+  const BucketList bucketList(blockSizesToHashes, crossSourcesOnly);
+  const std::vector<BucketPair> &pairs = bucketList.pairs;
+  std::size_t numHashes = 0;
+  UnitCursor cursor;
+
+  for (cursor.skipEmptySources(pairs); !cursor.isAtEnd(pairs);
+       cursor.moveToNextUnit(pairs)) {
+    if (cursor.isInShard(shard)) {
+      const HashGroup &group = pairs[cursor.pairIndex]
+                                   .bucket.sourcesToGroups[cursor.sourceIndex]
+                                                          [cursor.groupIndex];
+
+      numHashes += group.end - group.begin;
+    }
+  }
+
+  return numHashes;
+}
+
+namespace {
+constexpr double IDENTICAL_SIMILARITY_SCORE = 100.0;
+
+// Reports every pair of hashes within group as similar without scoring them.
+void compareHashesInGroup(const std::vector<FuzzyHashFromFile> &hashes,
+                          const HashGroup &group, int similarityThreshold,
+                          HashComparisonEventHandler &handler) {
+  if (IDENTICAL_SIMILARITY_SCORE < similarityThreshold) {
+    return;
+  }
+
+  for (std::size_t i = group.begin; i < group.end; ++i) {
+    for (std::size_t j = i + 1; j < group.end; ++j) {
+      if (handler.shouldCompare(hashes[i], hashes[j])) {
+        handler.onSimilarPairFound(hashes[i], hashes[j],
+                                   IDENTICAL_SIMILARITY_SCORE);
+      }
+    }
+  }
+}
+
+// Compare group with otherGroups[startIndex .. end]. Only the first hash of
+// each group is scored. If the score is high enough, every hash in group is
+// reported as similar to every hash in the other group.
+template <typename Metric>
+void compareGroupWithOthers(const std::vector<FuzzyHashFromFile> &hashes,
+                            const HashGroup &group,
+                            const std::vector<FuzzyHashFromFile> &otherHashes,
+                            const std::vector<HashGroup> &otherGroups,
+                            std::size_t startIndex, int similarityThreshold,
+                            HashComparisonEventHandler &handler) {
+  const FuzzyHashFromFile &hash = hashes[group.begin];
+  StatCounters &counters = threadStatCounters();
+
+  for (std::size_t j = startIndex; j < otherGroups.size(); ++j) {
+    const HashGroup &otherGroup = otherGroups[j];
+    const FuzzyHashFromFile &otherHash = otherHashes[otherGroup.begin];
+
+    counters.comparisonsAttempted++;
+
+    if (!hashesAreComparable(hash, otherHash) ||
+        !handler.shouldCompare(hash, otherHash)) {
+      counters.comparisonsPruned++;
+    } else {
+      double similarityScore =
+          compareHashesWithMetric<Metric>(hash, otherHash, similarityThreshold);
+
+      if (similarityScore >= similarityThreshold) {
+        counters.comparisonsMatched++;
+
+        for (std::size_t k = group.begin; k < group.end; ++k) {
+          for (std::size_t l = otherGroup.begin; l < otherGroup.end; ++l) {
+            handler.onSimilarPairFound(hashes[k], otherHashes[l],
+                                       similarityScore);
+          }
+        }
+      }
+    }
+  }
+}
 
-      compareHashWithOthers(hashes[i], hashes, i + 1, similarityThreshold,
-                            handler);
+// Does the unit of work at the cursor. If crossSourcesOnly is true, groups are
+// only compared with groups of other sources.
+template <typename Metric>
+void compareGroupWithComparableGroups(const std::vector<BucketPair> &pairs,
+                                      const UnitCursor &cursor,
+                                      int similarityThreshold,
+                                      HashComparisonEventHandler &handler,
+                                      bool crossSourcesOnly) {
+  const BucketPair &pair = pairs[cursor.pairIndex];
+  const Bucket &bucket = pair.bucket;
+  const std::vector<FuzzyHashFromFile> &hashes = bucket.hashes;
+  const HashGroup &group =
+      bucket.sourcesToGroups[cursor.sourceIndex][cursor.groupIndex];
+
+  if (!crossSourcesOnly) {
+    compareHashesInGroup(hashes, group, similarityThreshold, handler);
+  }
 
-      if (moreHashes) {
-        compareHashWithOthers(hashes[i], *moreHashes, 0, similarityThreshold,
-                              handler);
+  for (std::size_t i = cursor.sourceIndex; i < bucket.sourcesToGroups.size();
+       ++i) {
+    if (i == cursor.sourceIndex && crossSourcesOnly) {
+      continue;
+    }
+
+    std::size_t startIndex =
+        i == cursor.sourceIndex ? cursor.groupIndex + 1 : 0;
+
+    compareGroupWithOthers<Metric>(hashes, group, hashes,
+                                   bucket.sourcesToGroups[i], startIndex,
+                                   similarityThreshold, handler);
+  }
+
+  if (pair.doubleBucket) {
+    const Bucket &doubleBucket = *pair.doubleBucket;
+
+    for (std::size_t i = 0; i < doubleBucket.sourcesToGroups.size(); ++i) {
+      if (i == cursor.sourceIndex && crossSourcesOnly) {
+        continue;
       }
 
-      handler.onHashDone();
+      compareGroupWithOthers<Metric>(hashes, group, doubleBucket.hashes,
+                                     doubleBucket.sourcesToGroups[i], 0,
+                                     similarityThreshold, handler);
+    }
+  }
+
+  for (std::size_t i = group.begin; i < group.end; ++i) {
+    handler.onHashDone();
+  }
+}
+
+// Calls doUnit(cursor) for each unit of work in the shard.
+template <typename DoUnit>
+void doUnitsWithSingleThread(const std::vector<BucketPair> &pairs,
+                             const ComparisonShard &shard, DoUnit &doUnit) {
+  UnitCursor cursor;
+
+  for (cursor.skipEmptySources(pairs); !cursor.isAtEnd(pairs);
+       cursor.moveToNextUnit(pairs)) {
+    if (tlo::stopRequested.load()) {
+      break;
     }
+
+    if (!cursor.isInShard(shard)) {
+      continue;
+    }
+
+    const TraceSpan span("compareUnit", "compare");
+
+    doUnit(static_cast<const UnitCursor &>(cursor));
   }
 }
 
+template <typename DoUnit>
 struct SharedState {
-  const std::vector<std::size_t> &blockSizes;
-  const HashComparisonMap &blockSizesToHashes;
-  const int similarityThreshold;
-  HashComparisonEventHandler &handler;
+  const std::vector<BucketPair> &pairs;
+  const ComparisonShard &shard;
+  DoUnit &doUnit;
 
   std::mutex indexMutex;
   bool exceptionThrown = false;
-  std::size_t blockSizeIndex = 0;
-  std::size_t hashIndex = 0;
-
-  SharedState(const std::vector<std::size_t> &blockSizes_,
-              const HashComparisonMap &blockSizesToHashes_,
-              int similarityThreshold_, HashComparisonEventHandler &handler_)
-      : blockSizes(blockSizes_),
-        blockSizesToHashes(blockSizesToHashes_),
-        similarityThreshold(similarityThreshold_),
-        handler(handler_) {}
+  UnitCursor cursor;
+
+  SharedState(const std::vector<BucketPair> &pairs_,
+              const ComparisonShard &shard_, DoUnit &doUnit_)
+      : pairs(pairs_), shard(shard_), doUnit(doUnit_) {
+    cursor.skipEmptySources(pairs);
+  }
 };
 
-void compareHashAtIndexWithComparableHashes(SharedState &state,
-                                            std::exception_ptr &exception) {
+template <typename DoUnit>
+void doUnitAtCursor(SharedState<DoUnit> &state,
+                    std::exception_ptr &exception) {
   try {
     for (;;) {
       std::unique_lock<std::mutex> indexUniqueLock(state.indexMutex);
@@ -236,7 +824,7 @@ void compareHashAtIndexWithComparableHashes(SharedState &state,
         break;
       }
 
-      if (state.blockSizeIndex >= state.blockSizes.size()) {
+      if (state.cursor.isAtEnd(state.pairs)) {
         break;
       }
 
@@ -244,36 +832,18 @@ void compareHashAtIndexWithComparableHashes(SharedState &state,
         break;
       }
 
-      const std::size_t blockSize = state.blockSizes[state.blockSizeIndex];
-      const std::vector<FuzzyHashFromFile> &hashes =
-          state.blockSizesToHashes.at(blockSize);
-      const std::size_t i = state.hashIndex;
-
-      state.hashIndex++;
-
-      if (state.hashIndex >= hashes.size()) {
-        state.blockSizeIndex++;
-        state.hashIndex = 0;
-      }
+      const UnitCursor cursor = state.cursor;
 
+      state.cursor.moveToNextUnit(state.pairs);
       indexUniqueLock.unlock();
 
-      const std::vector<FuzzyHashFromFile> *moreHashes = nullptr;
-      const auto iterator = state.blockSizesToHashes.find(2 * blockSize);
-
-      if (iterator != state.blockSizesToHashes.end()) {
-        moreHashes = &iterator->second;
+      if (!cursor.isInShard(state.shard)) {
+        continue;
       }
 
-      compareHashWithOthers(hashes[i], hashes, i + 1, state.similarityThreshold,
-                            state.handler);
-
-      if (moreHashes) {
-        compareHashWithOthers(hashes[i], *moreHashes, 0,
-                              state.similarityThreshold, state.handler);
-      }
+      const TraceSpan span("compareUnit", "compare");
 
-      state.handler.onHashDone();
+      state.doUnit(cursor);
     }
   } catch (...) {
     std::lock_guard<std::mutex> indexLockGuard(state.indexMutex);
@@ -283,28 +853,22 @@ void compareHashAtIndexWithComparableHashes(SharedState &state,
   }
 }
 
-void compareHashesWithMultipleThreads(
-    const HashComparisonMap &blockSizesToHashes, int similarityThreshold,
-    HashComparisonEventHandler &handler, std::size_t numThreads) {
-  std::vector<std::size_t> blockSizes;
-
-  for (const auto &pair : blockSizesToHashes) {
-    blockSizes.push_back(pair.first);
-  }
-
-  std::sort(blockSizes.begin(), blockSizes.end());
-
-  SharedState state(blockSizes, blockSizesToHashes, similarityThreshold,
-                    handler);
+// Calls doUnit(cursor) for each unit of work in the shard using numThreads
+// threads.
+template <typename DoUnit>
+void doUnitsWithMultipleThreads(const std::vector<BucketPair> &pairs,
+                                const ComparisonShard &shard,
+                                DoUnit &doUnit, std::size_t numThreads) {
+  SharedState<DoUnit> state(pairs, shard, doUnit);
   std::vector<std::exception_ptr> exceptions(numThreads);
   std::vector<std::thread> threads(numThreads - 1);
 
   for (std::size_t i = 0; i < threads.size(); ++i) {
-    threads[i] = std::thread(compareHashAtIndexWithComparableHashes,
-                             std::ref(state), std::ref(exceptions[i + 1]));
+    threads[i] = std::thread(doUnitAtCursor<DoUnit>, std::ref(state),
+                             std::ref(exceptions[i + 1]));
   }
 
-  compareHashAtIndexWithComparableHashes(state, exceptions[0]);
+  doUnitAtCursor(state, exceptions[0]);
 
   for (auto &thread : threads) {
     thread.join();
@@ -316,17 +880,255 @@ void compareHashesWithMultipleThreads(
     }
   }
 }
+
+template <typename DoUnit>
+void doUnits(const std::vector<BucketPair> &pairs,
+             const ComparisonShard &shard, DoUnit &doUnit,
+             std::size_t numThreads) {
+  if (numThreads <= 1) {
+    doUnitsWithSingleThread(pairs, shard, doUnit);
+  } else {
+    doUnitsWithMultipleThreads(pairs, shard, doUnit, numThreads);
+  }
+}
+
+// Compares each group of hashes in bucketList with the groups of the comparable
+// buckets findOtherBucket() returns, given a block size. findOtherBucket()
+// returns nullptr if there is no bucket with the block size.
+template <typename FindOtherBucket>
+void compareBucketsWithOthers(const BucketList &bucketList,
+                              FindOtherBucket &&findOtherBucket,
+                              int similarityThreshold,
+                              HashComparisonEventHandler &handler,
+                              std::size_t numThreads,
+                              ComparisonMetric metric) {
+  withMetric(metric, [&](auto metricType) {
+    using Metric = decltype(metricType);
+
+    auto doUnit = [&](const UnitCursor &cursor) {
+      const Bucket &bucket = bucketList.pairs[cursor.pairIndex].bucket;
+      const HashGroup &group =
+          bucket.sourcesToGroups[cursor.sourceIndex][cursor.groupIndex];
+      const Bucket *otherBuckets[] = {
+          bucket.blockSize % 2 == 0 ? findOtherBucket(bucket.blockSize / 2)
+                                    : nullptr,
+          findOtherBucket(bucket.blockSize),
+          findOtherBucket(2 * bucket.blockSize)};
+
+      for (const Bucket *otherBucket : otherBuckets) {
+        if (!otherBucket) {
+          continue;
+        }
+
+        for (const auto &otherGroups : otherBucket->sourcesToGroups) {
+          compareGroupWithOthers<Metric>(bucket.hashes, group,
+                                         otherBucket->hashes, otherGroups, 0,
+                                         similarityThreshold, handler);
+        }
+      }
+
+      for (std::size_t i = group.begin; i < group.end; ++i) {
+        handler.onHashDone();
+      }
+    };
+
+    doUnits(bucketList.pairs, ComparisonShard(), doUnit, numThreads);
+  });
+}
 }  // namespace
 
 void compareHashes(const HashComparisonMap &blockSizesToHashes,
                    int similarityThreshold, HashComparisonEventHandler &handler,
-                   std::size_t numThreads) {
-  if (numThreads <= 1) {
-    compareHashesWithSingleThread(blockSizesToHashes, similarityThreshold,
-                                  handler);
-  } else {
-    compareHashesWithMultipleThreads(blockSizesToHashes, similarityThreshold,
-                                     handler, numThreads);
+                   std::size_t numThreads, const ComparisonShard &shard,
+                   bool crossSourcesOnly, ComparisonMetric metric) {
+  const BucketList bucketList(blockSizesToHashes, crossSourcesOnly);
+
+  withMetric(metric, [&](auto metricType) {
+    auto doUnit = [&](const UnitCursor &cursor) {
+      compareGroupWithComparableGroups<decltype(metricType)>(
+          bucketList.pairs, cursor, similarityThreshold, handler,
+          crossSourcesOnly);
+    };
+
+    doUnits(bucketList.pairs, shard, doUnit, numThreads);
+  });
+}
+
+void compareHashesWithOthers(const HashComparisonMap &blockSizesToHashes,
+                             const HashComparisonMap &otherBlockSizesToHashes,
+                             int similarityThreshold,
+                             HashComparisonEventHandler &handler,
+                             std::size_t numThreads, ComparisonMetric metric) {
+  const BucketList bucketList(blockSizesToHashes, false);
+  const BucketList otherBucketList(otherBlockSizesToHashes, false);
+
+  compareBucketsWithOthers(
+      bucketList,
+      [&](std::size_t blockSize) { return otherBucketList.find(blockSize); },
+      similarityThreshold, handler, numThreads, metric);
+}
+
+// Buckets of the hashes in the index, by block size. Each bucket refers to a
+// vector in blockSizesToHashes, which stays at the same address while the
+// index exists.
+struct HashComparisonIndex::Buckets {
+  std::unordered_map<std::size_t, Bucket> blockSizesToBuckets;
+
+  void regroup(std::size_t blockSize,
+               const std::vector<FuzzyHashFromFile> &hashes) {
+    blockSizesToBuckets.erase(blockSize);
+
+    if (!hashes.empty()) {
+      blockSizesToBuckets.emplace(blockSize, Bucket(blockSize, hashes, false));
+    }
+  }
+
+  const Bucket *find(std::size_t blockSize) const {
+    auto iterator = blockSizesToBuckets.find(blockSize);
+
+    if (iterator == blockSizesToBuckets.end()) {
+      return nullptr;
+    }
+
+    return &iterator->second;
+  }
+};
+
+HashComparisonIndex::HashComparisonIndex()
+    : buckets(std::make_unique<Buckets>()) {}
+
+HashComparisonIndex::~HashComparisonIndex() = default;
+
+std::size_t HashComparisonIndex::size() const { return numHashes; }
+
+const HashComparisonMap &HashComparisonIndex::hashes() const {
+  return blockSizesToHashes;
+}
+
+void HashComparisonIndex::insert(HashComparisonMap &&newBlockSizesToHashes) {
+  for (auto &pair : newBlockSizesToHashes) {
+    std::vector<FuzzyHashFromFile> &newHashes = pair.second;
+
+    if (newHashes.empty()) {
+      continue;
+    }
+
+    std::vector<FuzzyHashFromFile> &hashes = blockSizesToHashes[pair.first];
+    const auto middle = static_cast<std::ptrdiff_t>(hashes.size());
+
+    // Only the new hashes need sorting. Merging them in keeps the vector
+    // sorted.
+    std::sort(newHashes.begin(), newHashes.end(), hashComesBefore);
+    hashes.insert(hashes.end(), std::make_move_iterator(newHashes.begin()),
+                  std::make_move_iterator(newHashes.end()));
+    std::inplace_merge(hashes.begin(), hashes.begin() + middle, hashes.end(),
+                       hashComesBefore);
+    numHashes += newHashes.size();
+    buckets->regroup(pair.first, hashes);
+  }
+}
+
+std::size_t HashComparisonIndex::erase(
+    const std::unordered_set<std::string> &filePaths) {
+  std::size_t numErased = 0;
+
+  for (auto &pair : blockSizesToHashes) {
+    std::vector<FuzzyHashFromFile> &hashes = pair.second;
+    auto end = std::remove_if(hashes.begin(), hashes.end(),
+                              [&](const FuzzyHashFromFile &hash) {
+                                return filePaths.count(hash.filePath) > 0;
+                              });
+
+    if (end != hashes.end()) {
+      numErased += static_cast<std::size_t>(hashes.end() - end);
+      hashes.erase(end, hashes.end());
+      buckets->regroup(pair.first, hashes);
+    }
+  }
+
+  numHashes -= numErased;
+  return numErased;
+}
+
+void HashComparisonIndex::compare(
+    const HashComparisonMap &newBlockSizesToHashes, int similarityThreshold,
+    HashComparisonEventHandler &handler, std::size_t numThreads,
+    ComparisonMetric metric) const {
+  const BucketList bucketList(newBlockSizesToHashes, false);
+
+  compareBucketsWithOthers(
+      bucketList,
+      [&](std::size_t blockSize) { return buckets->find(blockSize); },
+      similarityThreshold, handler, numThreads, metric);
+}
+
+namespace {
+// Appends the hashes in the database with the given block size to hashes,
+// numbering them starting from numHashesRead.
+void readHashesWithBlockSize(FuzzyHashDatabase &database,
+                             std::size_t blockSize,
+                             std::vector<FuzzyHashFromFile> &hashes,
+                             std::size_t &numHashesRead) {
+  std::vector<FuzzyHash> results;
+
+  database.getHashesWithBlockSize(results, blockSize);
+  hashes.reserve(hashes.size() + results.size());
+
+  for (auto &result : results) {
+    hashes.emplace_back(std::move(result));
+    hashes.back().hashIndex = numHashesRead++;
+  }
+}
+}  // namespace
+
+void compareHashesInDatabase(FuzzyHashDatabase &database,
+                             int similarityThreshold,
+                             HashComparisonEventHandler &handler,
+                             std::size_t numThreads, ComparisonMetric metric) {
+  const std::vector<std::size_t> blockSizes = database.getBlockSizes();
+  std::vector<FuzzyHashFromFile> hashes;
+  std::vector<FuzzyHashFromFile> doubleHashes;
+  std::size_t numHashesRead = 0;
+
+  for (std::size_t i = 0; i < blockSizes.size(); ++i) {
+    if (tlo::stopRequested.load()) {
+      break;
+    }
+
+    const std::size_t blockSize = blockSizes[i];
+
+    // The hashes with this block size were already read as the double hashes
+    // of the previous block size.
+    if (i > 0 && 2 * blockSizes[i - 1] == blockSize) {
+      hashes = std::move(doubleHashes);
+    } else {
+      hashes.clear();
+      readHashesWithBlockSize(database, blockSize, hashes, numHashesRead);
+    }
+
+    doubleHashes.clear();
+
+    const bool hasDoubleBucket =
+        i + 1 < blockSizes.size() && blockSizes[i + 1] == 2 * blockSize;
+
+    if (hasDoubleBucket) {
+      readHashesWithBlockSize(database, 2 * blockSize, doubleHashes,
+                              numHashesRead);
+    }
+
+    const Bucket bucket(blockSize, hashes, false);
+    const Bucket doubleBucket(2 * blockSize, doubleHashes, false);
+    const std::vector<BucketPair> pairs{
+        {bucket, hasDoubleBucket ? &doubleBucket : nullptr}};
+
+    withMetric(metric, [&](auto metricType) {
+      auto doUnit = [&](const UnitCursor &cursor) {
+        compareGroupWithComparableGroups<decltype(metricType)>(
+            pairs, cursor, similarityThreshold, handler, false);
+      };
+
+      doUnits(pairs, ComparisonShard(), doUnit, numThreads);
+    });
   }
 }
 }  // namespace tfs
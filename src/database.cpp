@@ -1,7 +1,17 @@
 #include "tlo-file-similarity/database.hpp"
+#include "tlo-file-similarity/trace.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
 #include <tlo-cpp/stop.hpp>
-#include <tlo-cpp/string.hpp>
+#include <utility>
 
 namespace fs = std::filesystem;
 
@@ -16,45 +26,373 @@ FuzzyHashRow::FuzzyHashRow(std::string &&filePath_) {
   filePath = std::move(filePath_);
 }
 
+void FuzzyHashDatabase::EventHandler::onRowInsert() {}
+void FuzzyHashDatabase::EventHandler::onRowUpdate() {}
+void FuzzyHashDatabase::EventHandler::onRowUpsert() {}
 FuzzyHashDatabase::EventHandler::~EventHandler() = default;
 
 namespace {
-constexpr std::string_view CREATE_TABLE_FUZZY_HASH =
-    R"sql(CREATE TABLE IF NOT EXISTS FuzzyHash (
+// Write-ahead logging lets readers run alongside the writer, and with it,
+// synchronous = NORMAL only syncs at checkpoints instead of at every commit.
+// A negative cache_size is in KiB, so the page cache can grow to 64 MiB.
+constexpr std::string_view PRAGMA_JOURNAL_MODE = "PRAGMA journal_mode = WAL;";
+constexpr std::string_view PRAGMA_SYNCHRONOUS = "PRAGMA synchronous = NORMAL;";
+constexpr std::string_view PRAGMA_CACHE_SIZE = "PRAGMA cache_size = -65536;";
+
+// Lets vacuum() free pages incrementally. Only takes effect when the database
+// is created or vacuumed, so it must come before PRAGMA_JOURNAL_MODE, which
+// writes the header of a new database. Setting it takes a write lock, so it is
+// only set on new databases, where no other connection can be writing.
+constexpr std::string_view PRAGMA_AUTO_VACUUM =
+    "PRAGMA auto_vacuum = INCREMENTAL;";
+constexpr std::string_view SELECT_NUM_TABLES =
+    "SELECT COUNT(*) FROM sqlite_master;";
+constexpr std::string_view SELECT_AUTO_VACUUM = "PRAGMA auto_vacuum;";
+constexpr sqlite3_int64 AUTO_VACUUM_INCREMENTAL = 2;
+
+// Version 0 had a single FuzzyHash table with the full path of each file.
+constexpr sqlite3_int64 SCHEMA_VERSION = 1;
+
+constexpr std::string_view SELECT_SCHEMA_VERSION = "PRAGMA user_version;";
+
+// Each directory's path is stored once, with a trailing separator so the
+// paths of its files are its path followed by their names. A directory is
+// stored when the first hash of a file in it is.
+constexpr std::string_view CREATE_TABLE_DIRECTORY =
+    R"sql(CREATE TABLE IF NOT EXISTS Directory (
+  id INTEGER PRIMARY KEY,
+  path TEXT UNIQUE NOT NULL
+);)sql";
+
+constexpr std::string_view CREATE_TABLE_FILE_HASH =
+    R"sql(CREATE TABLE IF NOT EXISTS FileHash (
+  directoryId INTEGER NOT NULL REFERENCES Directory(id),
+  name TEXT NOT NULL,
   blockSize INTEGER NOT NULL,
   part1 TEXT NOT NULL,
   part2 TEXT NOT NULL,
-  filePath TEXT PRIMARY KEY NOT NULL,
   fileSize INTEGER NOT NULL,
-  fileLastWriteTime TEXT NOT NULL
+  fileLastWriteTime TEXT NOT NULL,
+  PRIMARY KEY (directoryId, name)
+) WITHOUT ROWID;)sql";
+
+constexpr std::string_view CREATE_INDEX_FILE_HASH_BLOCK_SIZE =
+    "CREATE INDEX IF NOT EXISTS FileHashBlockSize ON FileHash(blockSize);";
+
+constexpr std::string_view SELECT_VERSION_0_TABLE =
+    "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = "
+    "'FuzzyHash';";
+constexpr std::string_view SELECT_VERSION_0_HASHES =
+    "SELECT blockSize, part1, part2, filePath, fileSize, fileLastWriteTime "
+    "FROM FuzzyHash;";
+constexpr std::string_view DROP_VERSION_0_TABLE = "DROP TABLE FuzzyHash;";
+
+// Holds the file paths getHashesForFiles() and deleteHashesForFiles() are
+// working on, so they can be joined with FileHash no matter how many there
+// are. Temporary tables are private to the connection.
+constexpr std::string_view CREATE_TABLE_FILE_PATH_TO_FIND =
+    R"sql(CREATE TEMP TABLE IF NOT EXISTS FilePathToFind (
+  directoryPath TEXT NOT NULL,
+  name TEXT NOT NULL,
+  PRIMARY KEY (directoryPath, name)
 );)sql";
 
+constexpr std::string_view INSERT_FILE_PATH_TO_FIND =
+    "INSERT OR IGNORE INTO FilePathToFind VALUES(:directoryPath, :name);";
+constexpr std::string_view DELETE_FILE_PATHS_TO_FIND =
+    "DELETE FROM FilePathToFind;";
+
+// Number of file paths stored in FilePathToFind at a time.
+constexpr std::size_t FILE_PATH_CHUNK_SIZE = 10000;
+
+constexpr std::string_view SELECT_DIRECTORY_ID =
+    "SELECT id FROM Directory WHERE path = :path;";
+constexpr std::string_view INSERT_DIRECTORY =
+    "INSERT INTO Directory(path) VALUES(:path);";
+
 constexpr std::string_view INSERT_FUZZY_HASH =
-    "INSERT INTO FuzzyHash VALUES(:blockSize, :part1, :part2, :filePath, "
-    ":fileSize, :fileLastWriteTime);";
+    "INSERT INTO FileHash VALUES(:directoryId, :name, :blockSize, :part1, "
+    ":part2, :fileSize, :fileLastWriteTime);";
+
+constexpr std::string_view UPSERT_FUZZY_HASH =
+    "INSERT INTO FileHash VALUES(:directoryId, :name, :blockSize, :part1, "
+    ":part2, :fileSize, :fileLastWriteTime) ON CONFLICT(directoryId, name) DO "
+    "UPDATE SET blockSize = excluded.blockSize, part1 = excluded.part1, part2 "
+    "= excluded.part2, fileSize = excluded.fileSize, fileLastWriteTime = "
+    "excluded.fileLastWriteTime;";
 
-constexpr std::string_view SELECT_FUZZY_HASHES_IN =
-    "SELECT * FROM FuzzyHash WHERE filePath IN (";
-constexpr std::string_view SELECT_FUZZY_HASHES_GLOB =
-    "SELECT * FROM FuzzyHash WHERE filePath GLOB :filePathPattern;";
+constexpr std::string_view SELECT_FUZZY_HASH =
+    "SELECT blockSize, part1, part2, path || FileHash.name AS filePath, "
+    "fileSize, fileLastWriteTime FROM Directory JOIN FileHash ON directoryId = "
+    "Directory.id WHERE path = :directoryPath AND FileHash.name = :name;";
+constexpr std::string_view SELECT_FUZZY_HASHES_TO_FIND =
+    "SELECT blockSize, part1, part2, path || FileHash.name AS filePath, "
+    "fileSize, fileLastWriteTime FROM FilePathToFind JOIN Directory ON path = "
+    "directoryPath JOIN FileHash ON directoryId = Directory.id AND "
+    "FileHash.name = FilePathToFind.name;";
+// Scans only the part of the index on Directory.path between the bounds, then
+// the files of each directory found.
+constexpr std::string_view SELECT_FUZZY_HASHES_IN_RANGE =
+    "SELECT blockSize, part1, part2, path || FileHash.name AS filePath, "
+    "fileSize, fileLastWriteTime FROM Directory JOIN FileHash ON directoryId = "
+    "Directory.id WHERE path >= :lowerBound AND path < :upperBound;";
+constexpr std::string_view SELECT_FUZZY_HASHES_WITH_BLOCK_SIZE =
+    "SELECT blockSize, part1, part2, path || FileHash.name AS filePath, "
+    "fileSize, fileLastWriteTime FROM FileHash JOIN Directory ON Directory.id "
+    "= directoryId WHERE blockSize = :blockSize ORDER BY part1, part2, "
+    "filePath;";
+
+constexpr std::string_view SELECT_BLOCK_SIZES =
+    "SELECT DISTINCT blockSize FROM FileHash ORDER BY blockSize;";
+constexpr std::string_view SELECT_NUM_HASHES = "SELECT COUNT(*) FROM FileHash;";
 
 constexpr std::string_view UPDATE_FUZZY_HASH =
-    "UPDATE FuzzyHash SET blockSize = :blockSize, part1 = :part1, part2 = "
+    "UPDATE FileHash SET blockSize = :blockSize, part1 = :part1, part2 = "
     ":part2, fileSize = :fileSize, fileLastWriteTime = :fileLastWriteTime "
-    "WHERE filePath = :filePath;";
+    "WHERE directoryId = :directoryId AND name = :name;";
+
+// Orders the hashes the same way sortFilePathsByDirectory() orders file paths.
+constexpr std::string_view SELECT_FILE_PATHS_IN_RANGE =
+    "SELECT Directory.id, path, FileHash.name FROM Directory JOIN FileHash ON "
+    "directoryId = Directory.id WHERE path >= :lowerBound AND path < "
+    ":upperBound ORDER BY path, FileHash.name;";
+constexpr std::string_view DELETE_FUZZY_HASH =
+    "DELETE FROM FileHash WHERE directoryId = :directoryId AND name = :name;";
 
-constexpr std::string_view DELETE_FUZZY_HASHES_IN =
-    "DELETE FROM FuzzyHash WHERE filePath IN (";
+constexpr std::string_view DELETE_FUZZY_HASHES_TO_FIND =
+    "DELETE FROM FileHash WHERE (directoryId, name) IN (SELECT Directory.id, "
+    "FilePathToFind.name FROM FilePathToFind JOIN Directory ON path = "
+    "directoryPath);";
+
+#ifdef _WIN32
+constexpr std::string_view SEPARATORS = "/\\";
+#else
+constexpr std::string_view SEPARATORS = "/";
+#endif
+
+// Splits path into the path of its directory, including the trailing
+// separator, and its name. The directory of a path without separators is "".
+std::pair<std::string, std::string> splitPath(std::string_view path) {
+  const std::size_t index = path.find_last_of(SEPARATORS);
+
+  if (index == std::string_view::npos) {
+    return {std::string(), std::string(path)};
+  }
+
+  return {std::string(path.substr(0, index + 1)),
+          std::string(path.substr(index + 1))};
+}
 }  // namespace
 
+struct FuzzyHashDatabase::Writer {
+  std::size_t queueCapacity;
+  std::mutex mutex;
+  std::condition_variable hashesQueued;
+  std::condition_variable hashesTaken;
+  std::deque<FuzzyHashRow> queue;
+  bool finishing = false;
+  std::exception_ptr exception;
+  std::thread thread;
+
+  explicit Writer(std::size_t queueCapacity_)
+      : queueCapacity(queueCapacity_) {}
+};
+
+class FuzzyHashDatabase::Transaction {
+ private:
+  FuzzyHashDatabase &database;
+  bool open = false;
+
+ public:
+  std::size_t numRows = 0;
+
+  explicit Transaction(FuzzyHashDatabase &database_) : database(database_) {}
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+  ~Transaction() { rollback(); }
+
+  bool isOpen() const { return open; }
+
+  void begin() {
+    database.beginTransaction();
+    open = true;
+    numRows = 0;
+  }
+
+  // Stays open if COMMIT fails, so it is still rolled back.
+  void commit() {
+    database.commitTransaction();
+    open = false;
+  }
+
+  // Does nothing if the transaction is not open. Ignores errors, since it is
+  // called while handling another one. Forgets the cached directory ids, since
+  // the directories inserted in the transaction are gone.
+  void rollback() {
+    if (!open) {
+      return;
+    }
+
+    open = false;
+    database.directoryIds.clear();
+
+    try {
+      tlo::Sqlite3Statement(database.connection, "ROLLBACK;").step();
+    } catch (...) {
+    }
+  }
+};
+
+FuzzyHashDatabase::FuzzyHashDatabase() = default;
+
+FuzzyHashDatabase::~FuzzyHashDatabase() {
+  if (writer) {
+    try {
+      finishWriting();
+    } catch (...) {
+    }
+  }
+}
+
 void FuzzyHashDatabase::open(const fs::path &dbFilePath) {
+  const TraceSpan span("open", "database",
+                       [&] { return dbFilePath.u8string(); });
+
   connection.open(dbFilePath);
+  filePath = dbFilePath;
+
+  tlo::Sqlite3Statement selectNumTables(connection, SELECT_NUM_TABLES);
+
+  selectNumTables.step();
+
+  const bool creating = selectNumTables.columnAsInt64(0) == 0;
 
-  tlo::Sqlite3Statement(connection, CREATE_TABLE_FUZZY_HASH).step();
+  selectNumTables.reset();
+
+  if (creating) {
+    tlo::Sqlite3Statement(connection, PRAGMA_AUTO_VACUUM).step();
+  }
+
+  tlo::Sqlite3Statement(connection, PRAGMA_JOURNAL_MODE).step();
+  tlo::Sqlite3Statement(connection, PRAGMA_SYNCHRONOUS).step();
+  tlo::Sqlite3Statement(connection, PRAGMA_CACHE_SIZE).step();
+
+  tlo::Sqlite3Statement selectSchemaVersion(connection, SELECT_SCHEMA_VERSION);
+
+  selectSchemaVersion.step();
+
+  const sqlite3_int64 schemaVersion = selectSchemaVersion.columnAsInt64(0);
+
+  selectSchemaVersion.reset();
+
+  if (schemaVersion > SCHEMA_VERSION) {
+    throw std::runtime_error("Error: Database \"" + dbFilePath.u8string() +
+                             "\" was created by a newer version.");
+  }
+
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_DIRECTORY).step();
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_FILE_HASH).step();
+  tlo::Sqlite3Statement(connection, CREATE_INDEX_FILE_HASH_BLOCK_SIZE).step();
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_FILE_PATH_TO_FIND).step();
+
+  insertFilePathToFind.prepare(connection, INSERT_FILE_PATH_TO_FIND);
+  deleteFilePathsToFind.prepare(connection, DELETE_FILE_PATHS_TO_FIND);
+  selectDirectoryId.prepare(connection, SELECT_DIRECTORY_ID);
+  insertDirectory.prepare(connection, INSERT_DIRECTORY);
 
   insertFuzzyHash.prepare(connection, INSERT_FUZZY_HASH);
-  selectFuzzyHashesGlob.prepare(connection, SELECT_FUZZY_HASHES_GLOB);
+  upsertFuzzyHash.prepare(connection, UPSERT_FUZZY_HASH);
+  selectFuzzyHash.prepare(connection, SELECT_FUZZY_HASH);
+  selectFuzzyHashesToFind.prepare(connection, SELECT_FUZZY_HASHES_TO_FIND);
+  selectFuzzyHashesInRange.prepare(connection, SELECT_FUZZY_HASHES_IN_RANGE);
+  selectFuzzyHashesWithBlockSize.prepare(connection,
+                                         SELECT_FUZZY_HASHES_WITH_BLOCK_SIZE);
   updateFuzzyHash.prepare(connection, UPDATE_FUZZY_HASH);
+  deleteFuzzyHash.prepare(connection, DELETE_FUZZY_HASH);
+  deleteFuzzyHashesToFind.prepare(connection, DELETE_FUZZY_HASHES_TO_FIND);
+
+  if (schemaVersion == 0) {
+    migrateFromVersion0();
+  }
+}
+
+namespace {
+constexpr int BLOCK_SIZE = 0;
+constexpr int PART1 = 1;
+constexpr int PART2 = 2;
+constexpr int FILE_PATH = 3;
+constexpr int FILE_SIZE = 4;
+constexpr int FILE_LAST_WRITE_TIME = 5;
+
+// Reads a hash from the columns of a row selected by one of the statements
+// that select hashes.
+FuzzyHashRow readHash(tlo::Sqlite3Statement &selectStatement) {
+  FuzzyHashRow hash;
+
+  hash.blockSize =
+      static_cast<std::size_t>(selectStatement.columnAsInt64(BLOCK_SIZE));
+  hash.part1 = selectStatement.columnAsUtf8Text(PART1).data();
+  hash.part2 = selectStatement.columnAsUtf8Text(PART2).data();
+  hash.filePath = selectStatement.columnAsUtf8Text(FILE_PATH).data();
+  hash.fileSize =
+      static_cast<std::size_t>(selectStatement.columnAsInt64(FILE_SIZE));
+  hash.fileLastWriteTime =
+      selectStatement.columnAsUtf8Text(FILE_LAST_WRITE_TIME).data();
+
+  return hash;
+}
+
+void getHashes(FuzzyHashRowSet &results,
+               tlo::Sqlite3Statement &selectStatement) {
+  while (selectStatement.step() != SQLITE_DONE) {
+    results.insert(readHash(selectStatement));
+  }
+}
+}  // namespace
+
+void FuzzyHashDatabase::migrateFromVersion0() {
+  tlo::Sqlite3Statement selectVersion0Table(connection,
+                                            SELECT_VERSION_0_TABLE);
+
+  selectVersion0Table.step();
+
+  const bool hasVersion0Table = selectVersion0Table.columnAsInt64(0) > 0;
+
+  selectVersion0Table.reset();
+
+  Transaction transaction(*this);
+
+  transaction.begin();
+
+  if (hasVersion0Table) {
+    const TraceSpan span("migrateFromVersion0", "database");
+    tlo::Sqlite3Statement selectVersion0Hashes(connection,
+                                               SELECT_VERSION_0_HASHES);
+
+    while (selectVersion0Hashes.step() != SQLITE_DONE) {
+      const FuzzyHashRow hash = readHash(selectVersion0Hashes);
+
+      resetClearBindingsAndBindHash(insertFuzzyHash, hash);
+      insertFuzzyHash.step();
+    }
+
+    selectVersion0Hashes.reset();
+    tlo::Sqlite3Statement(connection, DROP_VERSION_0_TABLE).step();
+  }
+
+  setSchemaVersion();
+  transaction.commit();
+
+  // Gives the space of the dropped table back to the file system.
+  if (hasVersion0Table) {
+    tlo::Sqlite3Statement(connection, "VACUUM;").step();
+  }
+}
+
+void FuzzyHashDatabase::setSchemaVersion() {
+  tlo::Sqlite3Statement(connection, "PRAGMA user_version = " +
+                                        std::to_string(SCHEMA_VERSION) + ";")
+      .step();
 }
 
 bool FuzzyHashDatabase::isOpen() const { return connection.isOpen(); }
@@ -63,19 +401,102 @@ void FuzzyHashDatabase::setEventHandler(EventHandler &handler_) {
   handler = &handler_;
 }
 
-namespace {
-void resetClearBindingsAndBindHash(tlo::Sqlite3Statement &statement,
-                                   const FuzzyHashRow &hash) {
+void FuzzyHashDatabase::setBatchSize(std::size_t batchSize_) {
+  batchSize = batchSize_ == 0 ? 1 : batchSize_;
+}
+
+void FuzzyHashDatabase::beginTransaction() {
+  tlo::Sqlite3Statement(connection, "BEGIN;").step();
+}
+
+void FuzzyHashDatabase::commitTransaction() {
+  tlo::Sqlite3Statement(connection, "COMMIT;").step();
+}
+
+sqlite3_int64 FuzzyHashDatabase::getDirectoryId(
+    const std::string &directoryPath) {
+  const auto iterator = directoryIds.find(directoryPath);
+
+  if (iterator != directoryIds.end()) {
+    return iterator->second;
+  }
+
+  auto selectId = [&] {
+    selectDirectoryId.reset();
+    selectDirectoryId.clearBindings();
+    selectDirectoryId.bindUtf8Text(":path", directoryPath);
+    return selectDirectoryId.step() != SQLITE_DONE;
+  };
+
+  if (!selectId()) {
+    insertDirectory.reset();
+    insertDirectory.clearBindings();
+    insertDirectory.bindUtf8Text(":path", directoryPath);
+    insertDirectory.step();
+    selectId();
+  }
+
+  const sqlite3_int64 id = selectDirectoryId.columnAsInt64(0);
+
+  selectDirectoryId.reset();
+  directoryIds.emplace(directoryPath, id);
+  return id;
+}
+
+void FuzzyHashDatabase::resetClearBindingsAndBindHash(
+    tlo::Sqlite3Statement &statement, const FuzzyHashRow &hash) {
+  const auto [directoryPath, name] = splitPath(hash.filePath);
+  const sqlite3_int64 directoryId = getDirectoryId(directoryPath);
+
   statement.reset();
   statement.clearBindings();
+  statement.bindInt64(":directoryId", directoryId);
+  statement.bindUtf8Text(":name", name, SQLITE_TRANSIENT);
   statement.bindInt64(":blockSize", static_cast<sqlite3_int64>(hash.blockSize));
   statement.bindUtf8Text(":part1", hash.part1);
   statement.bindUtf8Text(":part2", hash.part2);
-  statement.bindUtf8Text(":filePath", hash.filePath);
   statement.bindInt64(":fileSize", static_cast<sqlite3_int64>(hash.fileSize));
   statement.bindUtf8Text(":fileLastWriteTime", hash.fileLastWriteTime);
 }
-}  // namespace
+
+void FuzzyHashDatabase::writeHash(tlo::Sqlite3Statement &statement,
+                                  const FuzzyHashRow &hash,
+                                  void (EventHandler::*onRowWrite)(),
+                                  Transaction &transaction) {
+  if (!transaction.isOpen()) {
+    transaction.begin();
+  }
+
+  resetClearBindingsAndBindHash(statement, hash);
+  statement.step();
+  transaction.numRows++;
+
+  if (handler) {
+    (handler->*onRowWrite)();
+  }
+
+  if (transaction.numRows == batchSize) {
+    transaction.commit();
+  }
+}
+
+void FuzzyHashDatabase::writeHashes(tlo::Sqlite3Statement &statement,
+                                    const FuzzyHashRowSet &hashes,
+                                    void (EventHandler::*onRowWrite)()) {
+  Transaction transaction(*this);
+
+  for (const auto &hash : hashes) {
+    if (tlo::stopRequested.load()) {
+      break;
+    }
+
+    writeHash(statement, hash, onRowWrite, transaction);
+  }
+
+  if (transaction.isOpen()) {
+    transaction.commit();
+  }
+}
 
 void FuzzyHashDatabase::insertHash(const FuzzyHashRow &newHash) {
   resetClearBindingsAndBindHash(insertFuzzyHash, newHash);
@@ -87,91 +508,292 @@ void FuzzyHashDatabase::insertHash(const FuzzyHashRow &newHash) {
 }
 
 void FuzzyHashDatabase::insertHashes(const FuzzyHashRowSet &newHashes) {
-  for (const auto &newHash : newHashes) {
-    if (tlo::stopRequested.load()) {
-      return;
-    }
+  const TraceSpan span("insertHashes", "database", [&] {
+    return std::to_string(newHashes.size()) + " hashes";
+  });
 
-    insertHash(newHash);
-  }
+  writeHashes(insertFuzzyHash, newHashes, &EventHandler::onRowInsert);
 }
 
-namespace {
-void bindPaths(tlo::Sqlite3Statement &statement,
-               const std::vector<fs::path> &filePaths) {
-  for (std::size_t i = 0; i < filePaths.size(); ++i) {
-    std::string filePath = filePaths[i].u8string();
+void FuzzyHashDatabase::storeFilePathsToFind(
+    const std::vector<fs::path> &filePaths, std::size_t begin,
+    std::size_t end) {
+  deleteFilePathsToFind.reset();
+  deleteFilePathsToFind.step();
 
-    statement.bindUtf8Text(static_cast<int>(i + 1), filePath, SQLITE_TRANSIENT);
+  for (std::size_t i = begin; i < end; ++i) {
+    const auto [directoryPath, name] = splitPath(filePaths[i].u8string());
+
+    insertFilePathToFind.reset();
+    insertFilePathToFind.clearBindings();
+    insertFilePathToFind.bindUtf8Text(":directoryPath", directoryPath);
+    insertFilePathToFind.bindUtf8Text(":name", name);
+    insertFilePathToFind.step();
   }
 }
 
-constexpr int BLOCK_SIZE = 0;
-constexpr int PART1 = 1;
-constexpr int PART2 = 2;
-constexpr int FILE_PATH = 3;
-constexpr int FILE_SIZE = 4;
-constexpr int FILE_LAST_WRITE_TIME = 5;
+bool FuzzyHashDatabase::getHashForFile(FuzzyHashRow &result,
+                                       const fs::path &filePath) {
+  const auto [directoryPath, name] = splitPath(filePath.u8string());
 
-void getHashes(FuzzyHashRowSet &results,
-               tlo::Sqlite3Statement &selectStatement) {
-  while (selectStatement.step() != SQLITE_DONE) {
-    FuzzyHashRow hash;
-
-    hash.blockSize =
-        static_cast<std::size_t>(selectStatement.columnAsInt64(BLOCK_SIZE));
-    hash.part1 = selectStatement.columnAsUtf8Text(PART1).data();
-    hash.part2 = selectStatement.columnAsUtf8Text(PART2).data();
-    hash.filePath = selectStatement.columnAsUtf8Text(FILE_PATH).data();
-    hash.fileSize =
-        static_cast<std::size_t>(selectStatement.columnAsInt64(FILE_SIZE));
-    hash.fileLastWriteTime =
-        selectStatement.columnAsUtf8Text(FILE_LAST_WRITE_TIME).data();
+  selectFuzzyHash.reset();
+  selectFuzzyHash.clearBindings();
+  selectFuzzyHash.bindUtf8Text(":directoryPath", directoryPath);
+  selectFuzzyHash.bindUtf8Text(":name", name);
 
-    results.insert(std::move(hash));
+  if (selectFuzzyHash.step() == SQLITE_DONE) {
+    return false;
   }
+
+  result = readHash(selectFuzzyHash);
+  selectFuzzyHash.reset();
+  return true;
 }
-}  // namespace
 
 void FuzzyHashDatabase::getHashesForFiles(
     FuzzyHashRowSet &results, const std::vector<fs::path> &filePaths) {
-  std::string sql = SELECT_FUZZY_HASHES_IN.data() +
-                    tlo::join(filePaths.size(), "?", ", ") + ");";
-  tlo::Sqlite3Statement selectFuzzyHashesIn(connection, sql);
+  const TraceSpan span("getHashesForFiles", "database", [&] {
+    return std::to_string(filePaths.size()) + " files";
+  });
+
+  for (std::size_t begin = 0; begin < filePaths.size();
+       begin += FILE_PATH_CHUNK_SIZE) {
+    getHashesForFileChunk(
+        results, filePaths, begin,
+        std::min(begin + FILE_PATH_CHUNK_SIZE, filePaths.size()));
+  }
+}
+
+void FuzzyHashDatabase::getHashesForFileChunk(
+    FuzzyHashRowSet &results, const std::vector<fs::path> &filePaths,
+    std::size_t begin, std::size_t end) {
+  Transaction transaction(*this);
 
-  bindPaths(selectFuzzyHashesIn, filePaths);
-  getHashes(results, selectFuzzyHashesIn);
+  transaction.begin();
+  storeFilePathsToFind(filePaths, begin, end);
+  selectFuzzyHashesToFind.reset();
+  getHashes(results, selectFuzzyHashesToFind);
+  transaction.commit();
 }
 
+namespace {
+// Binds the range of directory paths under directoryPath to :lowerBound and
+// :upperBound. Paths under the directory start with the directory path
+// followed by a separator. They are at least that prefix and less than the
+// prefix with its separator replaced by the next character, which excludes
+// siblings like /data/foo2 of /data/foo.
+void resetClearBindingsAndBindRange(tlo::Sqlite3Statement &statement,
+                                    const fs::path &directoryPath) {
+  std::string lowerBound = directoryPath.u8string();
+
+  if (lowerBound.empty() ||
+      lowerBound.back() != static_cast<char>(fs::path::preferred_separator)) {
+    lowerBound += static_cast<char>(fs::path::preferred_separator);
+  }
+
+  std::string upperBound = lowerBound;
+
+  upperBound.back()++;
+
+  statement.reset();
+  statement.clearBindings();
+  statement.bindUtf8Text(":lowerBound", lowerBound, SQLITE_TRANSIENT);
+  statement.bindUtf8Text(":upperBound", upperBound, SQLITE_TRANSIENT);
+}
+
+// Sorts file paths by the path of their directory, then by their name, which
+// is the order of SELECT_FILE_PATHS_IN_RANGE.
+std::vector<std::pair<std::string, std::string>> sortFilePathsByDirectory(
+    const std::vector<fs::path> &filePaths) {
+  std::vector<std::pair<std::string, std::string>> sortedFilePaths;
+
+  sortedFilePaths.reserve(filePaths.size());
+
+  for (const auto &filePath : filePaths) {
+    sortedFilePaths.push_back(splitPath(filePath.u8string()));
+  }
+
+  std::sort(sortedFilePaths.begin(), sortedFilePaths.end());
+  return sortedFilePaths;
+}
+}  // namespace
+
 void FuzzyHashDatabase::getHashesForDirectory(FuzzyHashRowSet &results,
                                               const fs::path &directoryPath) {
-  selectFuzzyHashesGlob.reset();
-  selectFuzzyHashesGlob.clearBindings();
+  const TraceSpan span("getHashesForDirectory", "database",
+                       [&] { return directoryPath.u8string(); });
+
+  resetClearBindingsAndBindRange(selectFuzzyHashesInRange, directoryPath);
+  getHashes(results, selectFuzzyHashesInRange);
+}
+
+// The directories and chunks of file paths getHashesForPaths() reads, in that
+// order. Threads take the next one by incrementing nextTaskIndex, so they
+// never wait on each other.
+struct FuzzyHashDatabase::ReadTasks {
+  std::vector<fs::path> directoryPaths;
+  std::vector<fs::path> filePaths;
+  std::size_t numTasks = 0;
+
+  std::atomic<std::size_t> nextTaskIndex{0};
+  std::atomic<bool> exceptionThrown{false};
+
+  explicit ReadTasks(const std::vector<fs::path> &paths) {
+    for (const auto &path : paths) {
+      if (fs::is_regular_file(path)) {
+        filePaths.push_back(path);
+      } else if (fs::is_directory(path)) {
+        directoryPaths.push_back(path);
+      }
+    }
+
+    numTasks = directoryPaths.size() +
+               (filePaths.size() + FILE_PATH_CHUNK_SIZE - 1) /
+                   FILE_PATH_CHUNK_SIZE;
+  }
+};
+
+void FuzzyHashDatabase::readTasks(ReadTasks &tasks, FuzzyHashRowSet &results,
+                                  std::exception_ptr &exception) {
+  try {
+    for (;;) {
+      if (tasks.exceptionThrown.load() || tlo::stopRequested.load()) {
+        break;
+      }
+
+      const std::size_t taskIndex = tasks.nextTaskIndex.fetch_add(1);
 
-  std::string filePathPattern = directoryPath.u8string();
+      if (taskIndex >= tasks.numTasks) {
+        break;
+      }
 
-  filePathPattern += '*';
-  selectFuzzyHashesGlob.bindUtf8Text(":filePathPattern", filePathPattern);
-  getHashes(results, selectFuzzyHashesGlob);
+      if (taskIndex < tasks.directoryPaths.size()) {
+        getHashesForDirectory(results, tasks.directoryPaths[taskIndex]);
+      } else {
+        const std::size_t begin =
+            (taskIndex - tasks.directoryPaths.size()) * FILE_PATH_CHUNK_SIZE;
+
+        getHashesForFileChunk(
+            results, tasks.filePaths, begin,
+            std::min(begin + FILE_PATH_CHUNK_SIZE, tasks.filePaths.size()));
+      }
+    }
+  } catch (...) {
+    tasks.exceptionThrown.store(true);
+    exception = std::current_exception();
+  }
 }
 
 void FuzzyHashDatabase::getHashesForPaths(FuzzyHashRowSet &results,
-                                          const std::vector<fs::path> &paths) {
-  std::vector<fs::path> filePaths;
+                                          const std::vector<fs::path> &paths,
+                                          std::size_t numThreads) {
+  ReadTasks tasks(paths);
+
+  numThreads = std::min(numThreads, tasks.numTasks);
+
+  if (numThreads <= 1) {
+    for (const auto &directoryPath : tasks.directoryPaths) {
+      getHashesForDirectory(results, directoryPath);
+    }
+
+    if (!tasks.filePaths.empty()) {
+      getHashesForFiles(results, tasks.filePaths);
+    }
+
+    return;
+  }
+
+  const TraceSpan span("getHashesForPaths", "database", [&] {
+    return std::to_string(tasks.numTasks) + " tasks on " +
+           std::to_string(numThreads) + " threads";
+  });
+
+  while (readers.size() < numThreads - 1) {
+    readers.push_back(std::make_unique<FuzzyHashDatabase>());
+  }
+
+  std::vector<FuzzyHashRowSet> threadResults(numThreads - 1);
+  std::vector<std::exception_ptr> exceptions(numThreads);
+  std::vector<std::thread> threads(numThreads - 1);
+
+  for (std::size_t i = 0; i < threads.size(); ++i) {
+    threads[i] = std::thread([&, i] {
+      try {
+        if (!readers[i]->isOpen()) {
+          readers[i]->open(filePath);
+        }
+      } catch (...) {
+        tasks.exceptionThrown.store(true);
+        exceptions[i + 1] = std::current_exception();
+        return;
+      }
+
+      readers[i]->readTasks(tasks, threadResults[i], exceptions[i + 1]);
+    });
+  }
 
-  for (const auto &path : paths) {
-    if (fs::is_regular_file(path)) {
-      filePaths.push_back(path);
-    } else if (fs::is_directory(path)) {
-      getHashesForDirectory(results, path);
+  readTasks(tasks, results, exceptions[0]);
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (const auto &exception : exceptions) {
+    if (exception) {
+      std::rethrow_exception(exception);
     }
   }
 
-  if (!filePaths.empty()) {
-    getHashesForFiles(results, filePaths);
+  // Moves the nodes of the other sets instead of copying the hashes.
+  for (auto &threadResult : threadResults) {
+    results.merge(threadResult);
+  }
+}
+
+std::vector<std::size_t> FuzzyHashDatabase::getBlockSizes() {
+  tlo::Sqlite3Statement selectBlockSizes(connection, SELECT_BLOCK_SIZES);
+  std::vector<std::size_t> blockSizes;
+
+  while (selectBlockSizes.step() != SQLITE_DONE) {
+    blockSizes.push_back(
+        static_cast<std::size_t>(selectBlockSizes.columnAsInt64(0)));
+  }
+
+  return blockSizes;
+}
+
+void FuzzyHashDatabase::getHashesWithBlockSize(std::vector<FuzzyHash> &results,
+                                               std::size_t blockSize) {
+  const TraceSpan span("getHashesWithBlockSize", "database", [&] {
+    return "block size " + std::to_string(blockSize);
+  });
+
+  selectFuzzyHashesWithBlockSize.reset();
+  selectFuzzyHashesWithBlockSize.clearBindings();
+  selectFuzzyHashesWithBlockSize.bindInt64(
+      ":blockSize", static_cast<sqlite3_int64>(blockSize));
+
+  while (selectFuzzyHashesWithBlockSize.step() != SQLITE_DONE) {
+    FuzzyHash hash;
+
+    hash.blockSize = static_cast<std::size_t>(
+        selectFuzzyHashesWithBlockSize.columnAsInt64(BLOCK_SIZE));
+    hash.part1 = selectFuzzyHashesWithBlockSize.columnAsUtf8Text(PART1).data();
+    hash.part2 = selectFuzzyHashesWithBlockSize.columnAsUtf8Text(PART2).data();
+    hash.filePath =
+        selectFuzzyHashesWithBlockSize.columnAsUtf8Text(FILE_PATH).data();
+
+    results.push_back(std::move(hash));
   }
 }
 
+std::size_t FuzzyHashDatabase::getNumHashes() {
+  tlo::Sqlite3Statement selectNumHashes(connection, SELECT_NUM_HASHES);
+
+  selectNumHashes.step();
+  return static_cast<std::size_t>(selectNumHashes.columnAsInt64(0));
+}
+
 void FuzzyHashDatabase::updateHash(const FuzzyHashRow &modifiedHash) {
   resetClearBindingsAndBindHash(updateFuzzyHash, modifiedHash);
   updateFuzzyHash.step();
@@ -182,22 +804,225 @@ void FuzzyHashDatabase::updateHash(const FuzzyHashRow &modifiedHash) {
 }
 
 void FuzzyHashDatabase::updateHashes(const FuzzyHashRowSet &modifiedHashes) {
-  for (const auto &modifiedHash : modifiedHashes) {
-    if (tlo::stopRequested.load()) {
-      return;
+  const TraceSpan span("updateHashes", "database", [&] {
+    return std::to_string(modifiedHashes.size()) + " hashes";
+  });
+
+  writeHashes(updateFuzzyHash, modifiedHashes, &EventHandler::onRowUpdate);
+}
+
+void FuzzyHashDatabase::upsertHashes(const FuzzyHashRowSet &hashes) {
+  const TraceSpan span("upsertHashes", "database", [&] {
+    return std::to_string(hashes.size()) + " hashes";
+  });
+
+  writeHashes(upsertFuzzyHash, hashes, &EventHandler::onRowUpsert);
+}
+
+void FuzzyHashDatabase::startWriting(std::size_t queueCapacity) {
+  writer = std::make_unique<Writer>(queueCapacity == 0 ? 1 : queueCapacity);
+  writer->thread = std::thread(&FuzzyHashDatabase::writeQueuedHashes, this);
+}
+
+void FuzzyHashDatabase::queueHash(FuzzyHashRow &&hash) {
+  std::unique_lock<std::mutex> lock(writer->mutex);
+
+  writer->hashesTaken.wait(lock, [&] {
+    return writer->queue.size() < writer->queueCapacity || writer->exception;
+  });
+
+  if (writer->exception) {
+    return;
+  }
+
+  writer->queue.push_back(std::move(hash));
+  lock.unlock();
+  writer->hashesQueued.notify_one();
+}
+
+void FuzzyHashDatabase::writeQueuedHashes() {
+  std::deque<FuzzyHashRow> hashes;
+  Transaction transaction(*this);
+
+  try {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(writer->mutex);
+
+        writer->hashesQueued.wait(
+            lock, [&] { return !writer->queue.empty() || writer->finishing; });
+
+        if (writer->queue.empty()) {
+          break;
+        }
+
+        hashes.swap(writer->queue);
+      }
+
+      writer->hashesTaken.notify_all();
+
+      const TraceSpan span("writeQueuedHashes", "database", [&] {
+        return std::to_string(hashes.size()) + " hashes";
+      });
+
+      for (const auto &hash : hashes) {
+        writeHash(upsertFuzzyHash, hash, &EventHandler::onRowUpsert,
+                  transaction);
+      }
+
+      hashes.clear();
+    }
+
+    if (transaction.isOpen()) {
+      transaction.commit();
+    }
+  } catch (...) {
+    // Rolls back before the failure is reported, even if the row that failed
+    // was the first after BEGIN.
+    if (transaction.isOpen()) {
+      transaction.rollback();
+    }
+
+    {
+      const std::lock_guard<std::mutex> lockGuard(writer->mutex);
+
+      writer->exception = std::current_exception();
+      writer->queue.clear();
     }
 
-    updateHash(modifiedHash);
+    writer->hashesTaken.notify_all();
+  }
+}
+
+void FuzzyHashDatabase::finishWriting() {
+  {
+    const std::lock_guard<std::mutex> lockGuard(writer->mutex);
+
+    writer->finishing = true;
+  }
+
+  writer->hashesQueued.notify_one();
+  writer->thread.join();
+
+  const std::exception_ptr exception = writer->exception;
+
+  writer.reset();
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+std::size_t FuzzyHashDatabase::deleteHashesForMissingFiles(
+    const std::vector<fs::path> &directoryPaths,
+    const std::vector<fs::path> &filePaths) {
+  const TraceSpan span("deleteHashesForMissingFiles", "database", [&] {
+    return std::to_string(directoryPaths.size()) + " directories";
+  });
+
+  const auto sortedFilePaths = sortFilePathsByDirectory(filePaths);
+  std::vector<std::pair<sqlite3_int64, std::string>> missingFiles;
+
+  for (const auto &directoryPath : directoryPaths) {
+    tlo::Sqlite3Statement selectFilePathsInRange(connection,
+                                                 SELECT_FILE_PATHS_IN_RANGE);
+    auto iterator = sortedFilePaths.begin();
+
+    resetClearBindingsAndBindRange(selectFilePathsInRange, directoryPath);
+
+    // Both sides are in the same order, so each stored file is either the
+    // next listed file or missing from the listing.
+    while (selectFilePathsInRange.step() != SQLITE_DONE) {
+      if (tlo::stopRequested.load()) {
+        return 0;
+      }
+
+      const std::pair<std::string_view, std::string_view> storedFilePath(
+          selectFilePathsInRange.columnAsUtf8Text(1),
+          selectFilePathsInRange.columnAsUtf8Text(2));
+
+      while (iterator != sortedFilePaths.end() &&
+             std::pair<std::string_view, std::string_view>(
+                 iterator->first, iterator->second) < storedFilePath) {
+        ++iterator;
+      }
+
+      if (iterator == sortedFilePaths.end() ||
+          iterator->first != storedFilePath.first ||
+          iterator->second != storedFilePath.second) {
+        missingFiles.emplace_back(selectFilePathsInRange.columnAsInt64(0),
+                                  storedFilePath.second);
+      }
+    }
+  }
+
+  Transaction transaction(*this);
+
+  for (const auto &[directoryId, name] : missingFiles) {
+    if (!transaction.isOpen()) {
+      transaction.begin();
+    }
+
+    deleteFuzzyHash.reset();
+    deleteFuzzyHash.clearBindings();
+    deleteFuzzyHash.bindInt64(":directoryId", directoryId);
+    deleteFuzzyHash.bindUtf8Text(":name", name);
+    deleteFuzzyHash.step();
+    transaction.numRows++;
+
+    if (transaction.numRows == batchSize) {
+      transaction.commit();
+    }
+  }
+
+  if (transaction.isOpen()) {
+    transaction.commit();
+  }
+
+  return missingFiles.size();
+}
+
+void FuzzyHashDatabase::vacuum() {
+  const TraceSpan span("vacuum", "database");
+  tlo::Sqlite3Statement selectAutoVacuum(connection, SELECT_AUTO_VACUUM);
+
+  selectAutoVacuum.step();
+
+  const sqlite3_int64 autoVacuum = selectAutoVacuum.columnAsInt64(0);
+
+  selectAutoVacuum.reset();
+
+  if (autoVacuum == AUTO_VACUUM_INCREMENTAL) {
+    tlo::Sqlite3Statement incrementalVacuum(connection,
+                                            "PRAGMA incremental_vacuum;");
+
+    while (incrementalVacuum.step() != SQLITE_DONE) {
+    }
+  } else {
+    // Switches the database to incremental vacuuming.
+    tlo::Sqlite3Statement(connection, PRAGMA_AUTO_VACUUM).step();
+    tlo::Sqlite3Statement(connection, "VACUUM;").step();
   }
 }
 
 void FuzzyHashDatabase::deleteHashesForFiles(
     const std::vector<fs::path> &filePaths) {
-  std::string sql = DELETE_FUZZY_HASHES_IN.data() +
-                    tlo::join(filePaths.size(), "?", ", ") + ");";
-  tlo::Sqlite3Statement deleteFuzzyHashesIn(connection, sql);
+  const TraceSpan span("deleteHashesForFiles", "database", [&] {
+    return std::to_string(filePaths.size()) + " files";
+  });
+
+  for (std::size_t begin = 0; begin < filePaths.size();
+       begin += FILE_PATH_CHUNK_SIZE) {
+    const std::size_t end =
+        std::min(begin + FILE_PATH_CHUNK_SIZE, filePaths.size());
 
-  bindPaths(deleteFuzzyHashesIn, filePaths);
-  deleteFuzzyHashesIn.step();
+    Transaction transaction(*this);
+
+    transaction.begin();
+    storeFilePathsToFind(filePaths, begin, end);
+    deleteFuzzyHashesToFind.reset();
+    deleteFuzzyHashesToFind.step();
+    transaction.commit();
+  }
 }
 }  // namespace tfs
@@ -0,0 +1,187 @@
+#include "tlo-file-similarity/distance.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <tlo-cpp/lcs.hpp>
+#include <tlo-cpp/levenshtein.hpp>
+#include <utility>
+#include <vector>
+
+namespace tfs {
+namespace {
+// For each character value, a mask with bit i set if pattern[i] is that
+// character.
+class PatternMasks {
+ private:
+  std::array<std::uint64_t, 256> masks{};
+
+ public:
+  explicit PatternMasks(const std::string &pattern) {
+    for (std::size_t i = 0; i < pattern.size(); ++i) {
+      masks[static_cast<unsigned char>(pattern[i])] |= std::uint64_t(1) << i;
+    }
+  }
+
+  std::uint64_t operator[](char character) const {
+    return masks[static_cast<unsigned char>(character)];
+  }
+};
+
+// Expects 0 < pattern.size() <= MAX_BIT_PARALLEL_LENGTH. Each iteration
+// processes the next row of the dynamic programming matrix, where the unset
+// bits of notMatched mark the positions of pattern at which the length of the
+// longest common subsequence so far increases.
+std::size_t bitParallelLcsLength(const std::string &pattern,
+                                 const std::string &text,
+                                 std::size_t minLcsLength) {
+  const PatternMasks patternMasks(pattern);
+  const std::uint64_t patternBits =
+      ~std::uint64_t(0) >> (MAX_BIT_PARALLEL_LENGTH - pattern.size());
+  std::uint64_t notMatched = ~std::uint64_t(0);
+  std::size_t length = 0;
+
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    const std::uint64_t matched = notMatched & patternMasks[text[i]];
+
+    notMatched = (notMatched + matched) | (notMatched - matched);
+    length = std::bitset<MAX_BIT_PARALLEL_LENGTH>(~notMatched & patternBits)
+                 .count();
+
+    // Each remaining row adds at most one.
+    if (length + (text.size() - i - 1) < minLcsLength) {
+      return length;
+    }
+  }
+
+  return length;
+}
+
+// Expects 0 < pattern.size() <= MAX_BIT_PARALLEL_LENGTH. Each iteration
+// computes the vertical and horizontal differences between adjacent cells of
+// the next column of the dynamic programming matrix, and the distance is
+// tracked in the last row.
+template <bool COUNTING_TRANSPOSITIONS>
+std::size_t bitParallelEditDistance(const std::string &pattern,
+                                    const std::string &text) {
+  const PatternMasks patternMasks(pattern);
+  const std::uint64_t lastRow = std::uint64_t(1) << (pattern.size() - 1);
+  std::uint64_t positiveVertical = ~std::uint64_t(0);
+  std::uint64_t negativeVertical = 0;
+  std::uint64_t zeroDiagonal = 0;
+  std::uint64_t previousMatches = 0;
+  std::size_t distance = pattern.size();
+
+  for (const char character : text) {
+    const std::uint64_t matches = patternMasks[character];
+    std::uint64_t transpositions = 0;
+
+    if constexpr (COUNTING_TRANSPOSITIONS) {
+      transpositions = ((~zeroDiagonal & matches) << 1) & previousMatches;
+    }
+
+    zeroDiagonal =
+        (((matches & positiveVertical) + positiveVertical) ^ positiveVertical) |
+        matches | negativeVertical | transpositions;
+
+    std::uint64_t positiveHorizontal =
+        negativeVertical | ~(zeroDiagonal | positiveVertical);
+    std::uint64_t negativeHorizontal = zeroDiagonal & positiveVertical;
+
+    if (positiveHorizontal & lastRow) {
+      distance++;
+    } else if (negativeHorizontal & lastRow) {
+      distance--;
+    }
+
+    // The first row of the matrix increases by one in each column.
+    positiveHorizontal = (positiveHorizontal << 1) | 1;
+    negativeHorizontal <<= 1;
+    positiveVertical =
+        negativeHorizontal | ~(zeroDiagonal | positiveHorizontal);
+    negativeVertical = zeroDiagonal & positiveHorizontal;
+    previousMatches = matches;
+  }
+
+  return distance;
+}
+
+// Keeps only the last three rows of the dynamic programming matrix, since a
+// transposition looks back two rows.
+std::size_t dynamicProgrammingOsaDistance(const std::string &string1,
+                                          const std::string &string2) {
+  std::vector<std::size_t> previousPreviousRow(string2.size() + 1);
+  std::vector<std::size_t> previousRow(string2.size() + 1);
+  std::vector<std::size_t> row(string2.size() + 1);
+
+  for (std::size_t j = 0; j <= string2.size(); ++j) {
+    previousRow[j] = j;
+  }
+
+  for (std::size_t i = 1; i <= string1.size(); ++i) {
+    row[0] = i;
+
+    for (std::size_t j = 1; j <= string2.size(); ++j) {
+      const std::size_t cost = string1[i - 1] == string2[j - 1] ? 0 : 1;
+
+      row[j] = std::min({previousRow[j] + 1, row[j - 1] + 1,
+                         previousRow[j - 1] + cost});
+
+      if (i > 1 && j > 1 && string1[i - 1] == string2[j - 2] &&
+          string1[i - 2] == string2[j - 1]) {
+        row[j] = std::min(row[j], previousPreviousRow[j - 2] + 1);
+      }
+    }
+
+    std::swap(previousPreviousRow, previousRow);
+    std::swap(previousRow, row);
+  }
+
+  return previousRow[string2.size()];
+}
+
+template <bool COUNTING_TRANSPOSITIONS>
+std::size_t editDistance(const std::string &string1,
+                         const std::string &string2) {
+  if (string1.empty()) {
+    return string2.size();
+  } else if (string2.empty()) {
+    return string1.size();
+  } else if (string1.size() <= MAX_BIT_PARALLEL_LENGTH) {
+    return bitParallelEditDistance<COUNTING_TRANSPOSITIONS>(string1, string2);
+  } else if (string2.size() <= MAX_BIT_PARALLEL_LENGTH) {
+    return bitParallelEditDistance<COUNTING_TRANSPOSITIONS>(string2, string1);
+  } else if (COUNTING_TRANSPOSITIONS) {
+    return dynamicProgrammingOsaDistance(string1, string2);
+  } else {
+    return tlo::levenshteinDistance3(string1, string2);
+  }
+}
+}  // namespace
+
+std::size_t lcsLength(const std::string &string1, const std::string &string2,
+                      std::size_t minLcsLength) {
+  if (string1.empty() || string2.empty()) {
+    return 0;
+  } else if (std::min(string1.size(), string2.size()) < minLcsLength) {
+    return std::min(string1.size(), string2.size());
+  } else if (string1.size() <= MAX_BIT_PARALLEL_LENGTH) {
+    return bitParallelLcsLength(string1, string2, minLcsLength);
+  } else if (string2.size() <= MAX_BIT_PARALLEL_LENGTH) {
+    return bitParallelLcsLength(string2, string1, minLcsLength);
+  } else {
+    return tlo::lcsLength3(string1, string2).lcsLength;
+  }
+}
+
+std::size_t levenshteinDistance(const std::string &string1,
+                                const std::string &string2) {
+  return editDistance<false>(string1, string2);
+}
+
+std::size_t osaDistance(const std::string &string1,
+                        const std::string &string2) {
+  return editDistance<true>(string1, string2);
+}
+}  // namespace tfs
@@ -1,6 +1,10 @@
 #include "tlo-file-similarity/fuzzy.hpp"
+#include "tlo-file-similarity/hashers.hpp"
+#include "tlo-file-similarity/stats.hpp"
+#include "tlo-file-similarity/trace.hpp"
 
 #include <cassert>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <exception>
@@ -9,12 +13,12 @@
 #include <mutex>
 #include <stdexcept>
 #include <string_view>
+#include <system_error>
 #include <thread>
 #include <tlo-cpp/chrono.hpp>
 #include <tlo-cpp/filesystem.hpp>
 #include <tlo-cpp/hash.hpp>
 #include <tlo-cpp/stop.hpp>
-#include <tlo-cpp/string.hpp>
 #include <tuple>
 #include <utility>
 
@@ -53,101 +57,42 @@ bool EqualFuzzyHashPath::operator()(const FuzzyHash &hash1,
 FuzzyHashEventHandler::~FuzzyHashEventHandler() = default;
 
 /*
- * Fuzzy hash algorithm, rolling hash algorithm, and SPAMSUM_LENGTH constant
- * from the paper "Identifying Almost Identical Files Using Context Triggered
- * Piecewise Hashing" by Jesse Kornblum (2006). The paper is available at any
- * of the following links:
+ * Fuzzy hash algorithm and SPAMSUM_LENGTH constant from the paper "Identifying
+ * Almost Identical Files Using Context Triggered Piecewise Hashing" by Jesse
+ * Kornblum (2006). The paper is available at any of the following links:
  * https://www.dfrws.org/sites/default/files/session-files/paper-identifying_almost_identical_files_using_context_triggered_piecewise_hashing.pdf
  * https://doi.org/10.1016/j.diin.2006.06.015
  *
- * Constants WINDOW_SIZE and MIN_BLOCK_SIZE from source file "ssdeep/fuzzy.c"
- * available at: https://github.com/ssdeep-project/ssdeep/blob/master/fuzzy.c
- * (Retrieved January 20, 2020)
- *
- * FNV-1 hash algorithm and constants OFFSET_BASIS and FNV_PRIME from web page
- * "FNV Hash" by Landon Curt Noll available at:
- * http://www.isthe.com/chongo/tech/comp/fnv/ (Retrieved January 20, 2020)
+ * Constant MIN_BLOCK_SIZE from source file "ssdeep/fuzzy.c" available at:
+ * https://github.com/ssdeep-project/ssdeep/blob/master/fuzzy.c (Retrieved
+ * January 20, 2020)
  */
 
-constexpr std::size_t WINDOW_SIZE = 7;
-
-class RollingHasher {
- private:
-  uint32_t x = 0;
-  uint32_t y = 0;
-  uint32_t z = 0;
-  uint32_t c = 0;
-  uint32_t window[WINDOW_SIZE] = {0};
-  bool bytesWereAdded_ = false;
-
- public:
-  void addByte(unsigned char byte) {
-    y -= x;
-    y += WINDOW_SIZE * byte;
-    x += byte;
-    x -= window[c % WINDOW_SIZE];
-    window[c % WINDOW_SIZE] = byte;
-    c++;
-    z <<= 5;
-    z ^= byte;
-    bytesWereAdded_ = true;
-  }
-
-  uint32_t getHash() const { return x + y + z; }
-
-  bool bytesWereAdded() { return bytesWereAdded_; }
-};
-
-constexpr uint32_t OFFSET_BASIS = 2166136261U;
-constexpr uint32_t FNV_PRIME = 16777619U;
-
-class Fnv1Hasher {
- private:
-  uint32_t hash = OFFSET_BASIS;
-  bool bytesWereAdded_ = false;
-
- public:
-  void addByte(unsigned char byte) {
-    hash = (hash * FNV_PRIME) ^ byte;
-    bytesWereAdded_ = true;
-  }
-
-  uint32_t getHash() const { return hash; }
-
-  bool bytesWereAdded() { return bytesWereAdded_; }
-};
-
-constexpr std::size_t MIN_BLOCK_SIZE = 3;
-constexpr std::size_t SPAMSUM_LENGTH = 64;
 constexpr std::size_t BUFFER_SIZE = 1000000;
-constexpr std::string_view BASE64_ALPHABET =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 namespace {
-std::pair<std::string, std::string> hashUsingBlockSize(
-    const fs::path &filePath, std::size_t blockSize,
-    FuzzyHashEventHandler *handler) {
-  std::ifstream ifstream(filePath, std::ifstream::in | std::ifstream::binary);
-
-  if (!ifstream.is_open()) {
-    throw std::runtime_error("Error: Failed to open \"" + filePath.u8string() +
-                             "\".");
-  }
-
-  std::vector<char> buffer(BUFFER_SIZE, 0);
+// Builds part1 and part2 of a fuzzy hash with the given block size from the
+// bytes added so far.
+class PartsHasher {
+ private:
+  const std::size_t blockSize;
   RollingHasher rollingHasher;
   Fnv1Hasher fnv1Hasher1;
   Fnv1Hasher fnv1Hasher2;
+
+ public:
   std::string part1;
   std::string part2;
 
-  while (!ifstream.eof()) {
-    ifstream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
-
-    std::size_t numCharsRead = static_cast<std::size_t>(ifstream.gcount());
+  explicit PartsHasher(std::size_t blockSize_) : blockSize(blockSize_) {}
 
-    for (std::size_t i = 0; i < numCharsRead; ++i) {
-      unsigned char byte = static_cast<unsigned char>(buffer[i]);
+  // If handler is not nullptr, calls handler->onBlockHash() whenever a block
+  // has just been hashed. Returns false if hashing stopped partway because
+  // tlo::stopRequested was set.
+  bool addBytes(const char *bytes, std::size_t numBytes,
+                FuzzyHashEventHandler *handler) {
+    for (std::size_t i = 0; i < numBytes; ++i) {
+      unsigned char byte = static_cast<unsigned char>(bytes[i]);
 
       rollingHasher.addByte(byte);
       fnv1Hasher1.addByte(byte);
@@ -163,7 +108,7 @@ std::pair<std::string, std::string> hashUsingBlockSize(
         }
 
         if (tlo::stopRequested.load()) {
-          return std::pair(std::move(part1), std::move(part2));
+          return false;
         }
       }
 
@@ -177,36 +122,75 @@ std::pair<std::string, std::string> hashUsingBlockSize(
         }
 
         if (tlo::stopRequested.load()) {
-          return std::pair(std::move(part1), std::move(part2));
+          return false;
         }
       }
     }
+
+    return true;
   }
 
-  if (fnv1Hasher1.bytesWereAdded()) {
-    part1 += BASE64_ALPHABET[fnv1Hasher1.getHash() % BASE64_ALPHABET.size()];
-    fnv1Hasher1 = Fnv1Hasher();
+  // Hashes the last blocks, which may be shorter than the others.
+  void finish(FuzzyHashEventHandler *handler) {
+    if (fnv1Hasher1.bytesWereAdded()) {
+      part1 += BASE64_ALPHABET[fnv1Hasher1.getHash() % BASE64_ALPHABET.size()];
+      fnv1Hasher1 = Fnv1Hasher();
 
-    if (handler) {
-      handler->onBlockHash();
+      if (handler) {
+        handler->onBlockHash();
+      }
+    }
+
+    if (fnv1Hasher2.bytesWereAdded()) {
+      part2 += BASE64_ALPHABET[fnv1Hasher2.getHash() % BASE64_ALPHABET.size()];
+      fnv1Hasher2 = Fnv1Hasher();
+
+      if (handler) {
+        handler->onBlockHash();
+      }
     }
   }
+};
 
-  if (fnv1Hasher2.bytesWereAdded()) {
-    part2 += BASE64_ALPHABET[fnv1Hasher2.getHash() % BASE64_ALPHABET.size()];
-    fnv1Hasher2 = Fnv1Hasher();
+std::pair<std::string, std::string> hashUsingBlockSize(
+    const fs::path &filePath, std::size_t blockSize,
+    FuzzyHashEventHandler *handler) {
+  const TraceSpan span("hashUsingBlockSize", "hash", [&] {
+    return "block size " + std::to_string(blockSize);
+  });
+  std::ifstream ifstream(filePath, std::ifstream::in | std::ifstream::binary);
 
-    if (handler) {
-      handler->onBlockHash();
+  if (!ifstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" + filePath.u8string() +
+                             "\".");
+  }
+
+  std::vector<char> buffer(BUFFER_SIZE, 0);
+  PartsHasher hasher(blockSize);
+
+  while (!ifstream.eof()) {
+    ifstream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+    std::size_t numCharsRead = static_cast<std::size_t>(ifstream.gcount());
+
+    threadStatCounters().bytesRead += numCharsRead;
+
+    if (!hasher.addBytes(buffer.data(), numCharsRead, handler)) {
+      return std::pair(std::move(hasher.part1), std::move(hasher.part2));
     }
   }
 
-  return std::pair(std::move(part1), std::move(part2));
+  hasher.finish(handler);
+  return std::pair(std::move(hasher.part1), std::move(hasher.part2));
 }
 
 FuzzyHash hashFileWithKnownSize(const fs::path &filePath,
                                 FuzzyHashEventHandler *handler,
                                 std::uintmax_t fileSize) {
+  StatCounters &counters = threadStatCounters();
+
+  counters.filesHashed++;
+
   if (fileSize == 0) {
     FuzzyHash hash{MIN_BLOCK_SIZE, "", "", filePath.u8string()};
 
@@ -241,6 +225,7 @@ FuzzyHash hashFileWithKnownSize(const fs::path &filePath,
 
     if (part1.size() < SPAMSUM_LENGTH / 2 && blockSize / 2 >= MIN_BLOCK_SIZE) {
       blockSize /= 2;
+      counters.rehashes++;
     } else {
       break;
     }
@@ -273,8 +258,21 @@ FuzzyHash fuzzyHash(const fs::path &filePath) {
   return hashFile(filePath, nullptr);
 }
 
+std::pair<std::string, std::string> hashUsingBlockSize(std::string_view bytes,
+                                                       std::size_t blockSize) {
+  PartsHasher hasher(blockSize);
+
+  if (hasher.addBytes(bytes.data(), bytes.size(), nullptr)) {
+    hasher.finish(nullptr);
+  }
+
+  return std::pair(std::move(hasher.part1), std::move(hasher.part2));
+}
+
 namespace {
 void hashAndCollect(const fs::path &filePath, FuzzyHashEventHandler &handler) {
+  const TraceSpan span("hashAndCollect", "hash",
+                       [&] { return filePath.u8string(); });
   std::uintmax_t fileSize = tlo::getFileSize(filePath);
   std::string fileLastWriteTime =
       tlo::timeToLocalTimestamp(tlo::getLastWriteTime(filePath));
@@ -389,33 +387,42 @@ void fuzzyHash(const std::vector<fs::path> &filePaths,
   }
 }
 
-FuzzyHash parseHash(const std::string &hash) {
+FuzzyHash parseHash(std::string_view hash) {
   auto commaPosition = hash.find(',');
 
-  if (commaPosition == std::string::npos) {
-    throw std::runtime_error("Error: Hash \"" + hash +
+  if (commaPosition == std::string_view::npos) {
+    throw std::runtime_error("Error: Hash \"" + std::string(hash) +
                              "\" does not have a comma.");
   }
 
-  std::vector<std::string> colonSplit =
-      tlo::split(hash.substr(0, commaPosition), ':');
+  std::string_view signature = hash.substr(0, commaPosition);
+  auto colonPosition1 = signature.find(':');
+  auto colonPosition2 = colonPosition1 == std::string_view::npos
+                            ? std::string_view::npos
+                            : signature.find(':', colonPosition1 + 1);
 
-  if (colonSplit.size() != 3) {
+  if (colonPosition2 == std::string_view::npos ||
+      signature.find(':', colonPosition2 + 1) != std::string_view::npos) {
     throw std::runtime_error(
-        "Error: Hash \"" + hash +
+        "Error: Hash \"" + std::string(hash) +
         "\" has the wrong number of sections separated by a colon.");
   }
 
-  std::size_t blockSize;
+  const char *blockSizeBegin = signature.data();
+  const char *blockSizeEnd = blockSizeBegin + colonPosition1;
+  std::size_t blockSize = 0;
+  const auto [pointer, errorCode] =
+      std::from_chars(blockSizeBegin, blockSizeEnd, blockSize);
 
-  try {
-    blockSize = std::stoull(colonSplit[0]);
-  } catch (const std::exception &) {
-    throw std::runtime_error("Error: Hash \"" + hash +
+  if (errorCode != std::errc() || pointer != blockSizeEnd) {
+    throw std::runtime_error("Error: Hash \"" + std::string(hash) +
                              "\" has non-integer block size.");
   }
 
-  return {blockSize, std::move(colonSplit[1]), std::move(colonSplit[2]),
-          hash.substr(commaPosition + 1)};
+  return {blockSize,
+          std::string(signature.substr(colonPosition1 + 1,
+                                       colonPosition2 - colonPosition1 - 1)),
+          std::string(signature.substr(colonPosition2 + 1)),
+          std::string(hash.substr(commaPosition + 1))};
 }
 }  // namespace tfs
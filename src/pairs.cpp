@@ -0,0 +1,430 @@
+#include "tlo-file-similarity/pairs.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <tlo-cpp/stop.hpp>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+namespace tfs {
+SimilarPairDatabase::EventHandler::~EventHandler() = default;
+
+namespace {
+constexpr std::string_view CREATE_TABLE_SETTING =
+    R"sql(CREATE TABLE IF NOT EXISTS Setting (
+  name TEXT PRIMARY KEY NOT NULL,
+  value INTEGER NOT NULL
+);)sql";
+
+constexpr std::string_view CREATE_TABLE_COMPARED_HASH =
+    R"sql(CREATE TABLE IF NOT EXISTS ComparedHash (
+  blockSize INTEGER NOT NULL,
+  part1 TEXT NOT NULL,
+  part2 TEXT NOT NULL,
+  filePath TEXT PRIMARY KEY NOT NULL
+);)sql";
+
+constexpr std::string_view CREATE_TABLE_SIMILAR_PAIR =
+    R"sql(CREATE TABLE IF NOT EXISTS SimilarPair (
+  filePath1 TEXT NOT NULL,
+  filePath2 TEXT NOT NULL,
+  similarityScore REAL NOT NULL,
+  PRIMARY KEY (filePath1, filePath2)
+);)sql";
+
+constexpr std::string_view CREATE_INDEX_SIMILAR_PAIR_FILE_PATH2 =
+    "CREATE INDEX IF NOT EXISTS SimilarPairFilePath2 ON "
+    "SimilarPair(filePath2);";
+
+constexpr std::string_view SELECT_SETTING =
+    "SELECT value FROM Setting WHERE name = :name;";
+constexpr std::string_view UPSERT_SETTING =
+    "INSERT OR REPLACE INTO Setting VALUES(:name, :value);";
+
+constexpr std::string_view INSERT_COMPARED_HASH =
+    "INSERT OR REPLACE INTO ComparedHash VALUES(:blockSize, :part1, :part2, "
+    ":filePath);";
+constexpr std::string_view SELECT_COMPARED_HASHES =
+    "SELECT blockSize, part1, part2, filePath FROM ComparedHash;";
+constexpr std::string_view DELETE_COMPARED_HASH =
+    "DELETE FROM ComparedHash WHERE filePath = :filePath;";
+constexpr std::string_view DELETE_COMPARED_HASHES =
+    "DELETE FROM ComparedHash;";
+
+constexpr std::string_view INSERT_SIMILAR_PAIR =
+    "INSERT OR REPLACE INTO SimilarPair VALUES(:filePath1, :filePath2, "
+    ":similarityScore);";
+constexpr std::string_view SELECT_SIMILAR_PAIRS =
+    "SELECT filePath1, filePath2, similarityScore FROM SimilarPair;";
+constexpr std::string_view DELETE_SIMILAR_PAIRS_FOR_FILE =
+    "DELETE FROM SimilarPair WHERE filePath1 = :filePath OR filePath2 = "
+    ":filePath;";
+constexpr std::string_view DELETE_SIMILAR_PAIRS = "DELETE FROM SimilarPair;";
+
+const std::string SIMILARITY_THRESHOLD_SETTING = "similarityThreshold";
+const std::string COMPARISON_METRIC_SETTING = "comparisonMetric";
+}  // namespace
+
+void SimilarPairDatabase::open(const fs::path &dbFilePath) {
+  connection.open(dbFilePath);
+
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_SETTING).step();
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_COMPARED_HASH).step();
+  tlo::Sqlite3Statement(connection, CREATE_TABLE_SIMILAR_PAIR).step();
+  tlo::Sqlite3Statement(connection, CREATE_INDEX_SIMILAR_PAIR_FILE_PATH2)
+      .step();
+
+  selectSetting.prepare(connection, SELECT_SETTING);
+  upsertSetting.prepare(connection, UPSERT_SETTING);
+  insertComparedHash.prepare(connection, INSERT_COMPARED_HASH);
+  deleteComparedHash.prepare(connection, DELETE_COMPARED_HASH);
+  deleteSimilarPairsForFile.prepare(connection, DELETE_SIMILAR_PAIRS_FOR_FILE);
+  insertSimilarPair.prepare(connection, INSERT_SIMILAR_PAIR);
+}
+
+bool SimilarPairDatabase::isOpen() const { return connection.isOpen(); }
+
+void SimilarPairDatabase::beginTransaction() {
+  tlo::Sqlite3Statement(connection, "BEGIN;").step();
+}
+
+void SimilarPairDatabase::commitTransaction() {
+  tlo::Sqlite3Statement(connection, "COMMIT;").step();
+}
+
+class SimilarPairDatabase::Transaction {
+ private:
+  SimilarPairDatabase &database;
+  bool open = false;
+
+ public:
+  explicit Transaction(SimilarPairDatabase &database_) : database(database_) {
+    database.beginTransaction();
+    open = true;
+  }
+
+  Transaction(const Transaction &) = delete;
+  Transaction &operator=(const Transaction &) = delete;
+  ~Transaction() { rollback(); }
+
+  // Stays open if COMMIT fails, so it is still rolled back.
+  void commit() {
+    database.commitTransaction();
+    open = false;
+  }
+
+  // Does nothing if the transaction is not open. Ignores errors, since it is
+  // called while handling another one.
+  void rollback() {
+    if (!open) {
+      return;
+    }
+
+    open = false;
+
+    try {
+      tlo::Sqlite3Statement(database.connection, "ROLLBACK;").step();
+    } catch (...) {
+    }
+  }
+};
+
+namespace {
+// Returns defaultValue if the setting is not stored.
+sqlite3_int64 getSetting(tlo::Sqlite3Statement &selectSetting,
+                         const std::string &name, sqlite3_int64 defaultValue) {
+  selectSetting.reset();
+  selectSetting.clearBindings();
+  selectSetting.bindUtf8Text(":name", name);
+
+  if (selectSetting.step() == SQLITE_DONE) {
+    return defaultValue;
+  }
+
+  return selectSetting.columnAsInt64(0);
+}
+
+void setSetting(tlo::Sqlite3Statement &upsertSetting, const std::string &name,
+                sqlite3_int64 value) {
+  upsertSetting.reset();
+  upsertSetting.clearBindings();
+  upsertSetting.bindUtf8Text(":name", name);
+  upsertSetting.bindInt64(":value", value);
+  upsertSetting.step();
+}
+}  // namespace
+
+int SimilarPairDatabase::getSimilarityThreshold() {
+  return static_cast<int>(
+      getSetting(selectSetting, SIMILARITY_THRESHOLD_SETTING, -1));
+}
+
+void SimilarPairDatabase::setSimilarityThreshold(int similarityThreshold) {
+  setSetting(upsertSetting, SIMILARITY_THRESHOLD_SETTING, similarityThreshold);
+}
+
+int SimilarPairDatabase::getComparisonMetric() {
+  return static_cast<int>(
+      getSetting(selectSetting, COMPARISON_METRIC_SETTING, -1));
+}
+
+void SimilarPairDatabase::setComparisonMetric(ComparisonMetric metric) {
+  setSetting(upsertSetting, COMPARISON_METRIC_SETTING,
+             static_cast<sqlite3_int64>(metric));
+}
+
+void SimilarPairDatabase::getHashes(FuzzyHashSet &results) {
+  tlo::Sqlite3Statement selectComparedHashes(connection,
+                                             SELECT_COMPARED_HASHES);
+
+  while (selectComparedHashes.step() != SQLITE_DONE) {
+    FuzzyHash hash;
+
+    hash.blockSize =
+        static_cast<std::size_t>(selectComparedHashes.columnAsInt64(0));
+    hash.part1 = selectComparedHashes.columnAsUtf8Text(1).data();
+    hash.part2 = selectComparedHashes.columnAsUtf8Text(2).data();
+    hash.filePath = selectComparedHashes.columnAsUtf8Text(3).data();
+
+    results.insert(std::move(hash));
+  }
+}
+
+void SimilarPairDatabase::insertHash(const FuzzyHash &hash) {
+  insertComparedHash.reset();
+  insertComparedHash.clearBindings();
+  insertComparedHash.bindInt64(":blockSize",
+                               static_cast<sqlite3_int64>(hash.blockSize));
+  insertComparedHash.bindUtf8Text(":part1", hash.part1);
+  insertComparedHash.bindUtf8Text(":part2", hash.part2);
+  insertComparedHash.bindUtf8Text(":filePath", hash.filePath);
+  insertComparedHash.step();
+}
+
+void SimilarPairDatabase::deleteHash(const std::string &filePath) {
+  deleteComparedHash.reset();
+  deleteComparedHash.clearBindings();
+  deleteComparedHash.bindUtf8Text(":filePath", filePath);
+  deleteComparedHash.step();
+
+  deleteSimilarPairsForFile.reset();
+  deleteSimilarPairsForFile.clearBindings();
+  deleteSimilarPairsForFile.bindUtf8Text(":filePath", filePath);
+  deleteSimilarPairsForFile.step();
+}
+
+void SimilarPairDatabase::deleteAll() {
+  tlo::Sqlite3Statement(connection, DELETE_COMPARED_HASHES).step();
+  tlo::Sqlite3Statement(connection, DELETE_SIMILAR_PAIRS).step();
+}
+
+void SimilarPairDatabase::insertPair(const std::string &filePath1,
+                                     const std::string &filePath2,
+                                     double similarityScore) {
+  // Bound as text with enough digits to round-trip. The REAL affinity of the
+  // column stores it as a floating point value.
+  std::ostringstream similarityScoreStream;
+
+  similarityScoreStream << std::setprecision(
+                               std::numeric_limits<double>::max_digits10)
+                        << similarityScore;
+
+  insertSimilarPair.reset();
+  insertSimilarPair.clearBindings();
+  insertSimilarPair.bindUtf8Text(":filePath1", filePath1);
+  insertSimilarPair.bindUtf8Text(":filePath2", filePath2);
+  insertSimilarPair.bindUtf8Text(":similarityScore",
+                                 similarityScoreStream.str(), SQLITE_TRANSIENT);
+  insertSimilarPair.step();
+}
+
+void SimilarPairDatabase::getPairs(EventHandler &handler) {
+  tlo::Sqlite3Statement selectSimilarPairs(connection, SELECT_SIMILAR_PAIRS);
+
+  while (selectSimilarPairs.step() != SQLITE_DONE) {
+    if (tlo::stopRequested.load()) {
+      return;
+    }
+
+    std::string filePath1(selectSimilarPairs.columnAsUtf8Text(0));
+    std::string filePath2(selectSimilarPairs.columnAsUtf8Text(1));
+    double similarityScore = selectSimilarPairs.columnAsDouble(2);
+
+    handler.onStoredPair(filePath1, filePath2, similarityScore);
+  }
+}
+
+HashComparisonMap prepareIncrementalComparison(
+    SimilarPairDatabase &pairDatabase,
+    const HashComparisonMap &blockSizesToHashes, int similarityThreshold,
+    ComparisonMetric metric) {
+  SimilarPairDatabase::Transaction transaction(pairDatabase);
+
+  if (pairDatabase.getSimilarityThreshold() != similarityThreshold ||
+      pairDatabase.getComparisonMetric() != static_cast<int>(metric)) {
+    pairDatabase.deleteAll();
+    pairDatabase.setSimilarityThreshold(similarityThreshold);
+    pairDatabase.setComparisonMetric(metric);
+  }
+
+  FuzzyHashSet storedHashes;
+  HashComparisonMap newBlockSizesToHashes;
+
+  pairDatabase.getHashes(storedHashes);
+
+  // Hashes are copied in the order they appear in their vectors, so hashes
+  // with identical parts stay next to each other.
+  for (const auto &pair : blockSizesToHashes) {
+    for (const auto &hash : pair.second) {
+      auto iterator = storedHashes.find(hash);
+
+      if (iterator != storedHashes.end() &&
+          iterator->blockSize == hash.blockSize &&
+          iterator->part1 == hash.part1 && iterator->part2 == hash.part2) {
+        storedHashes.erase(iterator);
+        continue;
+      }
+
+      if (iterator != storedHashes.end()) {
+        pairDatabase.deleteHash(hash.filePath);
+        storedHashes.erase(iterator);
+      }
+
+      newBlockSizesToHashes[pair.first].push_back(hash);
+    }
+  }
+
+  // The remaining stored hashes are no longer in the map.
+  for (const auto &storedHash : storedHashes) {
+    pairDatabase.deleteHash(storedHash.filePath);
+  }
+
+  transaction.commit();
+  return newBlockSizesToHashes;
+}
+
+namespace {
+// Collects pairs that include at least one new hash. Pairs where both hashes
+// are new are found twice (once from each side), so only the one where the
+// first hash was read first is kept.
+class IncrementalEventHandler : public HashComparisonEventHandler {
+ private:
+  const std::vector<bool> &hashesAreNew;
+  HashComparisonEventHandler &handler;
+
+  std::mutex pairsMutex;
+
+ public:
+  std::vector<std::tuple<std::string, std::string, double>> pairs;
+
+  IncrementalEventHandler(const std::vector<bool> &hashesAreNew_,
+                          HashComparisonEventHandler &handler_)
+      : hashesAreNew(hashesAreNew_), handler(handler_) {}
+
+  void onSimilarPairFound(const FuzzyHashFromFile &hash1,
+                          const FuzzyHashFromFile &hash2,
+                          double similarityScore) override {
+    if (hashesAreNew[hash2.hashIndex] && hash1.hashIndex >= hash2.hashIndex) {
+      return;
+    }
+
+    const std::lock_guard<std::mutex> pairsLockGuard(pairsMutex);
+
+    pairs.emplace_back(hash1.filePath, hash2.filePath, similarityScore);
+  }
+
+  void onHashDone() override { handler.onHashDone(); }
+};
+
+// Reports stored pairs to a HashComparisonEventHandler using the hashes with
+// the stored filePaths.
+class StoredPairEventHandler : public SimilarPairDatabase::EventHandler {
+ private:
+  std::unordered_map<std::string_view, const FuzzyHashFromFile *>
+      pathsToHashes;
+  HashComparisonEventHandler &handler;
+
+ public:
+  StoredPairEventHandler(const HashComparisonMap &blockSizesToHashes,
+                         HashComparisonEventHandler &handler_)
+      : handler(handler_) {
+    for (const auto &pair : blockSizesToHashes) {
+      for (const auto &hash : pair.second) {
+        pathsToHashes[hash.filePath] = &hash;
+      }
+    }
+  }
+
+  void onStoredPair(const std::string &filePath1, const std::string &filePath2,
+                    double similarityScore) override {
+    auto iterator1 = pathsToHashes.find(filePath1);
+    auto iterator2 = pathsToHashes.find(filePath2);
+
+    if (iterator1 != pathsToHashes.end() && iterator2 != pathsToHashes.end()) {
+      handler.onSimilarPairFound(*iterator1->second, *iterator2->second,
+                                 similarityScore);
+    }
+  }
+};
+}  // namespace
+
+void compareHashesIncrementally(SimilarPairDatabase &pairDatabase,
+                                const HashComparisonMap &blockSizesToHashes,
+                                const HashComparisonMap &newBlockSizesToHashes,
+                                int similarityThreshold,
+                                HashComparisonEventHandler &handler,
+                                std::size_t numThreads,
+                                ComparisonMetric metric) {
+  std::size_t numHashes = 0;
+
+  for (const auto &pair : blockSizesToHashes) {
+    for (const auto &hash : pair.second) {
+      numHashes = std::max(numHashes, hash.hashIndex + 1);
+    }
+  }
+
+  std::vector<bool> hashesAreNew(numHashes, false);
+
+  for (const auto &pair : newBlockSizesToHashes) {
+    for (const auto &hash : pair.second) {
+      hashesAreNew[hash.hashIndex] = true;
+    }
+  }
+
+  IncrementalEventHandler incrementalEventHandler(hashesAreNew, handler);
+
+  compareHashesWithOthers(newBlockSizesToHashes, blockSizesToHashes,
+                          similarityThreshold, incrementalEventHandler,
+                          numThreads, metric);
+
+  if (tlo::stopRequested.load()) {
+    return;
+  }
+
+  SimilarPairDatabase::Transaction transaction(pairDatabase);
+
+  for (const auto &[filePath1, filePath2, similarityScore] :
+       incrementalEventHandler.pairs) {
+    pairDatabase.insertPair(filePath1, filePath2, similarityScore);
+  }
+
+  for (const auto &pair : newBlockSizesToHashes) {
+    for (const auto &hash : pair.second) {
+      pairDatabase.insertHash(hash);
+    }
+  }
+
+  transaction.commit();
+
+  StoredPairEventHandler storedPairEventHandler(blockSizesToHashes, handler);
+
+  pairDatabase.getPairs(storedPairEventHandler);
+}
+}  // namespace tfs
@@ -0,0 +1,191 @@
+#include "tlo-file-similarity/stats.hpp"
+#include "tlo-file-similarity/writer.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace tfs {
+StatCounters &StatCounters::operator+=(const StatCounters &other) {
+  bytesRead += other.bytesRead;
+  filesHashed += other.filesHashed;
+  rehashes += other.rehashes;
+  databaseHits += other.databaseHits;
+  databaseMisses += other.databaseMisses;
+  comparisonsAttempted += other.comparisonsAttempted;
+  comparisonsPruned += other.comparisonsPruned;
+  comparisonsMatched += other.comparisonsMatched;
+  return *this;
+}
+
+namespace {
+// Counters of running threads, and the sum of the counters of threads that
+// have exited.
+struct StatRegistry {
+  std::mutex mutex;
+  std::vector<const StatCounters *> runningThreadCounters;
+  StatCounters exitedThreadCounters;
+};
+
+StatRegistry &statRegistry() {
+  static StatRegistry registry;
+  return registry;
+}
+
+// Adds its counters to the registry while the thread runs and adds them to
+// the sum of exited threads when the thread exits.
+class RegisteredStatCounters {
+ public:
+  StatCounters counters;
+
+  RegisteredStatCounters() {
+    StatRegistry &registry = statRegistry();
+    const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+
+    registry.runningThreadCounters.push_back(&counters);
+  }
+
+  RegisteredStatCounters(const RegisteredStatCounters &) = delete;
+  RegisteredStatCounters &operator=(const RegisteredStatCounters &) = delete;
+
+  ~RegisteredStatCounters() {
+    StatRegistry &registry = statRegistry();
+    const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+    auto &running = registry.runningThreadCounters;
+
+    registry.exitedThreadCounters += counters;
+    running.erase(std::find(running.begin(), running.end(), &counters));
+  }
+};
+}  // namespace
+
+StatCounters &threadStatCounters() {
+  thread_local RegisteredStatCounters registeredCounters;
+
+  return registeredCounters.counters;
+}
+
+StatCounters totalStatCounters() {
+  StatRegistry &registry = statRegistry();
+  const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+  StatCounters total = registry.exitedThreadCounters;
+
+  for (const StatCounters *counters : registry.runningThreadCounters) {
+    total += *counters;
+  }
+
+  return total;
+}
+
+std::uint64_t peakResidentSetSize() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage {};
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+#if defined(__APPLE__)
+  // Reported in bytes.
+  return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+  // Reported in kilobytes.
+  return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+void PhaseTimer::startPhase(std::string name) {
+  endPhase();
+  phases.push_back({std::move(name), 0.0, 0.0});
+  timingPhase = true;
+  wallStart = std::chrono::steady_clock::now();
+  cpuStart = std::clock();
+}
+
+void PhaseTimer::endPhase() {
+  if (!timingPhase) {
+    return;
+  }
+
+  const std::chrono::duration<double> wallTime =
+      std::chrono::steady_clock::now() - wallStart;
+
+  phases.back().wallSeconds = wallTime.count();
+  phases.back().cpuSeconds =
+      static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+  timingPhase = false;
+}
+
+const std::vector<PhaseTime> &PhaseTimer::getPhases() const { return phases; }
+
+void writeStats(std::ostream &os, PhaseTimer &phaseTimer) {
+  phaseTimer.endPhase();
+
+  const StatCounters counters = totalStatCounters();
+  const std::pair<const char *, std::uint64_t> namedCounters[] = {
+      {"bytesRead", counters.bytesRead},
+      {"filesHashed", counters.filesHashed},
+      {"rehashes", counters.rehashes},
+      {"databaseHits", counters.databaseHits},
+      {"databaseMisses", counters.databaseMisses},
+      {"comparisonsAttempted", counters.comparisonsAttempted},
+      {"comparisonsPruned", counters.comparisonsPruned},
+      {"comparisonsMatched", counters.comparisonsMatched}};
+  BufferedWriter writer(os);
+
+  writer.write("{\"counters\":{");
+
+  for (std::size_t i = 0; i < std::size(namedCounters); ++i) {
+    if (i > 0) {
+      writer.write(',');
+    }
+
+    writer.writeJsonString(namedCounters[i].first);
+    writer.write(':');
+    writer.writeUnsigned(namedCounters[i].second);
+  }
+
+  writer.write("},\"phases\":[");
+
+  const std::vector<PhaseTime> &phases = phaseTimer.getPhases();
+
+  for (std::size_t i = 0; i < phases.size(); ++i) {
+    if (i > 0) {
+      writer.write(',');
+    }
+
+    writer.write("{\"name\":");
+    writer.writeJsonString(phases[i].name);
+    writer.write(",\"wallSeconds\":");
+    writer.writeDouble(phases[i].wallSeconds);
+    writer.write(",\"cpuSeconds\":");
+    writer.writeDouble(phases[i].cpuSeconds);
+    writer.write('}');
+  }
+
+  writer.write("],\"peakResidentSetBytes\":");
+  writer.writeUnsigned(peakResidentSetSize());
+  writer.write("}\n");
+}
+
+void writeStats(const std::filesystem::path &filePath, PhaseTimer &phaseTimer) {
+  std::ofstream ofstream(filePath, std::ofstream::out | std::ofstream::binary);
+
+  if (!ofstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" + filePath.u8string() +
+                             "\".");
+  }
+
+  writeStats(ofstream, phaseTimer);
+}
+}  // namespace tfs
@@ -0,0 +1,487 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tlo-cpp/command-line.hpp>
+#include <tlo-cpp/filesystem.hpp>
+#include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/compare.hpp>
+#include <tlo-file-similarity/fuzzy.hpp>
+#include <tlo-file-similarity/stats.hpp>
+#include <tlo-file-similarity/trace.hpp>
+#include <tlo-file-similarity/writer.hpp>
+
+namespace fs = std::filesystem;
+
+namespace {
+enum class OutputFormat { REGULAR, CSV, TSV, JSONL };
+
+constexpr int DEFAULT_SIMILARITY_THRESHOLD = 50;
+constexpr int MIN_SIMILARITY_THRESHOLD = 0;
+constexpr int MAX_SIMILARITY_THRESHOLD = 99;
+
+constexpr std::size_t DEFAULT_NUM_THREADS = 1;
+constexpr std::size_t MIN_NUM_THREADS = 1;
+constexpr std::size_t MAX_NUM_THREADS = 256;
+
+constexpr OutputFormat DEFAULT_OUTPUT_FORMAT = OutputFormat::REGULAR;
+const std::string DEFAULT_OUTPUT_FORMAT_STRING = "regular";
+
+constexpr tfs::ComparisonMetric DEFAULT_METRIC = tfs::ComparisonMetric::LCS;
+const std::string DEFAULT_METRIC_STRING = "lcs";
+
+// Number of hashes that can wait to be compared. Hashing threads block once
+// this many are waiting, so memory use stays bounded if comparing falls
+// behind.
+constexpr std::size_t HASH_QUEUE_CAPACITY = 10000;
+
+// Adding a batch to the index regroups each block size the batch has hashes
+// with, which takes time proportional to the size of the index, so the
+// comparing thread waits for a batch of at least this many hashes, or at least
+// as many hashes as the index has, before comparing them.
+constexpr std::size_t MIN_BATCH_SIZE = HASH_QUEUE_CAPACITY / 2;
+
+// The comparing thread also compares whatever hashes are queued once this long
+// has passed without a batch being ready, so hashes are not left waiting while
+// hashing is slow.
+constexpr std::chrono::milliseconds BATCH_TIMEOUT(100);
+
+const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
+    {"--similarity-threshold",
+     {true,
+      "Display only the file pairs with a similarity score greater than or "
+      "equal to this threshold (default: " +
+          std::to_string(DEFAULT_SIMILARITY_THRESHOLD) + ")."}},
+    {"--num-threads",
+     {true,
+      "Number of threads the program will use to hash files, and to compare "
+      "each batch of hashes while the next files are being hashed (default: " +
+          std::to_string(DEFAULT_NUM_THREADS) + ")."}},
+    {"--verbose",
+     {false,
+      "Allow program to print status updates to stderr (default: off)."}},
+    {"--output-format",
+     {true,
+      "Output format can be regular, csv (comma-separated values), tsv "
+      "(tab-separated values), or jsonl (one JSON object per similar pair). "
+      "Each format is the same as the format of the same name of "
+      "tlo-find-similar-hashes (default: " +
+          DEFAULT_OUTPUT_FORMAT_STRING + ")."}},
+    {"--metric",
+     {true,
+      "Metric used to score pairs of hashes. Can be lcs (longest common "
+      "subsequence distance), levenshtein (Levenshtein distance), damerau "
+      "(Damerau-Levenshtein distance, counting each transposition of adjacent "
+      "characters as one edit), or osa (optimal string alignment distance, "
+      "which is faster than damerau but does not allow editing a substring "
+      "more than once, so can give lower scores) (default: " +
+          DEFAULT_METRIC_STRING + ")."}},
+    {"--stats",
+     {true,
+      "Write counters of the work done (bytes read, files hashed, and pairs "
+      "of hashes considered, pruned without scoring, and found similar), the "
+      "wall and CPU time of each phase, and the peak resident set size to the "
+      "specified file as JSON (default: no stats written)."}},
+    {"--trace",
+     {true,
+      "Record what each thread does over time and write it to the specified "
+      "file in the Chrome trace event format, which can be loaded in "
+      "Perfetto. Records hashing of each file and each batch of hashes "
+      "compared. Each thread keeps only its last " +
+          std::to_string(tfs::TRACE_BUFFER_CAPACITY) +
+          " spans (default: no trace written)."}}};
+
+struct Config {
+  int similarityThreshold = DEFAULT_SIMILARITY_THRESHOLD;
+  std::size_t numThreads = DEFAULT_NUM_THREADS;
+  bool verbose = false;
+  OutputFormat outputFormat = DEFAULT_OUTPUT_FORMAT;
+  tfs::ComparisonMetric metric = DEFAULT_METRIC;
+  std::string stats;
+  std::string trace;
+
+  Config(const tlo::CommandLine &commandLine) {
+    if (commandLine.specifiedOption("--similarity-threshold")) {
+      similarityThreshold = commandLine.getOptionValueAsInt(
+          "--similarity-threshold", MIN_SIMILARITY_THRESHOLD,
+          MAX_SIMILARITY_THRESHOLD);
+    }
+
+    if (commandLine.specifiedOption("--num-threads")) {
+      numThreads = commandLine.getOptionValueAsULong(
+          "--num-threads", MIN_NUM_THREADS, MAX_NUM_THREADS);
+    }
+
+    if (commandLine.specifiedOption("--verbose")) {
+      verbose = true;
+    }
+
+    if (commandLine.specifiedOption("--output-format")) {
+      std::string string = commandLine.getOptionValue("--output-format");
+
+      if (string == "regular") {
+        outputFormat = OutputFormat::REGULAR;
+      } else if (string == "csv") {
+        outputFormat = OutputFormat::CSV;
+      } else if (string == "tsv") {
+        outputFormat = OutputFormat::TSV;
+      } else if (string == "jsonl") {
+        outputFormat = OutputFormat::JSONL;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized output format.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--metric")) {
+      std::string string = commandLine.getOptionValue("--metric");
+
+      if (string == "lcs") {
+        metric = tfs::ComparisonMetric::LCS;
+      } else if (string == "levenshtein") {
+        metric = tfs::ComparisonMetric::LEVENSHTEIN;
+      } else if (string == "damerau") {
+        metric = tfs::ComparisonMetric::DAMERAU_LEVENSHTEIN;
+      } else if (string == "osa") {
+        metric = tfs::ComparisonMetric::OSA;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized metric.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--stats")) {
+      stats = commandLine.getOptionValue("--stats");
+    }
+
+    if (commandLine.specifiedOption("--trace")) {
+      trace = commandLine.getOptionValue("--trace");
+    }
+  }
+};
+
+// Called from all the threads comparing a batch, so output is synchronized.
+class ComparisonEventHandler : public tfs::HashComparisonEventHandler {
+ private:
+  const OutputFormat outputFormat;
+  std::mutex writerMutex;
+  tfs::BufferedWriter writer;
+
+  void printQuoted(std::string_view string) {
+    writer.write('"');
+    writer.write(string);
+    writer.write('"');
+  }
+
+  void printSeparatedValues(const tfs::FuzzyHashFromFile &hash1,
+                            const tfs::FuzzyHashFromFile &hash2,
+                            double similarityScore, char separator) {
+    printQuoted(hash1.filePath);
+    writer.write(separator);
+    printQuoted(hash2.filePath);
+    writer.write(separator);
+    writer.write('"');
+    writer.writeDouble(similarityScore);
+    writer.write("\"\n");
+  }
+
+ public:
+  std::size_t numSimilarPairs = 0;
+
+  explicit ComparisonEventHandler(const Config &config)
+      : outputFormat(config.outputFormat), writer(std::cout) {}
+
+  void onSimilarPairFound(const tfs::FuzzyHashFromFile &hash1,
+                          const tfs::FuzzyHashFromFile &hash2,
+                          double similarityScore) override {
+    const std::lock_guard<std::mutex> lockGuard(writerMutex);
+
+    numSimilarPairs++;
+
+    if (outputFormat == OutputFormat::REGULAR) {
+      printQuoted(hash1.filePath);
+      writer.write(" and ");
+      printQuoted(hash2.filePath);
+      writer.write(" are about ");
+      writer.writeDouble(similarityScore);
+      writer.write("% similar.\n");
+    } else if (outputFormat == OutputFormat::CSV) {
+      printSeparatedValues(hash1, hash2, similarityScore, ',');
+    } else if (outputFormat == OutputFormat::TSV) {
+      printSeparatedValues(hash1, hash2, similarityScore, '\t');
+    } else if (outputFormat == OutputFormat::JSONL) {
+      writer.write("{\"filePath1\":");
+      writer.writeJsonString(hash1.filePath);
+      writer.write(",\"filePath2\":");
+      writer.writeJsonString(hash2.filePath);
+      writer.write(",\"similarityScore\":");
+      writer.writeDouble(similarityScore);
+      writer.write("}\n");
+    }
+  }
+
+  void onHashDone() override {}
+
+  void flush() { writer.flush(); }
+};
+
+// Hashes files on the hashing threads and compares each batch of new hashes
+// while the next files are being hashed. Each batch is compared with itself
+// and with an index of the hashes of earlier batches, then added to the index,
+// so every pair of hashes is compared exactly once without waiting for all
+// files to be hashed.
+class HashEventHandler : public tfs::FuzzyHashEventHandler {
+ private:
+  const Config &config;
+  const std::size_t numFilesToHash;
+  ComparisonEventHandler comparisonHandler;
+  tfs::HashComparisonIndex index;
+
+  std::mutex queueMutex;
+  std::condition_variable hashesQueued;
+  std::condition_variable hashesTaken;
+  std::deque<tfs::FuzzyHash> queue;
+  std::size_t numHashesIndexed = 0;
+  bool finishing = false;
+  std::exception_ptr exception;
+
+  std::thread comparingThread;
+
+  void printStatus() {
+    const std::size_t numFilesHashed = index.size();
+
+    std::cerr << "Compared " << numFilesHashed << ' '
+              << (numFilesHashed == 1 ? "file" : "files") << " out of "
+              << numFilesToHash << ". Found "
+              << comparisonHandler.numSimilarPairs << " similar "
+              << (comparisonHandler.numSimilarPairs == 1 ? "pair" : "pairs")
+              << '.' << std::endl;
+  }
+
+  // Expects queueMutex to be locked.
+  bool batchIsReady() const {
+    return !queue.empty() && (queue.size() >= MIN_BATCH_SIZE ||
+                              queue.size() >= numHashesIndexed);
+  }
+
+  void compareBatch(std::deque<tfs::FuzzyHash> &batch) {
+    const tfs::TraceSpan span("compareBatch", "compare", [&] {
+      return std::to_string(batch.size()) + " hashes";
+    });
+    tfs::HashComparisonMap blockSizesToHashes;
+    std::size_t hashIndex = index.size();
+
+    for (auto &hash : batch) {
+      tfs::FuzzyHashFromFile hashFromFile(std::move(hash));
+
+      hashFromFile.hashIndex = hashIndex++;
+      blockSizesToHashes[hashFromFile.blockSize].push_back(
+          std::move(hashFromFile));
+    }
+
+    batch.clear();
+    tfs::compareHashes(blockSizesToHashes, config.similarityThreshold,
+                       comparisonHandler, config.numThreads,
+                       tfs::ComparisonShard(), false, config.metric);
+    index.compare(blockSizesToHashes, config.similarityThreshold,
+                  comparisonHandler, config.numThreads, config.metric);
+    index.insert(std::move(blockSizesToHashes));
+  }
+
+  // Body of the comparing thread. Waits until a batch is ready or
+  // BATCH_TIMEOUT passes, then takes every queued hash at once, so batches
+  // grow when comparing falls behind hashing. Once a stop is requested, takes
+  // queued hashes without comparing them, so hashing threads waiting for room
+  // in the queue can finish.
+  void compareQueuedHashes() {
+    try {
+      std::deque<tfs::FuzzyHash> batch;
+
+      for (;;) {
+        {
+          std::unique_lock<std::mutex> queueLock(queueMutex);
+
+          hashesQueued.wait_for(queueLock, BATCH_TIMEOUT,
+                                [&] { return finishing || batchIsReady(); });
+
+          if (queue.empty()) {
+            if (finishing) {
+              break;
+            }
+
+            continue;
+          }
+
+          batch.swap(queue);
+        }
+
+        hashesTaken.notify_all();
+
+        if (tlo::stopRequested.load()) {
+          batch.clear();
+          continue;
+        }
+
+        compareBatch(batch);
+
+        {
+          const std::lock_guard<std::mutex> queueLock(queueMutex);
+
+          numHashesIndexed = index.size();
+        }
+
+        if (config.verbose) {
+          printStatus();
+        }
+      }
+    } catch (...) {
+      const std::lock_guard<std::mutex> queueLock(queueMutex);
+
+      exception = std::current_exception();
+      queue.clear();
+      hashesTaken.notify_all();
+    }
+  }
+
+ public:
+  HashEventHandler(const Config &config_, std::size_t numFilesToHash_)
+      : config(config_),
+        numFilesToHash(numFilesToHash_),
+        comparisonHandler(config_),
+        comparingThread([this] { compareQueuedHashes(); }) {}
+
+  HashEventHandler(const HashEventHandler &) = delete;
+  HashEventHandler &operator=(const HashEventHandler &) = delete;
+
+  ~HashEventHandler() override {
+    if (comparingThread.joinable()) {
+      try {
+        finish();
+      } catch (...) {
+      }
+    }
+  }
+
+  void onBlockHash() override {}
+  void onFileHash(const tfs::FuzzyHash &) override {}
+
+  bool shouldHashFile(const fs::path &, std::uintmax_t,
+                      const std::string &) override {
+    return true;
+  }
+
+  // Called on the hashing threads. Blocks while HASH_QUEUE_CAPACITY hashes
+  // are waiting to be compared. Hashes of files whose hashing was interrupted
+  // are dropped.
+  void collect(tfs::FuzzyHash &&hash, std::uintmax_t,
+               std::string &&) override {
+    if (tlo::stopRequested.load()) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> queueLock(queueMutex);
+
+    hashesTaken.wait(queueLock, [&] {
+      return exception || queue.size() < HASH_QUEUE_CAPACITY;
+    });
+
+    if (exception) {
+      return;
+    }
+
+    queue.push_back(std::move(hash));
+
+    const bool batchReady = batchIsReady();
+
+    queueLock.unlock();
+
+    if (batchReady) {
+      hashesQueued.notify_one();
+    }
+  }
+
+  // Waits for the queued hashes to be compared and stops the comparing
+  // thread. Flushes the output. Rethrows the exception that made the
+  // comparing thread fail, if any.
+  void finish() {
+    {
+      const std::lock_guard<std::mutex> queueLock(queueMutex);
+
+      finishing = true;
+    }
+
+    hashesQueued.notify_one();
+    comparingThread.join();
+    comparisonHandler.flush();
+
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+
+    if (config.verbose) {
+      std::cerr << "Found " << comparisonHandler.numSimilarPairs << " similar "
+                << (comparisonHandler.numSimilarPairs == 1 ? "pair" : "pairs")
+                << '.' << std::endl;
+    }
+  }
+};
+}  // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
+
+    if (commandLine.arguments().empty()) {
+      std::cerr << "Usage: " << commandLine.program()
+                << " [options] <file or directory>...\n"
+                << std::endl;
+      commandLine.printValidOptions(std::cerr);
+
+      return 1;
+    }
+
+    tlo::registerInterruptSignalHandler(tloRequestStop);
+
+    const Config config(commandLine);
+    tfs::PhaseTimer phaseTimer;
+
+    if (!config.trace.empty()) {
+      tfs::startTracing();
+    }
+
+    phaseTimer.startPhase("buildFileList");
+
+    const auto paths =
+        tlo::stringsToPaths(commandLine.arguments(), tlo::PathType::CANONICAL);
+    const std::vector<fs::path> filePaths = tlo::buildFileList(paths);
+
+    if (config.verbose) {
+      std::cerr << "Hashing and comparing " << filePaths.size() << ' '
+                << (filePaths.size() == 1 ? "file" : "files") << '.'
+                << std::endl;
+    }
+
+    phaseTimer.startPhase("hashAndCompare");
+
+    HashEventHandler handler(config, filePaths.size());
+
+    tfs::fuzzyHash(filePaths, handler, config.numThreads);
+    handler.finish();
+
+    if (!config.stats.empty()) {
+      tfs::writeStats(config.stats, phaseTimer);
+    }
+
+    if (!config.trace.empty()) {
+      tfs::writeTrace(config.trace);
+    }
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+}
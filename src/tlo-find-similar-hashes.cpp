@@ -1,4 +1,6 @@
+#include <cstdio>
 #include <exception>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <mutex>
@@ -6,12 +8,23 @@
 #include <tlo-cpp/command-line.hpp>
 #include <tlo-cpp/filesystem.hpp>
 #include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/cluster.hpp>
 #include <tlo-file-similarity/compare.hpp>
+#include <tlo-file-similarity/database.hpp>
+#include <tlo-file-similarity/pairs.hpp>
+#include <tlo-file-similarity/stats.hpp>
+#include <tlo-file-similarity/trace.hpp>
+#include <tlo-file-similarity/writer.hpp>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 namespace fs = std::filesystem;
 
 namespace {
-enum class OutputFormat { REGULAR, CSV, TSV };
+enum class OutputFormat { REGULAR, CSV, TSV, JSONL, BINARY, CLUSTERS };
 
 constexpr int DEFAULT_SIMILARITY_THRESHOLD = 50;
 constexpr int MIN_SIMILARITY_THRESHOLD = 0;
@@ -24,6 +37,9 @@ constexpr std::size_t MAX_NUM_THREADS = 256;
 constexpr OutputFormat DEFAULT_OUTPUT_FORMAT = OutputFormat::REGULAR;
 const std::string DEFAULT_OUTPUT_FORMAT_STRING = "regular";
 
+constexpr tfs::ComparisonMetric DEFAULT_METRIC = tfs::ComparisonMetric::LCS;
+const std::string DEFAULT_METRIC_STRING = "lcs";
+
 const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
     {"--similarity-threshold",
      {true,
@@ -38,19 +54,95 @@ const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
       "Allow program to print status updates to stderr (default: off)."}},
     {"--output-format",
      {true,
-      "Output format can be regular, csv (comma-separated values), or tsv "
-      "(tab-separated values) (default: " +
+      "Output format can be regular, csv (comma-separated values), tsv "
+      "(tab-separated values), jsonl (one JSON object per similar pair), "
+      "binary (24 bytes per similar pair: the indexes of the two hashes as "
+      "64-bit unsigned integers and the similarity score as a 64-bit IEEE 754 "
+      "floating point number, all little-endian, with the file paths written "
+      "to the file given by --path-table), or clusters (one line for each "
+      "group of files connected by similar pairs, listing the quoted paths of "
+      "the files separated by commas with the representative of the group "
+      "first, and with quotes in paths doubled). With clusters, pairs of "
+      "files already known to be in the same group are not compared. With "
+      "binary or clusters, --record-sources has no effect on the output "
+      "(default: " +
           DEFAULT_OUTPUT_FORMAT_STRING + ")."}},
+    {"--path-table",
+     {true,
+      "File to write the file paths of the hashes to when the output format "
+      "is binary. For each hash, in order of index, the file has the length "
+      "of the file path in bytes as a 64-bit little-endian unsigned integer, "
+      "followed by the file path, so file paths can contain any character "
+      "(default: none)."}},
+    {"--metric",
+     {true,
+      "Metric used to score pairs of hashes. Can be lcs (longest common "
+      "subsequence distance), levenshtein (Levenshtein distance), damerau "
+      "(Damerau-Levenshtein distance, counting each transposition of adjacent "
+      "characters as one edit), or osa (optimal string alignment distance, "
+      "which is faster than damerau but does not allow editing a substring "
+      "more than once, so can give lower scores) (default: " +
+          DEFAULT_METRIC_STRING + ")."}},
     {"--record-sources",
      {false,
-      "Record which input text file each hash came from (default: off)."}}};
+      "Record which input text file each hash came from (default: off)."}},
+    {"--cross-sources-only",
+     {false,
+      "Only compare pairs of hashes that came from different input text "
+      "files. Implies --record-sources (default: off)."}},
+    {"--shard",
+     {true,
+      "Only do the part of the comparisons that belongs to the specified "
+      "shard. Shard i/n is the i-th of n parts, where 0 <= i < n. Running "
+      "all n shards on the same input files compares every pair of hashes "
+      "exactly once. Outputs of the shards can be combined using "
+      "tlo-merge-similar-pairs (default: 0/1)."}},
+    {"--pair-database",
+     {true,
+      "Path to a database that remembers the hashes that were compared and "
+      "the similar pairs that were found. Only new or modified hashes are "
+      "compared, and all stored pairs of hashes in the input text files are "
+      "output. Stored pairs are discarded if the similarity threshold or "
+      "metric changes. Cannot be used with --record-sources, "
+      "--cross-sources-only, or --shard (default: none)."}},
+    {"--database",
+     {true,
+      "Compare the hashes stored in the database at the specified path, as "
+      "created by tlo-fuzzy-hash, instead of the hashes in text files. Only "
+      "the hashes with two comparable block sizes are kept in memory at a "
+      "time. Cannot be used with text files, --record-sources, "
+      "--cross-sources-only, --shard, or --pair-database (default: none)."}},
+    {"--stats",
+     {true,
+      "Write counters of the work done (pairs of hashes considered, pruned "
+      "without scoring, and found similar), the wall and CPU time of each "
+      "phase, and the peak resident set size to the specified file as JSON. "
+      "Identical hashes are scored once, so each counted pair may stand for "
+      "several pairs of files (default: no stats written)."}},
+    {"--trace",
+     {true,
+      "Record what each thread does over time and write it to the specified "
+      "file in the Chrome trace event format, which can be loaded in "
+      "Perfetto. Records each unit of comparison work (a group of identical "
+      "hashes compared with the hashes after it) and database operations. "
+      "Each thread keeps only its last " +
+          std::to_string(tfs::TRACE_BUFFER_CAPACITY) +
+          " spans (default: no trace written)."}}};
 
 struct Config {
   int similarityThreshold = DEFAULT_SIMILARITY_THRESHOLD;
   std::size_t numThreads = DEFAULT_NUM_THREADS;
   bool verbose = false;
   OutputFormat outputFormat = DEFAULT_OUTPUT_FORMAT;
+  std::string pathTable;
+  tfs::ComparisonMetric metric = DEFAULT_METRIC;
   bool recordingSources = false;
+  bool crossSourcesOnly = false;
+  tfs::ComparisonShard shard;
+  std::string pairDatabase;
+  std::string database;
+  std::string stats;
+  std::string trace;
 
   Config(const tlo::CommandLine &commandLine) {
     if (commandLine.specifiedOption("--similarity-threshold")) {
@@ -77,15 +169,89 @@ struct Config {
         outputFormat = OutputFormat::CSV;
       } else if (string == "tsv") {
         outputFormat = OutputFormat::TSV;
+      } else if (string == "jsonl") {
+        outputFormat = OutputFormat::JSONL;
+      } else if (string == "binary") {
+        outputFormat = OutputFormat::BINARY;
+      } else if (string == "clusters") {
+        outputFormat = OutputFormat::CLUSTERS;
       } else {
         throw std::runtime_error("Error: \"" + string +
                                  "\" is not a recognized output format.");
       }
     }
 
+    if (commandLine.specifiedOption("--path-table")) {
+      pathTable = commandLine.getOptionValue("--path-table");
+    }
+
+    if (outputFormat == OutputFormat::BINARY && pathTable.empty()) {
+      throw std::runtime_error(
+          "Error: --path-table is required with the binary output format.");
+    }
+
+    if (commandLine.specifiedOption("--metric")) {
+      std::string string = commandLine.getOptionValue("--metric");
+
+      if (string == "lcs") {
+        metric = tfs::ComparisonMetric::LCS;
+      } else if (string == "levenshtein") {
+        metric = tfs::ComparisonMetric::LEVENSHTEIN;
+      } else if (string == "damerau") {
+        metric = tfs::ComparisonMetric::DAMERAU_LEVENSHTEIN;
+      } else if (string == "osa") {
+        metric = tfs::ComparisonMetric::OSA;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized metric.");
+      }
+    }
+
     if (commandLine.specifiedOption("--record-sources")) {
       recordingSources = true;
     }
+
+    if (commandLine.specifiedOption("--cross-sources-only")) {
+      recordingSources = true;
+      crossSourcesOnly = true;
+    }
+
+    if (commandLine.specifiedOption("--shard")) {
+      shard = tfs::parseShard(commandLine.getOptionValue("--shard"));
+    }
+
+    if (commandLine.specifiedOption("--pair-database")) {
+      pairDatabase = commandLine.getOptionValue("--pair-database");
+
+      if (recordingSources || shard.count > 1) {
+        throw std::runtime_error(
+            "Error: --pair-database cannot be used with --record-sources, "
+            "--cross-sources-only, or --shard.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--database")) {
+      database = commandLine.getOptionValue("--database");
+
+      if (!commandLine.arguments().empty()) {
+        throw std::runtime_error(
+            "Error: Text files with hashes cannot be given with --database.");
+      }
+
+      if (recordingSources || shard.count > 1 || !pairDatabase.empty()) {
+        throw std::runtime_error(
+            "Error: --database cannot be used with --record-sources, "
+            "--cross-sources-only, --shard, or --pair-database.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--stats")) {
+      stats = commandLine.getOptionValue("--stats");
+    }
+
+    if (commandLine.specifiedOption("--trace")) {
+      trace = commandLine.getOptionValue("--trace");
+    }
   }
 };
 
@@ -94,12 +260,17 @@ class AbstractEventHandler : public tfs::HashComparisonEventHandler {
   const bool verbose;
   const OutputFormat outputFormat;
   const bool recordingSources;
-  const std::vector<fs::path> &textFilePaths;
+  const std::string pathTable;
+  const std::size_t numHashes;
   const std::size_t numHashesToCompare;
 
   std::size_t numHashesDone = 0;
   std::size_t numSimilarPairs = 0;
 
+  // Groups of hashes connected by similar pairs. Only used if outputFormat is
+  // OutputFormat::CLUSTERS.
+  tfs::ConcurrentDisjointSets clusters;
+
   void printStatus() {
     std::cerr << "Done with " << numHashesDone << ' '
               << (numHashesDone == 1 ? "hash" : "hashes") << " out of "
@@ -109,61 +280,159 @@ class AbstractEventHandler : public tfs::HashComparisonEventHandler {
   }
 
  private:
+  // Converted once instead of for every similar pair.
+  std::vector<std::string> textFilePaths;
+
+  tfs::BufferedWriter writer;
+
+  void printQuoted(std::string_view string) {
+    writer.write('"');
+    writer.write(string);
+    writer.write('"');
+  }
+
   void printSeparatedValues(const tfs::FuzzyHashFromFile &hash1,
                             const tfs::FuzzyHashFromFile &hash2,
                             double similarityScore, char separator) {
-    std::cout << '"' << hash1.filePath << '"' << separator;
+    printQuoted(hash1.filePath);
+    writer.write(separator);
+
+    if (recordingSources) {
+      printQuoted(textFilePaths[hash1.fileIndex]);
+      writer.write(separator);
+    }
+
+    printQuoted(hash2.filePath);
+    writer.write(separator);
+
+    if (recordingSources) {
+      printQuoted(textFilePaths[hash2.fileIndex]);
+      writer.write(separator);
+    }
+
+    writer.write('"');
+    writer.writeDouble(similarityScore);
+    writer.write("\"\n");
+  }
+
+  void printJsonObject(const tfs::FuzzyHashFromFile &hash1,
+                       const tfs::FuzzyHashFromFile &hash2,
+                       double similarityScore) {
+    writer.write("{\"filePath1\":");
+    writer.writeJsonString(hash1.filePath);
 
     if (recordingSources) {
-      std::cout << '"' << textFilePaths[hash1.fileIndex].u8string() << '"'
-                << separator;
+      writer.write(",\"textFilePath1\":");
+      writer.writeJsonString(textFilePaths[hash1.fileIndex]);
     }
 
-    std::cout << '"' << hash2.filePath << '"' << separator;
+    writer.write(",\"filePath2\":");
+    writer.writeJsonString(hash2.filePath);
 
     if (recordingSources) {
-      std::cout << '"' << textFilePaths[hash2.fileIndex].u8string() << '"'
-                << separator;
+      writer.write(",\"textFilePath2\":");
+      writer.writeJsonString(textFilePaths[hash2.fileIndex]);
     }
 
-    std::cout << '"' << similarityScore << '"' << std::endl;
+    writer.write(",\"similarityScore\":");
+    writer.writeDouble(similarityScore);
+    writer.write("}\n");
   }
 
   void printSimilarPair(const tfs::FuzzyHashFromFile &hash1,
                         const tfs::FuzzyHashFromFile &hash2,
                         double similarityScore) {
     if (outputFormat == OutputFormat::REGULAR) {
-      std::cout << '"' << hash1.filePath << "\" ";
+      printQuoted(hash1.filePath);
+      writer.write(' ');
 
       if (recordingSources) {
-        std::cout << "(\"" << textFilePaths[hash1.fileIndex].u8string()
-                  << "\") ";
+        writer.write('(');
+        printQuoted(textFilePaths[hash1.fileIndex]);
+        writer.write(") ");
       }
 
-      std::cout << "and \"" << hash2.filePath << "\" ";
+      writer.write("and ");
+      printQuoted(hash2.filePath);
+      writer.write(' ');
 
       if (recordingSources) {
-        std::cout << "(\"" << textFilePaths[hash2.fileIndex].u8string()
-                  << "\") ";
+        writer.write('(');
+        printQuoted(textFilePaths[hash2.fileIndex]);
+        writer.write(") ");
       }
 
-      std::cout << "are about " << similarityScore << "% similar." << std::endl;
+      writer.write("are about ");
+      writer.writeDouble(similarityScore);
+      writer.write("% similar.\n");
     } else if (outputFormat == OutputFormat::CSV) {
       printSeparatedValues(hash1, hash2, similarityScore, ',');
     } else if (outputFormat == OutputFormat::TSV) {
       printSeparatedValues(hash1, hash2, similarityScore, '\t');
+    } else if (outputFormat == OutputFormat::JSONL) {
+      printJsonObject(hash1, hash2, similarityScore);
+    } else if (outputFormat == OutputFormat::BINARY) {
+      writer.writeLittleEndian(static_cast<std::uint64_t>(hash1.hashIndex));
+      writer.writeLittleEndian(static_cast<std::uint64_t>(hash2.hashIndex));
+      writer.writeLittleEndian(similarityScore);
     }
   }
 
+  void printClusters(const std::vector<const std::string *> &paths) {
+    writer.flush();
+
+    for (const auto &cluster : tfs::collectClusters(clusters, paths)) {
+      tfs::printCluster(std::cout, cluster);
+      std::cout << '\n';
+    }
+
+    std::cout.flush();
+  }
+
+  std::ofstream openPathTable() {
+    std::ofstream ofstream(pathTable,
+                           std::ofstream::out | std::ofstream::binary);
+
+    if (!ofstream.is_open()) {
+      throw std::runtime_error("Error: Failed to open \"" + pathTable +
+                               "\".");
+    }
+
+    return ofstream;
+  }
+
+  // Writes the length of path before path, since path can contain newlines.
+  static void writePathTableEntry(tfs::BufferedWriter &pathTableWriter,
+                                  std::string_view path) {
+    pathTableWriter.writeLittleEndian(static_cast<std::uint64_t>(path.size()));
+    pathTableWriter.write(path);
+  }
+
  public:
   AbstractEventHandler(const Config &config,
                        const std::vector<fs::path> &textFilePaths_,
-                       std::size_t numHashesToCompare_)
+                       std::size_t numHashes_, std::size_t numHashesToCompare_)
       : verbose(config.verbose),
         outputFormat(config.outputFormat),
         recordingSources(config.recordingSources),
-        textFilePaths(textFilePaths_),
-        numHashesToCompare(numHashesToCompare_) {}
+        pathTable(config.pathTable),
+        numHashes(numHashes_),
+        numHashesToCompare(numHashesToCompare_),
+        clusters(outputFormat == OutputFormat::CLUSTERS ? numHashes : 0),
+        writer(std::cout) {
+    for (const auto &textFilePath : textFilePaths_) {
+      textFilePaths.push_back(textFilePath.u8string());
+    }
+  }
+
+  bool shouldCompare(const tfs::FuzzyHashFromFile &hash1,
+                     const tfs::FuzzyHashFromFile &hash2) override {
+    if (outputFormat == OutputFormat::CLUSTERS) {
+      return !clusters.areConnected(hash1.hashIndex, hash2.hashIndex);
+    }
+
+    return true;
+  }
 
   void onSimilarPairFound(const tfs::FuzzyHashFromFile &hash1,
                           const tfs::FuzzyHashFromFile &hash2,
@@ -172,7 +441,93 @@ class AbstractEventHandler : public tfs::HashComparisonEventHandler {
       numSimilarPairs++;
     }
 
-    printSimilarPair(hash1, hash2, similarityScore);
+    if (outputFormat == OutputFormat::CLUSTERS) {
+      clusters.unite(hash1.hashIndex, hash2.hashIndex);
+    } else {
+      printSimilarPair(hash1, hash2, similarityScore);
+    }
+  }
+
+  // Prints the clusters or the path table if the output format needs them,
+  // and flushes the output.
+  void finish(const tfs::HashComparisonMap &blockSizesToHashes) {
+    if (outputFormat == OutputFormat::CLUSTERS ||
+        outputFormat == OutputFormat::BINARY) {
+      std::vector<const std::string *> paths(numHashes);
+
+      for (const auto &pair : blockSizesToHashes) {
+        for (const auto &hash : pair.second) {
+          paths[hash.hashIndex] = &hash.filePath;
+        }
+      }
+
+      if (outputFormat == OutputFormat::CLUSTERS) {
+        printClusters(paths);
+      } else {
+        std::ofstream ofstream = openPathTable();
+        tfs::BufferedWriter pathTableWriter(ofstream);
+
+        for (const auto path : paths) {
+          writePathTableEntry(pathTableWriter, *path);
+        }
+      }
+    }
+
+    writer.flush();
+  }
+
+  // Reads back file paths one block size at a time, numbering the hashes the
+  // same way tfs::compareHashesInDatabase() does. For clusters, only keeps the
+  // file paths of hashes in clusters.
+  void finish(tfs::FuzzyHashDatabase &database) {
+    if (outputFormat == OutputFormat::CLUSTERS) {
+      std::vector<bool> inClusters(clusters.size(), false);
+
+      for (std::size_t i = 0; i < clusters.size(); ++i) {
+        std::size_t root = clusters.find(i);
+
+        if (root != i) {
+          inClusters[i] = true;
+          inClusters[root] = true;
+        }
+      }
+
+      std::vector<std::string> filePaths(clusters.size());
+      std::vector<const std::string *> paths(clusters.size(), nullptr);
+      std::size_t hashIndex = 0;
+
+      for (const auto blockSize : database.getBlockSizes()) {
+        std::vector<tfs::FuzzyHash> hashes;
+
+        database.getHashesWithBlockSize(hashes, blockSize);
+
+        for (auto &hash : hashes) {
+          if (inClusters[hashIndex]) {
+            filePaths[hashIndex] = std::move(hash.filePath);
+            paths[hashIndex] = &filePaths[hashIndex];
+          }
+
+          hashIndex++;
+        }
+      }
+
+      printClusters(paths);
+    } else if (outputFormat == OutputFormat::BINARY) {
+      std::ofstream ofstream = openPathTable();
+      tfs::BufferedWriter pathTableWriter(ofstream);
+
+      for (const auto blockSize : database.getBlockSizes()) {
+        std::vector<tfs::FuzzyHash> hashes;
+
+        database.getHashesWithBlockSize(hashes, blockSize);
+
+        for (const auto &hash : hashes) {
+          writePathTableEntry(pathTableWriter, hash.filePath);
+        }
+      }
+    }
+
+    writer.flush();
   }
 };
 
@@ -198,6 +553,20 @@ class SynchronizingEventHandler : public AbstractEventHandler {
   void onSimilarPairFound(const tfs::FuzzyHashFromFile &hash1,
                           const tfs::FuzzyHashFromFile &hash2,
                           double similarityScore) override {
+    // The clusters are safe to update concurrently, so only the counter needs
+    // the lock.
+    if (outputFormat == OutputFormat::CLUSTERS) {
+      clusters.unite(hash1.hashIndex, hash2.hashIndex);
+
+      if (verbose) {
+        const std::lock_guard<std::mutex> outputLockGuard(outputMutex);
+
+        numSimilarPairs++;
+      }
+
+      return;
+    }
+
     const std::lock_guard<std::mutex> outputLockGuard(outputMutex);
 
     AbstractEventHandler::onSimilarPairFound(hash1, hash2, similarityScore);
@@ -215,13 +584,33 @@ class SynchronizingEventHandler : public AbstractEventHandler {
 
 std::unique_ptr<AbstractEventHandler> makeEventHandler(
     const Config &config, const std::vector<fs::path> &textFilePaths,
-    std::size_t numHashesToCompare) {
+    std::size_t numHashes, std::size_t numHashesToCompare) {
   if (config.numThreads <= 1) {
-    return std::make_unique<EventHandler>(config, textFilePaths,
+    return std::make_unique<EventHandler>(config, textFilePaths, numHashes,
                                           numHashesToCompare);
   } else {
-    return std::make_unique<SynchronizingEventHandler>(config, textFilePaths,
-                                                       numHashesToCompare);
+    return std::make_unique<SynchronizingEventHandler>(
+        config, textFilePaths, numHashes, numHashesToCompare);
+  }
+}
+
+// Standard output is in text mode, which on Windows writes each '\n' byte of
+// the binary output as "\r\n".
+void setStdoutToBinaryMode() {
+#ifdef _WIN32
+  if (_setmode(_fileno(stdout), _O_BINARY) == -1) {
+    throw std::runtime_error("Error: Failed to set stdout to binary mode.");
+  }
+#endif
+}
+
+void writeStatsAndTrace(const Config &config, tfs::PhaseTimer &phaseTimer) {
+  if (!config.stats.empty()) {
+    tfs::writeStats(config.stats, phaseTimer);
+  }
+
+  if (!config.trace.empty()) {
+    tfs::writeTrace(config.trace);
   }
 }
 }  // namespace
@@ -230,7 +619,8 @@ int main(int argc, char **argv) {
   try {
     const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
 
-    if (commandLine.arguments().empty()) {
+    if (commandLine.arguments().empty() &&
+        !commandLine.specifiedOption("--database")) {
       std::cerr << "Usage: " << commandLine.program()
                 << " [options] <text file with hashes>...\n"
                 << std::endl;
@@ -243,22 +633,104 @@ int main(int argc, char **argv) {
 
     const Config config(commandLine);
     const auto paths = tlo::stringsToPaths(commandLine.arguments());
+    tfs::PhaseTimer phaseTimer;
+
+    if (config.outputFormat == OutputFormat::BINARY) {
+      setStdoutToBinaryMode();
+    }
+
+    if (!config.trace.empty()) {
+      tfs::startTracing();
+    }
+
+    if (!config.database.empty()) {
+      phaseTimer.startPhase("compare");
+
+      tfs::FuzzyHashDatabase database;
+
+      database.open(config.database);
+
+      const std::size_t numHashes = database.getNumHashes();
+      std::unique_ptr<AbstractEventHandler> handler =
+          makeEventHandler(config, paths, numHashes, numHashes);
+
+      if (config.verbose) {
+        std::cerr << "Comparing hashes in database." << std::endl;
+      }
+
+      tfs::compareHashesInDatabase(database, config.similarityThreshold,
+                                   *handler, config.numThreads, config.metric);
+      phaseTimer.startPhase("finishOutput");
+      handler->finish(database);
+      writeStatsAndTrace(config, phaseTimer);
+
+      return 0;
+    }
 
     if (config.verbose) {
       std::cerr << "Reading hashes." << std::endl;
     }
 
+    phaseTimer.startPhase("readHashes");
+
     const auto [blockSizesToHashes, numHashes] =
-        tfs::readHashesForComparison(paths, config.recordingSources);
-    std::unique_ptr<AbstractEventHandler> handler =
-        makeEventHandler(config, paths, numHashes);
+        tfs::readHashesForComparison(paths, config.recordingSources,
+                                     config.numThreads);
+
+    if (!config.pairDatabase.empty()) {
+      phaseTimer.startPhase("prepareIncrementalComparison");
+
+      tfs::SimilarPairDatabase pairDatabase;
+
+      pairDatabase.open(config.pairDatabase);
+
+      const tfs::HashComparisonMap newBlockSizesToHashes =
+          tfs::prepareIncrementalComparison(pairDatabase, blockSizesToHashes,
+                                            config.similarityThreshold,
+                                            config.metric);
+      std::size_t numNewHashes = 0;
+
+      for (const auto &pair : newBlockSizesToHashes) {
+        numNewHashes += pair.second.size();
+      }
+
+      std::unique_ptr<AbstractEventHandler> handler =
+          makeEventHandler(config, paths, numHashes, numNewHashes);
+
+      if (config.verbose) {
+        std::cerr << "Comparing " << numNewHashes << " new or modified "
+                  << (numNewHashes == 1 ? "hash" : "hashes") << '.'
+                  << std::endl;
+      }
+
+      phaseTimer.startPhase("compare");
+      tfs::compareHashesIncrementally(
+          pairDatabase, blockSizesToHashes, newBlockSizesToHashes,
+          config.similarityThreshold, *handler, config.numThreads,
+          config.metric);
+      phaseTimer.startPhase("finishOutput");
+      handler->finish(blockSizesToHashes);
+      writeStatsAndTrace(config, phaseTimer);
+
+      return 0;
+    }
+
+    std::unique_ptr<AbstractEventHandler> handler = makeEventHandler(
+        config, paths, numHashes,
+        tfs::numHashesInShard(blockSizesToHashes, config.shard,
+                              config.crossSourcesOnly));
 
     if (config.verbose) {
       std::cerr << "Comparing hashes." << std::endl;
     }
 
+    phaseTimer.startPhase("compare");
     tfs::compareHashes(blockSizesToHashes, config.similarityThreshold, *handler,
-                       config.numThreads);
+                       config.numThreads, config.shard,
+                       config.crossSourcesOnly, config.metric);
+    phaseTimer.startPhase("finishOutput");
+    handler->finish(blockSizesToHashes);
+    writeStatsAndTrace(config, phaseTimer);
   } catch (const std::exception &exception) {
     std::cerr << exception.what() << std::endl;
 
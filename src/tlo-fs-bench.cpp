@@ -0,0 +1,604 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tlo-cpp/command-line.hpp>
+#include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/compare.hpp>
+#include <tlo-file-similarity/database.hpp>
+#include <tlo-file-similarity/fuzzy.hpp>
+#include <tlo-file-similarity/hashers.hpp>
+#include <tlo-file-similarity/writer.hpp>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+enum class OutputFormat { REGULAR, JSON };
+
+constexpr unsigned long DEFAULT_MIN_TIME = 500;
+constexpr unsigned long MIN_MIN_TIME = 1;
+constexpr unsigned long MAX_MIN_TIME = 3600000;
+
+constexpr OutputFormat DEFAULT_OUTPUT_FORMAT = OutputFormat::REGULAR;
+const std::string DEFAULT_OUTPUT_FORMAT_STRING = "regular";
+
+const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
+    {"--filter",
+     {true,
+      "Only run the benchmarks whose names contain the specified string "
+      "(default: run all benchmarks)."}},
+    {"--min-time",
+     {true,
+      "Minimum number of milliseconds each benchmark is timed for. The number "
+      "of iterations is doubled until the iterations take at least this long "
+      "(default: " +
+          std::to_string(DEFAULT_MIN_TIME) + ")."}},
+    {"--output-format",
+     {true,
+      "Output format can be regular (one line per benchmark) or json (one "
+      "JSON object with an array of results, for comparing runs across "
+      "releases) (default: " +
+          DEFAULT_OUTPUT_FORMAT_STRING + ")."}}};
+
+struct Config {
+  std::string filter;
+  std::chrono::milliseconds minTime{DEFAULT_MIN_TIME};
+  OutputFormat outputFormat = DEFAULT_OUTPUT_FORMAT;
+
+  Config(const tlo::CommandLine &commandLine) {
+    if (commandLine.specifiedOption("--filter")) {
+      filter = commandLine.getOptionValue("--filter");
+    }
+
+    if (commandLine.specifiedOption("--min-time")) {
+      minTime = std::chrono::milliseconds(commandLine.getOptionValueAsULong(
+          "--min-time", MIN_MIN_TIME, MAX_MIN_TIME));
+    }
+
+    if (commandLine.specifiedOption("--output-format")) {
+      std::string string = commandLine.getOptionValue("--output-format");
+
+      if (string == "regular") {
+        outputFormat = OutputFormat::REGULAR;
+      } else if (string == "json") {
+        outputFormat = OutputFormat::JSON;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized output format.");
+      }
+    }
+  }
+};
+
+// Results are added to this so that the compiler cannot remove the work done
+// by a benchmark.
+volatile std::uint64_t sink = 0;
+
+struct Benchmark {
+  std::string name;
+
+  // Bytes and items processed by one iteration, or 0 if the throughput in
+  // bytes or items is not meaningful.
+  std::uint64_t bytesPerIteration;
+  std::uint64_t itemsPerIteration;
+
+  // Sets up the data the benchmark needs and returns a function that does one
+  // iteration. Only called if the benchmark is run.
+  std::function<std::function<void()>()> setUp;
+};
+
+struct BenchmarkResult {
+  std::string name;
+  std::uint64_t iterations;
+  double nanosecondsPerIteration;
+  double bytesPerSecond;
+  double itemsPerSecond;
+};
+
+constexpr std::uint64_t MAX_ITERATIONS = 1000000000;
+
+BenchmarkResult runBenchmark(const Benchmark &benchmark,
+                             std::chrono::milliseconds minTime) {
+  const std::function<void()> iterate = benchmark.setUp();
+  std::uint64_t iterations = 1;
+  std::chrono::duration<double, std::nano> elapsed{};
+
+  // Warm up caches before timing.
+  iterate();
+
+  for (;;) {
+    const auto start = std::chrono::steady_clock::now();
+
+    for (std::uint64_t i = 0; i < iterations; ++i) {
+      iterate();
+    }
+
+    elapsed = std::chrono::steady_clock::now() - start;
+
+    if (elapsed >= minTime || iterations >= MAX_ITERATIONS ||
+        tlo::stopRequested.load()) {
+      break;
+    }
+
+    iterations *= 2;
+  }
+
+  const double seconds = elapsed.count() / 1e9;
+
+  return {benchmark.name, iterations,
+          elapsed.count() / static_cast<double>(iterations),
+          static_cast<double>(benchmark.bytesPerIteration * iterations) /
+              seconds,
+          static_cast<double>(benchmark.itemsPerIteration * iterations) /
+              seconds};
+}
+
+// Deterministic data, so results of different runs are comparable.
+constexpr std::mt19937_64::result_type SEED = 20200120;
+
+std::string randomBytes(std::mt19937_64 &rng, std::size_t size) {
+  std::string bytes(size, '\0');
+
+  for (auto &byte : bytes) {
+    byte = static_cast<char>(rng() % 256);
+  }
+
+  return bytes;
+}
+
+std::string randomPart(std::mt19937_64 &rng, std::size_t size) {
+  std::string part(size, '\0');
+
+  for (auto &character : part) {
+    character = tfs::BASE64_ALPHABET[rng() % tfs::BASE64_ALPHABET.size()];
+  }
+
+  return part;
+}
+
+// Replaces about one in every mutationInterval characters of part.
+std::string mutatePart(std::mt19937_64 &rng, std::string part,
+                       std::size_t mutationInterval) {
+  for (auto &character : part) {
+    if (rng() % mutationInterval == 0) {
+      character = tfs::BASE64_ALPHABET[rng() % tfs::BASE64_ALPHABET.size()];
+    }
+  }
+
+  return part;
+}
+
+// Smallest block size of the form MIN_BLOCK_SIZE * 2^n that is expected to
+// give a part1 of at most SPAMSUM_LENGTH characters, as fuzzyHash() starts
+// with.
+std::size_t blockSizeForSize(std::size_t size) {
+  std::size_t blockSize = tfs::MIN_BLOCK_SIZE;
+
+  while (blockSize * tfs::SPAMSUM_LENGTH < size) {
+    blockSize *= 2;
+  }
+
+  return blockSize;
+}
+
+constexpr std::size_t NUM_HASHES = 10000;
+constexpr std::size_t NUM_HASHES_PER_DIRECTORY = 100;
+
+// Hashes that look like those of files in directories of
+// NUM_HASHES_PER_DIRECTORY files each.
+std::vector<tfs::FuzzyHash> makeHashes(std::size_t numHashes) {
+  std::mt19937_64 rng(SEED);
+  std::vector<tfs::FuzzyHash> hashes;
+
+  hashes.reserve(numHashes);
+
+  for (std::size_t i = 0; i < numHashes; ++i) {
+    hashes.push_back({tfs::MIN_BLOCK_SIZE << (rng() % 12),
+                      randomPart(rng, tfs::SPAMSUM_LENGTH),
+                      randomPart(rng, tfs::SPAMSUM_LENGTH / 2),
+                      "/bench/directory" +
+                          std::to_string(i / NUM_HASHES_PER_DIRECTORY) +
+                          "/file" + std::to_string(i)});
+  }
+
+  return hashes;
+}
+
+std::vector<std::string> makeHashLines(std::size_t numHashes) {
+  std::vector<std::string> lines;
+
+  for (const auto &hash : makeHashes(numHashes)) {
+    lines.push_back(std::to_string(hash.blockSize) + ':' + hash.part1 + ':' +
+                    hash.part2 + ',' + hash.filePath);
+  }
+
+  return lines;
+}
+
+// Creates a directory for the files of the benchmarks and removes it and the
+// files on destruction.
+class TemporaryDirectory {
+ private:
+  fs::path path_;
+
+ public:
+  TemporaryDirectory() {
+    path_ = fs::temp_directory_path() /
+            ("tlo-fs-bench-" + std::to_string(std::random_device()()));
+    fs::create_directories(path_);
+  }
+
+  TemporaryDirectory(const TemporaryDirectory &) = delete;
+  TemporaryDirectory &operator=(const TemporaryDirectory &) = delete;
+
+  ~TemporaryDirectory() {
+    std::error_code errorCode;
+
+    fs::remove_all(path_, errorCode);
+  }
+
+  const fs::path &path() const { return path_; }
+};
+
+constexpr std::size_t HASHER_INPUT_SIZE = 1 << 20;
+
+void addHasherBenchmarks(std::vector<Benchmark> &benchmarks) {
+  benchmarks.push_back({"RollingHasher/1MiB", HASHER_INPUT_SIZE, 0, [] {
+                          std::mt19937_64 rng(SEED);
+                          auto bytes = std::make_shared<std::string>(
+                              randomBytes(rng, HASHER_INPUT_SIZE));
+
+                          return std::function<void()>([bytes] {
+                            tfs::RollingHasher hasher;
+                            std::uint64_t sum = 0;
+
+                            for (const char byte : *bytes) {
+                              hasher.addByte(static_cast<unsigned char>(byte));
+                              sum += hasher.getHash();
+                            }
+
+                            sink = sink + sum;
+                          });
+                        }});
+
+  benchmarks.push_back({"Fnv1Hasher/1MiB", HASHER_INPUT_SIZE, 0, [] {
+                          std::mt19937_64 rng(SEED);
+                          auto bytes = std::make_shared<std::string>(
+                              randomBytes(rng, HASHER_INPUT_SIZE));
+
+                          return std::function<void()>([bytes] {
+                            tfs::Fnv1Hasher hasher;
+
+                            for (const char byte : *bytes) {
+                              hasher.addByte(static_cast<unsigned char>(byte));
+                            }
+
+                            sink = sink + hasher.getHash();
+                          });
+                        }});
+
+  const std::pair<const char *, std::size_t> sizes[] = {
+      {"4KiB", 1 << 12}, {"64KiB", 1 << 16}, {"1MiB", 1 << 20}};
+
+  for (const auto &[sizeName, size] : sizes) {
+    benchmarks.push_back(
+        {std::string("hashUsingBlockSize/") + sizeName, size, 0, [size = size] {
+           std::mt19937_64 rng(SEED);
+           auto bytes = std::make_shared<std::string>(randomBytes(rng, size));
+           const std::size_t blockSize = blockSizeForSize(size);
+
+           return std::function<void()>([bytes, blockSize] {
+             const auto parts = tfs::hashUsingBlockSize(*bytes, blockSize);
+
+             sink = sink + parts.first.size() + parts.second.size();
+           });
+         }});
+  }
+}
+
+constexpr std::size_t NUM_PART_PAIRS = 1000;
+
+// Pairs of 64-character parts. A mutationInterval of 0 makes the parts of each
+// pair unrelated.
+std::shared_ptr<std::vector<std::pair<std::string, std::string>>>
+makePartPairs(std::size_t mutationInterval) {
+  std::mt19937_64 rng(SEED);
+  auto pairs =
+      std::make_shared<std::vector<std::pair<std::string, std::string>>>();
+
+  for (std::size_t i = 0; i < NUM_PART_PAIRS; ++i) {
+    std::string part = randomPart(rng, 64);
+    std::string otherPart = mutationInterval == 0
+                                ? randomPart(rng, 64)
+                                : mutatePart(rng, part, mutationInterval);
+
+    pairs->emplace_back(std::move(part), std::move(otherPart));
+  }
+
+  return pairs;
+}
+
+void addComparisonBenchmarks(std::vector<Benchmark> &benchmarks) {
+  const std::tuple<const char *, std::size_t, double> cases[] = {
+      {"similar", 4, 0.0},
+      {"unrelated", 0, 0.0},
+      {"unrelatedWithThreshold50", 0, 50.0}};
+
+  for (const auto &[caseName, mutationInterval, minSimilarityScore] : cases) {
+    benchmarks.push_back(
+        {std::string("compareWithLcsDistance/") + caseName, 0, NUM_PART_PAIRS,
+         [mutationInterval = mutationInterval,
+          minSimilarityScore = minSimilarityScore] {
+           auto pairs = makePartPairs(mutationInterval);
+
+           return std::function<void()>([pairs, minSimilarityScore] {
+             double sum = 0.0;
+
+             for (const auto &[part, otherPart] : *pairs) {
+               sum += tfs::compareWithLcsDistance(part, otherPart,
+                                                  minSimilarityScore);
+             }
+
+             sink = sink + static_cast<std::uint64_t>(sum);
+           });
+         }});
+  }
+}
+
+void addParsingBenchmarks(std::vector<Benchmark> &benchmarks,
+                          const TemporaryDirectory &directory) {
+  benchmarks.push_back({"parseHash", 0, NUM_HASHES, [] {
+                          auto lines = std::make_shared<
+                              std::vector<std::string>>(
+                              makeHashLines(NUM_HASHES));
+
+                          return std::function<void()>([lines] {
+                            std::uint64_t sum = 0;
+
+                            for (const auto &line : *lines) {
+                              sum += tfs::parseHash(line).blockSize;
+                            }
+
+                            sink = sink + sum;
+                          });
+                        }});
+
+  benchmarks.push_back(
+      {"readHashesForComparison", 0, NUM_HASHES, [&directory] {
+         const fs::path textFilePath = directory.path() / "hashes.txt";
+         std::ofstream ofstream(textFilePath, std::ofstream::out);
+
+         for (const auto &line : makeHashLines(NUM_HASHES)) {
+           ofstream << line << '\n';
+         }
+
+         ofstream.close();
+
+         return std::function<void()>([textFilePath] {
+           const auto result = tfs::readHashesForComparison({textFilePath});
+
+           sink = sink + result.second;
+         });
+       }});
+}
+
+constexpr std::size_t NUM_ROWS_PER_INSERT = 100;
+
+std::shared_ptr<tfs::FuzzyHashDatabase> openDatabase(
+    const TemporaryDirectory &directory, const std::string &fileName) {
+  auto database = std::make_shared<tfs::FuzzyHashDatabase>();
+
+  database->open(directory.path() / fileName);
+  return database;
+}
+
+// Rows for the hashes, with made-up file sizes and last write times.
+tfs::FuzzyHashRowSet makeRows(std::vector<tfs::FuzzyHash> &&hashes) {
+  tfs::FuzzyHashRowSet rows;
+
+  for (auto &hash : hashes) {
+    rows.emplace(std::move(hash), 1000, "2020-01-20 00:00:00");
+  }
+
+  return rows;
+}
+
+void addDatabaseBenchmarks(std::vector<Benchmark> &benchmarks,
+                           const TemporaryDirectory &directory) {
+  benchmarks.push_back(
+      {"FuzzyHashDatabase/insertHashes", 0, NUM_ROWS_PER_INSERT,
+       [&directory] {
+         auto database = openDatabase(directory, "insert.db");
+         auto hashes = std::make_shared<std::vector<tfs::FuzzyHash>>(
+             makeHashes(NUM_ROWS_PER_INSERT));
+         auto numIterations = std::make_shared<std::size_t>(0);
+
+         return std::function<void()>([database, hashes, numIterations] {
+           // Every iteration inserts new file paths.
+           std::vector<tfs::FuzzyHash> newHashes = *hashes;
+
+           for (auto &hash : newHashes) {
+             hash.filePath += '.' + std::to_string(*numIterations);
+           }
+
+           (*numIterations)++;
+           database->insertHashes(makeRows(std::move(newHashes)));
+         });
+       }});
+
+  benchmarks.push_back(
+      {"FuzzyHashDatabase/upsertHashes", 0, NUM_ROWS_PER_INSERT, [&directory] {
+         auto database = openDatabase(directory, "upsert.db");
+         auto rows = std::make_shared<tfs::FuzzyHashRowSet>(
+             makeRows(makeHashes(NUM_ROWS_PER_INSERT)));
+
+         database->upsertHashes(*rows);
+
+         // Every iteration replaces the rows stored by the previous one.
+         return std::function<void()>(
+             [database, rows] { database->upsertHashes(*rows); });
+       }});
+
+  auto setUpSelectDatabase = [&directory] {
+    auto database = openDatabase(directory, "select.db");
+
+    if (database->getNumHashes() == 0) {
+      database->insertHashes(makeRows(makeHashes(NUM_HASHES)));
+    }
+
+    return database;
+  };
+
+  benchmarks.push_back(
+      {"FuzzyHashDatabase/getHashesForFiles", 0, NUM_HASHES_PER_DIRECTORY,
+       [setUpSelectDatabase] {
+         auto database = setUpSelectDatabase();
+         const std::vector<tfs::FuzzyHash> hashes = makeHashes(NUM_HASHES);
+         auto filePaths = std::make_shared<std::vector<fs::path>>();
+
+         // One file from each of NUM_HASHES_PER_DIRECTORY directories.
+         for (std::size_t i = 0; i < hashes.size();
+              i += NUM_HASHES / NUM_HASHES_PER_DIRECTORY) {
+           filePaths->push_back(hashes[i].filePath);
+         }
+
+         return std::function<void()>([database, filePaths] {
+           tfs::FuzzyHashRowSet results;
+
+           database->getHashesForFiles(results, *filePaths);
+           sink = sink + results.size();
+         });
+       }});
+
+  benchmarks.push_back(
+      {"FuzzyHashDatabase/getHashesForDirectory", 0, NUM_HASHES_PER_DIRECTORY,
+       [setUpSelectDatabase] {
+         auto database = setUpSelectDatabase();
+
+         return std::function<void()>([database] {
+           tfs::FuzzyHashRowSet results;
+
+           database->getHashesForDirectory(results, "/bench/directory42");
+           sink = sink + results.size();
+         });
+       }});
+
+  benchmarks.push_back(
+      {"FuzzyHashDatabase/getHashesWithBlockSize", 0, 0,
+       [setUpSelectDatabase] {
+         auto database = setUpSelectDatabase();
+
+         return std::function<void()>([database] {
+           std::vector<tfs::FuzzyHash> results;
+
+           database->getHashesWithBlockSize(results, tfs::MIN_BLOCK_SIZE);
+           sink = sink + results.size();
+         });
+       }});
+}
+
+void printResults(const std::vector<BenchmarkResult> &results,
+                  OutputFormat outputFormat) {
+  if (outputFormat == OutputFormat::JSON) {
+    tfs::BufferedWriter writer(std::cout);
+
+    writer.write("{\"benchmarks\":[");
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+      const BenchmarkResult &result = results[i];
+
+      writer.write(i == 0 ? "\n" : ",\n");
+      writer.write("{\"name\":");
+      writer.writeJsonString(result.name);
+      writer.write(",\"iterations\":");
+      writer.writeUnsigned(result.iterations);
+      writer.write(",\"nanosecondsPerIteration\":");
+      writer.writeDouble(result.nanosecondsPerIteration);
+      writer.write(",\"bytesPerSecond\":");
+      writer.writeDouble(result.bytesPerSecond);
+      writer.write(",\"itemsPerSecond\":");
+      writer.writeDouble(result.itemsPerSecond);
+      writer.write('}');
+    }
+
+    writer.write("\n]}\n");
+    return;
+  }
+
+  for (const auto &result : results) {
+    std::cout << std::left << std::setw(48) << result.name << std::right
+              << std::setw(12) << result.iterations << " iterations "
+              << std::setw(14) << std::fixed << std::setprecision(1)
+              << result.nanosecondsPerIteration << " ns/iteration";
+
+    if (result.bytesPerSecond > 0.0) {
+      std::cout << ' ' << std::setprecision(1)
+                << result.bytesPerSecond / (1 << 20) << " MiB/s";
+    }
+
+    if (result.itemsPerSecond > 0.0) {
+      std::cout << ' ' << std::setprecision(0) << result.itemsPerSecond
+                << " items/s";
+    }
+
+    std::cout << '\n';
+  }
+
+  std::cout.flush();
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
+
+    if (!commandLine.arguments().empty()) {
+      std::cerr << "Usage: " << commandLine.program() << " [options]\n"
+                << std::endl;
+      commandLine.printValidOptions(std::cerr);
+
+      return 1;
+    }
+
+    tlo::registerInterruptSignalHandler(tloRequestStop);
+
+    const Config config(commandLine);
+    const TemporaryDirectory directory;
+    std::vector<Benchmark> benchmarks;
+
+    addHasherBenchmarks(benchmarks);
+    addComparisonBenchmarks(benchmarks);
+    addParsingBenchmarks(benchmarks, directory);
+    addDatabaseBenchmarks(benchmarks, directory);
+
+    std::vector<BenchmarkResult> results;
+
+    for (const auto &benchmark : benchmarks) {
+      if (tlo::stopRequested.load()) {
+        break;
+      }
+
+      if (benchmark.name.find(config.filter) != std::string::npos) {
+        results.push_back(runBenchmark(benchmark, config.minTime));
+      }
+    }
+
+    printResults(results, config.outputFormat);
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+}
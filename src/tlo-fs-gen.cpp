@@ -0,0 +1,733 @@
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tlo-cpp/command-line.hpp>
+#include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/fuzzy.hpp>
+#include <tlo-file-similarity/writer.hpp>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+enum class OutputFormat { FILES, HASHES };
+
+enum class SizeDistribution { UNIFORM, LOG_UNIFORM };
+
+// Named after the files in the samples directory, which were derived from
+// Original.txt in these ways.
+enum class Mutation {
+  REMOVED_1ST_HALF,
+  REMOVED_2ND_HALF,
+  MOVED_SOME_LINES,
+  MOVED_SOME_WORDS,
+  REMOVED_SOME_LINES,
+  REMOVED_SOME_WORDS,
+  SWAPPED_PARAGRAPHS
+};
+
+const std::pair<std::string_view, Mutation> MUTATION_NAMES[] = {
+    {"removed-1st-half", Mutation::REMOVED_1ST_HALF},
+    {"removed-2nd-half", Mutation::REMOVED_2ND_HALF},
+    {"moved-some-lines", Mutation::MOVED_SOME_LINES},
+    {"moved-some-words", Mutation::MOVED_SOME_WORDS},
+    {"removed-some-lines", Mutation::REMOVED_SOME_LINES},
+    {"removed-some-words", Mutation::REMOVED_SOME_WORDS},
+    {"swapped-paragraphs", Mutation::SWAPPED_PARAGRAPHS}};
+
+std::string_view mutationName(Mutation mutation) {
+  for (const auto &[name, value] : MUTATION_NAMES) {
+    if (value == mutation) {
+      return name;
+    }
+  }
+
+  return "";
+}
+
+constexpr OutputFormat DEFAULT_OUTPUT_FORMAT = OutputFormat::FILES;
+const std::string DEFAULT_OUTPUT_FORMAT_STRING = "files";
+
+constexpr unsigned long DEFAULT_SEED = 0;
+constexpr unsigned long MAX_SEED = 4294967295UL;
+
+constexpr unsigned long DEFAULT_NUM_CLUSTERS = 10;
+constexpr unsigned long MIN_NUM_CLUSTERS = 1;
+constexpr unsigned long MAX_NUM_CLUSTERS = 4294967295UL;
+
+constexpr unsigned long DEFAULT_MIN_CLUSTER_SIZE = 1;
+constexpr unsigned long DEFAULT_MAX_CLUSTER_SIZE = 8;
+constexpr unsigned long MIN_CLUSTER_SIZE = 1;
+constexpr unsigned long MAX_CLUSTER_SIZE = 1000000;
+
+constexpr unsigned long DEFAULT_MIN_FILE_SIZE = 4096;
+constexpr unsigned long DEFAULT_MAX_FILE_SIZE = 1048576;
+constexpr unsigned long MIN_FILE_SIZE = 1;
+constexpr unsigned long MAX_FILE_SIZE = 1073741824;
+
+constexpr SizeDistribution DEFAULT_SIZE_DISTRIBUTION =
+    SizeDistribution::LOG_UNIFORM;
+const std::string DEFAULT_SIZE_DISTRIBUTION_STRING = "log-uniform";
+
+constexpr unsigned long DEFAULT_MUTATION_INTERVAL = 10;
+constexpr unsigned long MIN_MUTATION_INTERVAL = 1;
+constexpr unsigned long MAX_MUTATION_INTERVAL = 1000000;
+
+std::string mutationNames() {
+  std::string names;
+
+  for (const auto &pair : MUTATION_NAMES) {
+    if (!names.empty()) {
+      names += ", ";
+    }
+
+    names += pair.first;
+  }
+
+  return names;
+}
+
+const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
+    {"--output-format",
+     {true,
+      "Output format can be files (a tree of text files is created in the "
+      "output directory) or hashes (a text file of fuzzy hashes is written "
+      "directly, without creating any files, by applying the mutations to "
+      "the parts of the hashes instead of to file contents) (default: " +
+          DEFAULT_OUTPUT_FORMAT_STRING + ")."}},
+    {"--seed",
+     {true, "Seed of the random number generator. The same seed and options "
+            "always generate the same output (default: " +
+                std::to_string(DEFAULT_SEED) + ")."}},
+    {"--num-clusters",
+     {true,
+      "Number of clusters to generate. Each cluster is an original file and "
+      "files derived from it, stored in directory group<g>/cluster<c>, where "
+      "g is c / 1000. Files in different clusters are unrelated "
+      "(default: " +
+          std::to_string(DEFAULT_NUM_CLUSTERS) + ")."}},
+    {"--min-cluster-size",
+     {true, "Minimum number of files in a cluster, including the original "
+            "(default: " +
+                std::to_string(DEFAULT_MIN_CLUSTER_SIZE) + ")."}},
+    {"--max-cluster-size",
+     {true, "Maximum number of files in a cluster, including the original "
+            "(default: " +
+                std::to_string(DEFAULT_MAX_CLUSTER_SIZE) + ")."}},
+    {"--min-file-size",
+     {true, "Minimum size in bytes of an original file (default: " +
+                std::to_string(DEFAULT_MIN_FILE_SIZE) + ")."}},
+    {"--max-file-size",
+     {true, "Maximum size in bytes of an original file (default: " +
+                std::to_string(DEFAULT_MAX_FILE_SIZE) + ")."}},
+    {"--size-distribution",
+     {true,
+      "Distribution of the sizes of original files. Can be uniform or "
+      "log-uniform (each power of two between the minimum and maximum sizes "
+      "is equally likely) (default: " +
+          DEFAULT_SIZE_DISTRIBUTION_STRING + ")."}},
+    {"--mutations",
+     {true,
+      "Comma-separated list of the ways files are derived from the original "
+      "file of their cluster. Each derived file uses one of them, chosen at "
+      "random. Can include " +
+          mutationNames() + " (default: all of them)."}},
+    {"--mutation-interval",
+     {true,
+      "About one in every this many lines or words is moved or removed by the "
+      "moved-some-* and removed-some-* mutations (default: " +
+          std::to_string(DEFAULT_MUTATION_INTERVAL) + ")."}}};
+
+std::vector<Mutation> parseMutations(std::string_view string) {
+  std::vector<Mutation> mutations;
+
+  while (!string.empty()) {
+    const auto commaPosition = string.find(',');
+    const std::string_view name = string.substr(0, commaPosition);
+    bool found = false;
+
+    for (const auto &[mutationName, mutation] : MUTATION_NAMES) {
+      if (name == mutationName) {
+        mutations.push_back(mutation);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      throw std::runtime_error("Error: \"" + std::string(name) +
+                               "\" is not a recognized mutation.");
+    }
+
+    string = commaPosition == std::string_view::npos
+                 ? std::string_view()
+                 : string.substr(commaPosition + 1);
+  }
+
+  return mutations;
+}
+
+struct Config {
+  OutputFormat outputFormat = DEFAULT_OUTPUT_FORMAT;
+  unsigned long seed = DEFAULT_SEED;
+  unsigned long numClusters = DEFAULT_NUM_CLUSTERS;
+  unsigned long minClusterSize = DEFAULT_MIN_CLUSTER_SIZE;
+  unsigned long maxClusterSize = DEFAULT_MAX_CLUSTER_SIZE;
+  unsigned long minFileSize = DEFAULT_MIN_FILE_SIZE;
+  unsigned long maxFileSize = DEFAULT_MAX_FILE_SIZE;
+  SizeDistribution sizeDistribution = DEFAULT_SIZE_DISTRIBUTION;
+  std::vector<Mutation> mutations;
+  unsigned long mutationInterval = DEFAULT_MUTATION_INTERVAL;
+
+  Config(const tlo::CommandLine &commandLine) {
+    if (commandLine.specifiedOption("--output-format")) {
+      std::string string = commandLine.getOptionValue("--output-format");
+
+      if (string == "files") {
+        outputFormat = OutputFormat::FILES;
+      } else if (string == "hashes") {
+        outputFormat = OutputFormat::HASHES;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized output format.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--seed")) {
+      seed = commandLine.getOptionValueAsULong("--seed", 0, MAX_SEED);
+    }
+
+    if (commandLine.specifiedOption("--num-clusters")) {
+      numClusters = commandLine.getOptionValueAsULong(
+          "--num-clusters", MIN_NUM_CLUSTERS, MAX_NUM_CLUSTERS);
+    }
+
+    if (commandLine.specifiedOption("--min-cluster-size")) {
+      minClusterSize = commandLine.getOptionValueAsULong(
+          "--min-cluster-size", MIN_CLUSTER_SIZE, MAX_CLUSTER_SIZE);
+    }
+
+    if (commandLine.specifiedOption("--max-cluster-size")) {
+      maxClusterSize = commandLine.getOptionValueAsULong(
+          "--max-cluster-size", MIN_CLUSTER_SIZE, MAX_CLUSTER_SIZE);
+    }
+
+    if (minClusterSize > maxClusterSize) {
+      throw std::runtime_error(
+          "Error: --min-cluster-size is greater than --max-cluster-size.");
+    }
+
+    if (commandLine.specifiedOption("--min-file-size")) {
+      minFileSize = commandLine.getOptionValueAsULong(
+          "--min-file-size", MIN_FILE_SIZE, MAX_FILE_SIZE);
+    }
+
+    if (commandLine.specifiedOption("--max-file-size")) {
+      maxFileSize = commandLine.getOptionValueAsULong(
+          "--max-file-size", MIN_FILE_SIZE, MAX_FILE_SIZE);
+    }
+
+    if (minFileSize > maxFileSize) {
+      throw std::runtime_error(
+          "Error: --min-file-size is greater than --max-file-size.");
+    }
+
+    if (commandLine.specifiedOption("--size-distribution")) {
+      std::string string = commandLine.getOptionValue("--size-distribution");
+
+      if (string == "uniform") {
+        sizeDistribution = SizeDistribution::UNIFORM;
+      } else if (string == "log-uniform") {
+        sizeDistribution = SizeDistribution::LOG_UNIFORM;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized size distribution.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--mutations")) {
+      mutations = parseMutations(commandLine.getOptionValue("--mutations"));
+    } else {
+      for (const auto &pair : MUTATION_NAMES) {
+        mutations.push_back(pair.second);
+      }
+    }
+
+    if (mutations.empty() && maxClusterSize > 1) {
+      throw std::runtime_error(
+          "Error: --mutations is empty but clusters can have derived files.");
+    }
+
+    if (commandLine.specifiedOption("--mutation-interval")) {
+      mutationInterval = commandLine.getOptionValueAsULong(
+          "--mutation-interval", MIN_MUTATION_INTERVAL, MAX_MUTATION_INTERVAL);
+    }
+  }
+};
+
+// Only rng() % n is used to get random numbers, because the algorithms of the
+// standard distributions are implementation-defined, so they could make the
+// output differ between standard libraries.
+using Rng = std::mt19937_64;
+
+std::uint64_t randomInRange(Rng &rng, std::uint64_t min, std::uint64_t max) {
+  return min + rng() % (max - min + 1);
+}
+
+std::uint64_t randomFileSize(Rng &rng, const Config &config) {
+  if (config.sizeDistribution == SizeDistribution::UNIFORM) {
+    return randomInRange(rng, config.minFileSize, config.maxFileSize);
+  }
+
+  std::uint64_t numOctaves = 0;
+
+  while ((std::uint64_t(config.minFileSize) << (numOctaves + 1)) <=
+         config.maxFileSize) {
+    numOctaves++;
+  }
+
+  const std::uint64_t octaveMin = std::uint64_t(config.minFileSize)
+                                  << (rng() % (numOctaves + 1));
+  const std::uint64_t octaveMax =
+      std::min<std::uint64_t>(2 * octaveMin - 1, config.maxFileSize);
+
+  return randomInRange(rng, octaveMin, octaveMax);
+}
+
+// Removes about one in every interval elements of elements.
+template <typename T>
+void removeSome(Rng &rng, std::vector<T> &elements, std::uint64_t interval) {
+  std::vector<T> kept;
+
+  for (auto &element : elements) {
+    if (rng() % interval != 0) {
+      kept.push_back(std::move(element));
+    }
+  }
+
+  elements = std::move(kept);
+}
+
+// Moves about one in every interval elements of elements to a random index.
+template <typename T>
+void moveSome(Rng &rng, std::vector<T> &elements, std::uint64_t interval) {
+  const std::size_t numMoves = elements.size() / interval;
+
+  for (std::size_t i = 0; i < numMoves && elements.size() > 1; ++i) {
+    const std::size_t from = rng() % elements.size();
+    T element = std::move(elements[from]);
+
+    elements.erase(elements.begin() + static_cast<std::ptrdiff_t>(from));
+
+    const std::size_t to = rng() % (elements.size() + 1);
+
+    elements.insert(elements.begin() + static_cast<std::ptrdiff_t>(to),
+                    std::move(element));
+  }
+}
+
+// Keeps only the first or the second half of elements.
+template <typename T>
+void removeHalf(std::vector<T> &elements, bool removingFirstHalf) {
+  const auto middle =
+      elements.begin() + static_cast<std::ptrdiff_t>(elements.size() / 2);
+
+  if (removingFirstHalf) {
+    elements.erase(elements.begin(), middle);
+  } else {
+    elements.erase(middle, elements.end());
+  }
+}
+
+// Swaps two adjacent runs of elements, where the runs are given by the indexes
+// of their first elements, so that the order of runs i and i + 1 is reversed.
+template <typename T>
+void swapAdjacentRuns(Rng &rng, std::vector<T> &elements,
+                      const std::vector<std::size_t> &runStarts) {
+  if (runStarts.size() < 2) {
+    return;
+  }
+
+  const std::size_t i = rng() % (runStarts.size() - 1);
+  const std::size_t end =
+      i + 2 < runStarts.size() ? runStarts[i + 2] : elements.size();
+
+  std::rotate(elements.begin() + static_cast<std::ptrdiff_t>(runStarts[i]),
+              elements.begin() + static_cast<std::ptrdiff_t>(runStarts[i + 1]),
+              elements.begin() + static_cast<std::ptrdiff_t>(end));
+}
+
+// Words of the lorem ipsum text in the samples directory.
+constexpr std::string_view WORDS[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "suspendisse", "ultrices", "gravida",
+    "dictum", "fusce", "fermentum", "sollicitudin", "ac", "orci", "phasellus",
+    "cursus", "senectus", "netus", "malesuada", "fames", "turpis", "egestas",
+    "morbi", "non", "arcu", "risus", "quis", "varius", "quam", "quisque", "id",
+    "duis", "at", "donec", "massa", "sapien", "in", "nisl", "nisi",
+    "scelerisque", "eu", "vitae", "purus", "faucibus", "ornare", "lacus",
+    "viverra", "imperdiet", "proin", "leo", "vel", "dapibus", "iaculis", "nunc",
+    "augue"};
+
+constexpr std::size_t MAX_LINE_LENGTH = 80;
+constexpr std::uint64_t MIN_LINES_PER_PARAGRAPH = 4;
+constexpr std::uint64_t MAX_LINES_PER_PARAGRAPH = 16;
+
+// A text file as a list of lines, where each line is a list of words and an
+// empty line separates paragraphs.
+using Text = std::vector<std::vector<std::string_view>>;
+
+Text randomText(Rng &rng, std::uint64_t size) {
+  Text text;
+  std::uint64_t textSize = 0;
+  std::uint64_t numLinesLeftInParagraph =
+      randomInRange(rng, MIN_LINES_PER_PARAGRAPH, MAX_LINES_PER_PARAGRAPH);
+
+  while (textSize < size) {
+    std::vector<std::string_view> line;
+    std::size_t lineLength = 0;
+
+    for (;;) {
+      const std::string_view word = WORDS[rng() % std::size(WORDS)];
+
+      if (!line.empty() && lineLength + 1 + word.size() > MAX_LINE_LENGTH) {
+        break;
+      }
+
+      lineLength += (line.empty() ? 0 : 1) + word.size();
+      line.push_back(word);
+    }
+
+    text.push_back(std::move(line));
+    textSize += lineLength + 1;
+    numLinesLeftInParagraph--;
+
+    if (numLinesLeftInParagraph == 0 && textSize < size) {
+      text.emplace_back();
+      textSize++;
+      numLinesLeftInParagraph =
+          randomInRange(rng, MIN_LINES_PER_PARAGRAPH, MAX_LINES_PER_PARAGRAPH);
+    }
+  }
+
+  return text;
+}
+
+void mutateText(Rng &rng, Text &text, Mutation mutation,
+                std::uint64_t interval) {
+  switch (mutation) {
+    case Mutation::REMOVED_1ST_HALF:
+      removeHalf(text, true);
+      break;
+    case Mutation::REMOVED_2ND_HALF:
+      removeHalf(text, false);
+      break;
+    case Mutation::MOVED_SOME_LINES:
+      moveSome(rng, text, interval);
+      break;
+    case Mutation::MOVED_SOME_WORDS: {
+      // Moves words within the text by moving them among all words and then
+      // putting them back into lines of the same lengths.
+      std::vector<std::string_view> words;
+      std::vector<std::size_t> lineLengths;
+
+      for (const auto &line : text) {
+        words.insert(words.end(), line.begin(), line.end());
+        lineLengths.push_back(line.size());
+      }
+
+      moveSome(rng, words, interval);
+
+      std::size_t wordIndex = 0;
+
+      for (std::size_t i = 0; i < text.size(); ++i) {
+        text[i].assign(
+            words.begin() + static_cast<std::ptrdiff_t>(wordIndex),
+            words.begin() +
+                static_cast<std::ptrdiff_t>(wordIndex + lineLengths[i]));
+        wordIndex += lineLengths[i];
+      }
+
+      break;
+    }
+    case Mutation::REMOVED_SOME_LINES:
+      removeSome(rng, text, interval);
+      break;
+    case Mutation::REMOVED_SOME_WORDS:
+      for (auto &line : text) {
+        removeSome(rng, line, interval);
+      }
+
+      break;
+    case Mutation::SWAPPED_PARAGRAPHS: {
+      std::vector<std::size_t> paragraphStarts{0};
+
+      for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i].empty()) {
+          paragraphStarts.push_back(i);
+        }
+      }
+
+      swapAdjacentRuns(rng, text, paragraphStarts);
+      break;
+    }
+  }
+}
+
+void writeText(const fs::path &filePath, const Text &text) {
+  std::ofstream ofstream(filePath, std::ofstream::out | std::ofstream::binary);
+
+  if (!ofstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" + filePath.u8string() +
+                             "\".");
+  }
+
+  tfs::BufferedWriter writer(ofstream);
+
+  for (const auto &line : text) {
+    for (std::size_t i = 0; i < line.size(); ++i) {
+      if (i > 0) {
+        writer.write(' ');
+      }
+
+      writer.write(line[i]);
+    }
+
+    writer.write('\n');
+  }
+}
+
+// A fuzzy hash with each part as a list of characters, so that the mutations
+// can treat each character like a line of a file. Each character of a part
+// stands for a block of the file.
+struct SyntheticHash {
+  std::uint64_t blockSize;
+  std::vector<char> part1;
+  std::vector<char> part2;
+};
+
+std::vector<char> randomPart(Rng &rng, std::size_t size) {
+  std::vector<char> part(size);
+
+  for (auto &character : part) {
+    character = tfs::BASE64_ALPHABET[rng() % tfs::BASE64_ALPHABET.size()];
+  }
+
+  return part;
+}
+
+// Approximates the hash fuzzyHash() would give a file of the given size:
+// part1 has between SPAMSUM_LENGTH / 2 and SPAMSUM_LENGTH characters, and part2
+// has about half as many.
+SyntheticHash randomHash(Rng &rng, std::uint64_t size) {
+  std::uint64_t blockSize = tfs::MIN_BLOCK_SIZE;
+
+  while (blockSize * tfs::SPAMSUM_LENGTH < size) {
+    blockSize *= 2;
+  }
+
+  const std::size_t part1Size = std::max<std::size_t>(
+      1, std::min<std::uint64_t>(size / blockSize,
+                                 randomInRange(rng, tfs::SPAMSUM_LENGTH / 2,
+                                               tfs::SPAMSUM_LENGTH)));
+  const std::size_t part2Size = std::max<std::size_t>(1, (part1Size + 1) / 2);
+
+  return {blockSize, randomPart(rng, part1Size), randomPart(rng, part2Size)};
+}
+
+// Number of characters of a part treated as a paragraph. A paragraph of the
+// generated text files is about this many blocks long when part1 has
+// SPAMSUM_LENGTH characters.
+constexpr std::size_t PARAGRAPH_LENGTH = 10;
+
+// Moved words change the blocks they are in, so they are approximated by
+// replacing characters.
+void replaceSome(Rng &rng, std::vector<char> &part, std::uint64_t interval) {
+  for (auto &character : part) {
+    if (rng() % interval == 0) {
+      character = tfs::BASE64_ALPHABET[rng() % tfs::BASE64_ALPHABET.size()];
+    }
+  }
+}
+
+void mutatePart(Rng &rng, std::vector<char> &part, Mutation mutation,
+                std::uint64_t interval) {
+  switch (mutation) {
+    case Mutation::REMOVED_1ST_HALF:
+      removeHalf(part, true);
+      break;
+    case Mutation::REMOVED_2ND_HALF:
+      removeHalf(part, false);
+      break;
+    case Mutation::MOVED_SOME_LINES:
+      moveSome(rng, part, interval);
+      break;
+    case Mutation::MOVED_SOME_WORDS:
+      replaceSome(rng, part, interval);
+      break;
+    case Mutation::REMOVED_SOME_LINES:
+      removeSome(rng, part, interval);
+      break;
+    case Mutation::REMOVED_SOME_WORDS:
+      replaceSome(rng, part, interval);
+      break;
+    case Mutation::SWAPPED_PARAGRAPHS: {
+      std::vector<std::size_t> paragraphStarts;
+
+      for (std::size_t i = 0; i < part.size(); i += PARAGRAPH_LENGTH) {
+        paragraphStarts.push_back(i);
+      }
+
+      swapAdjacentRuns(rng, part, paragraphStarts);
+      break;
+    }
+  }
+
+  if (part.empty()) {
+    part = randomPart(rng, 1);
+  }
+}
+
+void writeHash(tfs::BufferedWriter &writer, const SyntheticHash &hash,
+               const std::string &filePath) {
+  writer.writeUnsigned(hash.blockSize);
+  writer.write(':');
+  writer.write(std::string_view(hash.part1.data(), hash.part1.size()));
+  writer.write(':');
+  writer.write(std::string_view(hash.part2.data(), hash.part2.size()));
+  writer.write(',');
+  writer.write(filePath);
+  writer.write('\n');
+}
+
+constexpr std::uint64_t NUM_CLUSTERS_PER_GROUP = 1000;
+
+std::string clusterDirectory(std::uint64_t clusterIndex) {
+  return "group" + std::to_string(clusterIndex / NUM_CLUSTERS_PER_GROUP) +
+         "/cluster" + std::to_string(clusterIndex);
+}
+
+std::string fileName(std::uint64_t fileIndex, std::string_view kind) {
+  return std::to_string(fileIndex) + '-' + std::string(kind) + ".txt";
+}
+
+// The size of a cluster and the size of its original file.
+struct ClusterShape {
+  std::uint64_t clusterSize;
+  std::uint64_t originalSize;
+};
+
+ClusterShape randomClusterShape(Rng &rng, const Config &config) {
+  const std::uint64_t clusterSize =
+      randomInRange(rng, config.minClusterSize, config.maxClusterSize);
+
+  return {clusterSize, randomFileSize(rng, config)};
+}
+
+// Every cluster has its own random number generator seeded from seedRng, so
+// the files of a cluster do not depend on how other clusters used randomness.
+void generateHashes(const Config &config, const fs::path &outputPath) {
+  std::ofstream ofstream(outputPath,
+                         std::ofstream::out | std::ofstream::binary);
+
+  if (!ofstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" +
+                             outputPath.u8string() + "\".");
+  }
+
+  tfs::BufferedWriter writer(ofstream);
+  Rng seedRng(config.seed);
+
+  for (std::uint64_t c = 0; c < config.numClusters; ++c) {
+    if (tlo::stopRequested.load()) {
+      break;
+    }
+
+    Rng rng(seedRng());
+    const ClusterShape shape = randomClusterShape(rng, config);
+    const std::string directory = clusterDirectory(c);
+    const SyntheticHash original = randomHash(rng, shape.originalSize);
+
+    writeHash(writer, original, directory + '/' + fileName(0, "original"));
+
+    for (std::uint64_t i = 1; i < shape.clusterSize; ++i) {
+      const Mutation mutation =
+          config.mutations[rng() % config.mutations.size()];
+      SyntheticHash hash = original;
+
+      mutatePart(rng, hash.part1, mutation, config.mutationInterval);
+      mutatePart(rng, hash.part2, mutation, config.mutationInterval);
+      writeHash(writer, hash,
+                directory + '/' + fileName(i, mutationName(mutation)));
+    }
+  }
+}
+
+void generateFiles(const Config &config, const fs::path &outputPath) {
+  Rng seedRng(config.seed);
+
+  for (std::uint64_t c = 0; c < config.numClusters; ++c) {
+    if (tlo::stopRequested.load()) {
+      break;
+    }
+
+    Rng rng(seedRng());
+    const ClusterShape shape = randomClusterShape(rng, config);
+    const fs::path directoryPath =
+        outputPath / fs::u8path(clusterDirectory(c));
+    const Text original = randomText(rng, shape.originalSize);
+
+    fs::create_directories(directoryPath);
+    writeText(directoryPath / fileName(0, "original"), original);
+
+    for (std::uint64_t i = 1; i < shape.clusterSize; ++i) {
+      const Mutation mutation =
+          config.mutations[rng() % config.mutations.size()];
+      Text text = original;
+
+      mutateText(rng, text, mutation, config.mutationInterval);
+      writeText(directoryPath / fileName(i, mutationName(mutation)), text);
+    }
+  }
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
+
+    if (commandLine.arguments().size() != 1) {
+      std::cerr << "Usage: " << commandLine.program()
+                << " [options] <output directory or hashes file>\n"
+                << std::endl;
+      commandLine.printValidOptions(std::cerr);
+
+      return 1;
+    }
+
+    tlo::registerInterruptSignalHandler(tloRequestStop);
+
+    const Config config(commandLine);
+
+    const fs::path outputPath = fs::u8path(commandLine.arguments()[0]);
+
+    if (config.outputFormat == OutputFormat::HASHES) {
+      generateHashes(config, outputPath);
+    } else {
+      generateFiles(config, outputPath);
+    }
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+}
@@ -0,0 +1,821 @@
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <tlo-cpp/command-line.hpp>
+#include <tlo-cpp/filesystem.hpp>
+#include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/compare.hpp>
+#include <tlo-file-similarity/database.hpp>
+#include <tlo-file-similarity/writer.hpp>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr int DEFAULT_SIMILARITY_THRESHOLD = 50;
+constexpr int MIN_SIMILARITY_THRESHOLD = 0;
+constexpr int MAX_SIMILARITY_THRESHOLD = 99;
+
+constexpr std::size_t DEFAULT_NUM_THREADS = 1;
+constexpr std::size_t MIN_NUM_THREADS = 1;
+constexpr std::size_t MAX_NUM_THREADS = 256;
+
+constexpr tfs::ComparisonMetric DEFAULT_METRIC = tfs::ComparisonMetric::LCS;
+const std::string DEFAULT_METRIC_STRING = "lcs";
+
+// Requests larger than this are rejected, and responses larger than this are
+// replaced with an error. Also keeps sizes within the frame header.
+constexpr std::size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
+// Each frame starts with the size of its payload as a 32-bit unsigned
+// big-endian integer.
+constexpr std::size_t FRAME_HEADER_SIZE = 4;
+
+constexpr int LISTEN_BACKLOG = 64;
+
+// How often threads waiting for a socket check tlo::stopRequested.
+constexpr int POLL_TIMEOUT_MILLISECONDS = 200;
+
+const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
+    {"--socket",
+     {true,
+      "Path of the Unix domain socket to listen on. Required. A socket left "
+      "at the path by a server that is no longer running is replaced."}},
+    {"--database",
+     {true,
+      "Load the hashes stored in the database at the specified path, as "
+      "created by tlo-fuzzy-hash, instead of the hashes in text files. "
+      "Inserted hashes are not stored in the database. Cannot be used with "
+      "text files (default: none)."}},
+    {"--similarity-threshold",
+     {true,
+      "Similarity threshold of queries that do not specify one (default: " +
+          std::to_string(DEFAULT_SIMILARITY_THRESHOLD) + ")."}},
+    {"--metric",
+     {true,
+      "Metric used to score pairs of hashes. Can be lcs (longest common "
+      "subsequence distance), levenshtein (Levenshtein distance), damerau "
+      "(Damerau-Levenshtein distance, counting each transposition of adjacent "
+      "characters as one edit), or osa (optimal string alignment distance, "
+      "which is faster than damerau but does not allow editing a substring "
+      "more than once, so can give lower scores) (default: " +
+          DEFAULT_METRIC_STRING + ")."}},
+    {"--num-threads",
+     {true,
+      "Number of threads that serve requests. Each request is served by "
+      "whichever thread is free, so any number of clients can stay connected, "
+      "and queries run concurrently while no hashes are being inserted. Each "
+      "query also compares its hashes on this many threads (default: " +
+          std::to_string(DEFAULT_NUM_THREADS) + ")."}},
+    {"--verbose",
+     {false,
+      "Allow program to print status updates to stderr (default: off)."}}};
+
+struct Config {
+  std::string socket;
+  std::string database;
+  int similarityThreshold = DEFAULT_SIMILARITY_THRESHOLD;
+  tfs::ComparisonMetric metric = DEFAULT_METRIC;
+  std::size_t numThreads = DEFAULT_NUM_THREADS;
+  bool verbose = false;
+
+  Config(const tlo::CommandLine &commandLine) {
+    if (!commandLine.specifiedOption("--socket")) {
+      throw std::runtime_error("Error: --socket is required.");
+    }
+
+    socket = commandLine.getOptionValue("--socket");
+
+    if (commandLine.specifiedOption("--database")) {
+      database = commandLine.getOptionValue("--database");
+
+      if (!commandLine.arguments().empty()) {
+        throw std::runtime_error(
+            "Error: Text files with hashes cannot be given with --database.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--similarity-threshold")) {
+      similarityThreshold = commandLine.getOptionValueAsInt(
+          "--similarity-threshold", MIN_SIMILARITY_THRESHOLD,
+          MAX_SIMILARITY_THRESHOLD);
+    }
+
+    if (commandLine.specifiedOption("--metric")) {
+      std::string string = commandLine.getOptionValue("--metric");
+
+      if (string == "lcs") {
+        metric = tfs::ComparisonMetric::LCS;
+      } else if (string == "levenshtein") {
+        metric = tfs::ComparisonMetric::LEVENSHTEIN;
+      } else if (string == "damerau") {
+        metric = tfs::ComparisonMetric::DAMERAU_LEVENSHTEIN;
+      } else if (string == "osa") {
+        metric = tfs::ComparisonMetric::OSA;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized metric.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--num-threads")) {
+      numThreads = commandLine.getOptionValueAsULong(
+          "--num-threads", MIN_NUM_THREADS, MAX_NUM_THREADS);
+    }
+
+    if (commandLine.specifiedOption("--verbose")) {
+      verbose = true;
+    }
+  }
+};
+
+std::runtime_error systemError(const std::string &what) {
+  return std::runtime_error("Error: " + what + ": " + std::strerror(errno) +
+                            '.');
+}
+
+// Closes the file descriptor when destroyed.
+class FileDescriptor {
+ private:
+  int fd;
+
+ public:
+  explicit FileDescriptor(int fd_) : fd(fd_) {}
+  FileDescriptor(const FileDescriptor &) = delete;
+  FileDescriptor &operator=(const FileDescriptor &) = delete;
+
+  ~FileDescriptor() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  int get() const { return fd; }
+};
+
+// Returns true once fd has data to read or has been closed by the other end.
+// Returns false if tlo::stopRequested is set first.
+bool waitUntilReadable(int fd) {
+  pollfd pollFd{fd, POLLIN, 0};
+
+  while (!tlo::stopRequested.load()) {
+    const int numReady = ::poll(&pollFd, 1, POLL_TIMEOUT_MILLISECONDS);
+
+    if (numReady > 0) {
+      return true;
+    }
+
+    if (numReady < 0 && errno != EINTR) {
+      throw systemError("Failed to poll socket");
+    }
+  }
+
+  return false;
+}
+
+// Returns the number of bytes read, which is less than size only if the other
+// end closed the connection or tlo::stopRequested was set.
+std::size_t readFully(int fd, char *data, std::size_t size) {
+  std::size_t numBytesRead = 0;
+
+  while (numBytesRead < size && waitUntilReadable(fd)) {
+    const ssize_t result =
+        ::read(fd, data + numBytesRead, size - numBytesRead);
+
+    if (result == 0) {
+      break;
+    }
+
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throw systemError("Failed to read from socket");
+    }
+
+    numBytesRead += static_cast<std::size_t>(result);
+  }
+
+  return numBytesRead;
+}
+
+void writeFully(int fd, std::string_view data) {
+  while (!data.empty()) {
+    const ssize_t result = ::write(fd, data.data(), data.size());
+
+    if (result < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throw systemError("Failed to write to socket");
+    }
+
+    data.remove_prefix(static_cast<std::size_t>(result));
+  }
+}
+
+// Reads the payload of the next frame into payload. Returns false if the other
+// end closed the connection between frames or tlo::stopRequested was set.
+bool readFrame(int fd, std::string &payload) {
+  unsigned char header[FRAME_HEADER_SIZE];
+  const std::size_t numHeaderBytesRead =
+      readFully(fd, reinterpret_cast<char *>(header), FRAME_HEADER_SIZE);
+
+  if (numHeaderBytesRead == 0) {
+    return false;
+  }
+
+  if (numHeaderBytesRead < FRAME_HEADER_SIZE) {
+    throw std::runtime_error("Error: Connection closed within a frame.");
+  }
+
+  std::size_t size = 0;
+
+  for (const unsigned char byte : header) {
+    size = size << 8 | byte;
+  }
+
+  if (size > MAX_FRAME_SIZE) {
+    throw std::runtime_error("Error: Frame of " + std::to_string(size) +
+                             " bytes is too large.");
+  }
+
+  payload.resize(size);
+
+  if (readFully(fd, payload.data(), size) < size) {
+    throw std::runtime_error("Error: Connection closed within a frame.");
+  }
+
+  return true;
+}
+
+void writeFrame(int fd, std::string_view payload) {
+  if (payload.size() > MAX_FRAME_SIZE) {
+    throw std::runtime_error("Error: Frame of " +
+                             std::to_string(payload.size()) +
+                             " bytes is too large.");
+  }
+
+  char header[FRAME_HEADER_SIZE];
+  std::size_t size = payload.size();
+
+  for (std::size_t i = FRAME_HEADER_SIZE; i > 0; --i) {
+    header[i - 1] = static_cast<char>(size & 0xFF);
+    size >>= 8;
+  }
+
+  writeFully(fd, std::string_view(header, FRAME_HEADER_SIZE));
+  writeFully(fd, payload);
+}
+
+// Parses each non-empty line of text as a hash. Lines may end with "\r\n".
+tfs::HashComparisonMap parseHashes(std::string_view text) {
+  tfs::HashComparisonMap blockSizesToHashes;
+  std::size_t numHashes = 0;
+
+  while (!text.empty()) {
+    const std::size_t newlineIndex = text.find('\n');
+    std::string_view line = text.substr(0, newlineIndex);
+
+    text.remove_prefix(newlineIndex == std::string_view::npos
+                           ? text.size()
+                           : newlineIndex + 1);
+
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    if (line.empty()) {
+      continue;
+    }
+
+    tfs::FuzzyHashFromFile hash(tfs::parseHash(line));
+
+    hash.hashIndex = numHashes++;
+    blockSizesToHashes[hash.blockSize].push_back(std::move(hash));
+  }
+
+  return blockSizesToHashes;
+}
+
+// Writes each similar pair as a line of comma-separated values, the same way
+// tlo-find-similar-hashes does with the csv output format. Skips pairs of a
+// file with itself, which a query for a file that is in the index would find.
+// Those are skipped here rather than in shouldCompare(), which is not called
+// for every pair of identical hashes.
+class QueryEventHandler : public tfs::HashComparisonEventHandler {
+ private:
+  std::mutex writerMutex;
+  tfs::BufferedWriter writer;
+
+  void printQuoted(std::string_view string) {
+    writer.write('"');
+    writer.write(string);
+    writer.write('"');
+  }
+
+ public:
+  explicit QueryEventHandler(std::ostream &os) : writer(os) {}
+
+  void onSimilarPairFound(const tfs::FuzzyHashFromFile &hash1,
+                          const tfs::FuzzyHashFromFile &hash2,
+                          double similarityScore) override {
+    if (hash1.filePath == hash2.filePath) {
+      return;
+    }
+
+    const std::lock_guard<std::mutex> lockGuard(writerMutex);
+
+    printQuoted(hash1.filePath);
+    writer.write(',');
+    printQuoted(hash2.filePath);
+    writer.write(",\"");
+    writer.writeDouble(similarityScore);
+    writer.write("\"\n");
+  }
+
+  void onHashDone() override {}
+
+  void flush() { writer.flush(); }
+};
+
+class Server {
+ private:
+  const Config &config;
+
+  // Queries hold a shared lock while comparing. Inserts hold an exclusive
+  // lock.
+  std::shared_mutex indexMutex;
+  tfs::HashComparisonIndex index;
+
+  // Connections with a request to serve, and connections whose request has
+  // been served, which serve() polls for their next request.
+  std::mutex connectionsMutex;
+  std::condition_variable requestQueued;
+  std::deque<int> readyConnections;
+  std::vector<int> servedConnections;
+  bool stopping = false;
+
+  // Write end of the pipe that wakes serve() when a connection is served.
+  int wakeFd = -1;
+
+  std::string query(std::string_view arguments, std::string_view hashes) {
+    int similarityThreshold = config.similarityThreshold;
+
+    if (!arguments.empty()) {
+      const auto [end, errorCode] =
+          std::from_chars(arguments.data(), arguments.data() + arguments.size(),
+                          similarityThreshold);
+
+      if (errorCode != std::errc() ||
+          end != arguments.data() + arguments.size() ||
+          similarityThreshold < MIN_SIMILARITY_THRESHOLD ||
+          similarityThreshold > MAX_SIMILARITY_THRESHOLD) {
+        throw std::runtime_error("Error: \"" + std::string(arguments) +
+                                 "\" is not a valid similarity threshold.");
+      }
+    }
+
+    const tfs::HashComparisonMap blockSizesToHashes = parseHashes(hashes);
+    std::ostringstream response;
+
+    response << "ok\n";
+
+    QueryEventHandler handler(response);
+    const std::shared_lock<std::shared_mutex> indexLock(indexMutex);
+
+    index.compare(blockSizesToHashes, similarityThreshold, handler,
+                  config.numThreads, config.metric);
+    handler.flush();
+    return response.str();
+  }
+
+  // Replaces the hashes of files that are already in the index. Only the
+  // index is changed. The hashes come from the client, so storing them in the
+  // database would make tlo-fuzzy-hash trust them as the hashes of the files
+  // as they are now.
+  std::string insert(std::string_view hashes) {
+    tfs::HashComparisonMap blockSizesToHashes = parseHashes(hashes);
+    std::unordered_set<std::string> filePaths;
+
+    for (const auto &pair : blockSizesToHashes) {
+      for (const auto &hash : pair.second) {
+        filePaths.insert(hash.filePath);
+      }
+    }
+
+    const std::lock_guard<std::shared_mutex> indexLock(indexMutex);
+
+    index.erase(filePaths);
+    index.insert(std::move(blockSizesToHashes));
+    return "ok\n";
+  }
+
+  std::string handleRequest(std::string_view request) {
+    const std::size_t newlineIndex = request.find('\n');
+    const std::string_view commandLine = request.substr(0, newlineIndex);
+    const std::string_view hashes =
+        newlineIndex == std::string_view::npos
+            ? std::string_view()
+            : request.substr(newlineIndex + 1);
+    const std::size_t spaceIndex = commandLine.find(' ');
+    const std::string_view command = commandLine.substr(0, spaceIndex);
+    const std::string_view arguments =
+        spaceIndex == std::string_view::npos
+            ? std::string_view()
+            : commandLine.substr(spaceIndex + 1);
+
+    try {
+      std::string response;
+
+      if (command == "query") {
+        response = query(arguments, hashes);
+      } else if (command == "insert") {
+        response = insert(hashes);
+      } else {
+        throw std::runtime_error("Error: \"" + std::string(command) +
+                                 "\" is not a recognized command.");
+      }
+
+      if (response.size() > MAX_FRAME_SIZE) {
+        throw std::runtime_error(
+            "Error: Response of " + std::to_string(response.size()) +
+            " bytes is too large. Query fewer hashes or use a higher "
+            "similarity threshold.");
+      }
+
+      return response;
+    } catch (const std::exception &exception) {
+      return std::string("error\n") + exception.what() + '\n';
+    }
+  }
+
+  // Serves one request from fd, which has data to read. Returns false if the
+  // connection was closed by the client or failed and should be closed.
+  bool serveRequest(int fd) {
+    std::string request;
+
+    try {
+      if (!readFrame(fd, request)) {
+        return false;
+      }
+
+      writeFrame(fd, handleRequest(request));
+      return true;
+    } catch (const std::exception &exception) {
+      if (config.verbose) {
+        std::cerr << exception.what() << std::endl;
+      }
+
+      return false;
+    }
+  }
+
+  // Hands the connection back to the thread running serve() by writing to
+  // the pipe it polls. If the pipe is full, serve() is already being woken.
+  void wakeServe() {
+    const char byte = 0;
+
+    while (::write(wakeFd, &byte, 1) < 0 && errno == EINTR) {
+    }
+  }
+
+  void serveRequests() {
+    for (;;) {
+      std::unique_lock<std::mutex> connectionsLock(connectionsMutex);
+
+      requestQueued.wait(connectionsLock, [&] {
+        return stopping || !readyConnections.empty();
+      });
+
+      if (stopping) {
+        break;
+      }
+
+      const int fd = readyConnections.front();
+
+      readyConnections.pop_front();
+      connectionsLock.unlock();
+
+      if (serveRequest(fd)) {
+        {
+          const std::lock_guard<std::mutex> lockGuard(connectionsMutex);
+
+          servedConnections.push_back(fd);
+        }
+
+        wakeServe();
+      } else {
+        ::close(fd);
+      }
+    }
+  }
+
+ public:
+  explicit Server(const Config &config_) : config(config_) {}
+
+  void loadHashes(const std::vector<fs::path> &textFilePaths) {
+    if (config.database.empty()) {
+      index.insert(
+          tfs::readHashesForComparison(textFilePaths, false, config.numThreads)
+              .first);
+      return;
+    }
+
+    tfs::FuzzyHashDatabase database;
+    std::size_t numHashesRead = 0;
+
+    database.open(config.database);
+
+    for (const auto blockSize : database.getBlockSizes()) {
+      std::vector<tfs::FuzzyHash> hashes;
+      tfs::HashComparisonMap blockSizesToHashes;
+      std::vector<tfs::FuzzyHashFromFile> &hashesFromFile =
+          blockSizesToHashes[blockSize];
+
+      database.getHashesWithBlockSize(hashes, blockSize);
+      hashesFromFile.reserve(hashes.size());
+
+      for (auto &hash : hashes) {
+        hashesFromFile.emplace_back(std::move(hash));
+        hashesFromFile.back().hashIndex = numHashesRead++;
+      }
+
+      index.insert(std::move(blockSizesToHashes));
+    }
+  }
+
+  std::size_t numHashes() const { return index.size(); }
+
+  // Accepts connections and polls them for requests until
+  // tlo::stopRequested is set. Each request is served by whichever of
+  // config.numThreads threads is free, so one thread can serve requests from
+  // many connections, and a connection between requests holds no thread.
+  // Connections are closed when the server stops.
+  void serve(int listeningFd) {
+    int pipeFds[2];
+
+    if (::pipe(pipeFds) != 0) {
+      throw systemError("Failed to create pipe");
+    }
+
+    const FileDescriptor wakeReadEnd(pipeFds[0]);
+    const FileDescriptor wakeWriteEnd(pipeFds[1]);
+
+    if (::fcntl(wakeReadEnd.get(), F_SETFL, O_NONBLOCK) != 0 ||
+        ::fcntl(wakeWriteEnd.get(), F_SETFL, O_NONBLOCK) != 0) {
+      throw systemError("Failed to configure pipe");
+    }
+
+    wakeFd = wakeWriteEnd.get();
+
+    std::vector<std::thread> threads;
+    std::exception_ptr exception;
+
+    // Connections waiting for their next request.
+    std::vector<int> idleConnections;
+    std::vector<pollfd> pollFds;
+
+    for (std::size_t i = 0; i < config.numThreads; ++i) {
+      threads.emplace_back([&] { serveRequests(); });
+    }
+
+    try {
+      while (!tlo::stopRequested.load()) {
+        pollFds.clear();
+        pollFds.push_back({wakeReadEnd.get(), POLLIN, 0});
+        pollFds.push_back({listeningFd, POLLIN, 0});
+
+        for (const int fd : idleConnections) {
+          pollFds.push_back({fd, POLLIN, 0});
+        }
+
+        const int numReady =
+            ::poll(pollFds.data(), pollFds.size(), POLL_TIMEOUT_MILLISECONDS);
+
+        if (numReady < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          throw systemError("Failed to poll sockets");
+        }
+
+        if (pollFds[0].revents != 0) {
+          char bytes[256];
+
+          while (::read(wakeReadEnd.get(), bytes, sizeof(bytes)) > 0) {
+          }
+        }
+
+        std::vector<int> stillIdleConnections;
+        bool requestsQueued = false;
+
+        {
+          const std::lock_guard<std::mutex> lockGuard(connectionsMutex);
+
+          // A connection closed by the client is also readable, and is closed
+          // by the thread that finds nothing to read.
+          for (std::size_t i = 0; i < idleConnections.size(); ++i) {
+            if (pollFds[i + 2].revents != 0) {
+              readyConnections.push_back(idleConnections[i]);
+              requestsQueued = true;
+            } else {
+              stillIdleConnections.push_back(idleConnections[i]);
+            }
+          }
+
+          stillIdleConnections.insert(stillIdleConnections.end(),
+                                      servedConnections.begin(),
+                                      servedConnections.end());
+          servedConnections.clear();
+        }
+
+        if (requestsQueued) {
+          requestQueued.notify_all();
+        }
+
+        idleConnections.swap(stillIdleConnections);
+
+        if (pollFds[1].revents != 0) {
+          const int fd = ::accept(listeningFd, nullptr, nullptr);
+
+          if (fd >= 0) {
+            idleConnections.push_back(fd);
+          } else if (errno != EINTR && errno != ECONNABORTED) {
+            throw systemError("Failed to accept connection");
+          }
+        }
+      }
+    } catch (...) {
+      exception = std::current_exception();
+      tlo::stopRequested.store(true);
+    }
+
+    {
+      const std::lock_guard<std::mutex> lockGuard(connectionsMutex);
+
+      stopping = true;
+
+      for (const int fd : readyConnections) {
+        ::close(fd);
+      }
+
+      readyConnections.clear();
+    }
+
+    requestQueued.notify_all();
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    for (const int fd : idleConnections) {
+      ::close(fd);
+    }
+
+    for (const int fd : servedConnections) {
+      ::close(fd);
+    }
+
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+sockaddr_un makeSocketAddress(const fs::path &socketPath) {
+  sockaddr_un address{};
+  const std::string path = socketPath.string();
+
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Error: Socket path \"" + path +
+                             "\" is too long.");
+  }
+
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+// Removes a socket at socketPath that no server is listening on anymore.
+void removeStaleSocket(const fs::path &socketPath) {
+  if (!fs::is_socket(socketPath)) {
+    return;
+  }
+
+  const sockaddr_un address = makeSocketAddress(socketPath);
+  const FileDescriptor probe(::socket(AF_UNIX, SOCK_STREAM, 0));
+
+  if (probe.get() < 0) {
+    throw systemError("Failed to create socket");
+  }
+
+  if (::connect(probe.get(), reinterpret_cast<const sockaddr *>(&address),
+                sizeof(address)) == 0) {
+    throw std::runtime_error("Error: A server is already listening on \"" +
+                             socketPath.string() + "\".");
+  }
+
+  if (errno == ECONNREFUSED) {
+    fs::remove(socketPath);
+  }
+}
+
+int listenOnSocket(const fs::path &socketPath) {
+  removeStaleSocket(socketPath);
+
+  const sockaddr_un address = makeSocketAddress(socketPath);
+  const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0) {
+    throw systemError("Failed to create socket");
+  }
+
+  if (::bind(fd, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(fd, LISTEN_BACKLOG) != 0) {
+    const std::runtime_error error = systemError(
+        "Failed to listen on \"" + socketPath.string() + "\"");
+
+    ::close(fd);
+    throw error;
+  }
+
+  return fd;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
+
+    if (commandLine.arguments().empty() &&
+        !commandLine.specifiedOption("--database")) {
+      std::cerr << "Usage: " << commandLine.program()
+                << " [options] <text file with hashes>...\n"
+                << std::endl;
+      commandLine.printValidOptions(std::cerr);
+
+      return 1;
+    }
+
+    tlo::registerInterruptSignalHandler(tloRequestStop);
+
+    // A client that disconnects before reading its response should not stop
+    // the server.
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const Config config(commandLine);
+    const auto paths = tlo::stringsToPaths(commandLine.arguments());
+    Server server(config);
+
+    if (config.verbose) {
+      std::cerr << "Loading hashes." << std::endl;
+    }
+
+    server.loadHashes(paths);
+
+    if (config.verbose) {
+      const std::size_t numHashes = server.numHashes();
+
+      std::cerr << "Loaded " << numHashes << ' '
+                << (numHashes == 1 ? "hash" : "hashes") << '.' << std::endl;
+    }
+
+    const FileDescriptor listeningSocket(listenOnSocket(config.socket));
+
+    if (config.verbose) {
+      std::cerr << "Listening on \"" << config.socket << "\"." << std::endl;
+    }
+
+    server.serve(listeningSocket.get());
+    fs::remove(config.socket);
+
+    if (config.verbose) {
+      std::cerr << "Stopped." << std::endl;
+    }
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+}
@@ -9,6 +9,9 @@
 #include <tlo-cpp/stop.hpp>
 #include <tlo-file-similarity/database.hpp>
 #include <tlo-file-similarity/fuzzy.hpp>
+#include <tlo-file-similarity/stats.hpp>
+#include <tlo-file-similarity/trace.hpp>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace fs = std::filesystem;
@@ -17,6 +20,23 @@ namespace {
 constexpr std::size_t DEFAULT_NUM_THREADS = 1;
 constexpr std::size_t MIN_NUM_THREADS = 1;
 constexpr std::size_t MAX_NUM_THREADS = 256;
+constexpr std::size_t MIN_DATABASE_BATCH_SIZE = 1;
+constexpr std::size_t MAX_DATABASE_BATCH_SIZE = 1000000;
+
+enum class KnownHashLookup { AUTO, PRELOAD, LOOKUP };
+
+constexpr KnownHashLookup DEFAULT_KNOWN_HASH_LOOKUP = KnownHashLookup::AUTO;
+
+// With auto, known hashes are looked up one file at a time if there are more
+// files to hash than this, so memory use does not grow with the number of
+// files.
+constexpr std::size_t MAX_PRELOADED_HASHES = 1000000;
+
+// With auto, known hashes are also looked up one file at a time if the
+// database has at least this many times as many hashes as there are files to
+// hash. A few point lookups are then cheaper than reading every row under the
+// given directories, including rows of files that no longer exist.
+constexpr std::size_t LOOKUP_DATABASE_RATIO = 64;
 
 const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
     {"--num-threads",
@@ -28,12 +48,58 @@ const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
     {"--database",
      {true,
       "Store hashes in and get hashes from the database at the specified path "
-      "(default: no database used)."}}};
+      "(default: no database used)."}},
+    {"--known-hash-lookup",
+     {true,
+      "How hashes stored in the database are found. Can be preload (read all "
+      "the stored hashes under the given paths before hashing), lookup (look "
+      "up the hash of each file when it is reached, using one database "
+      "connection per thread), or auto (lookup if there are more than " +
+          std::to_string(MAX_PRELOADED_HASHES) +
+          " files or the database has at least " +
+          std::to_string(LOOKUP_DATABASE_RATIO) +
+          " times as many hashes as there are files, preload otherwise) "
+          "(default: auto)."}},
+    {"--database-batch-size",
+     {true, "Number of hashes written to the database per transaction. Larger "
+            "batches are faster, but more work is lost if the program is "
+            "killed (default: " +
+                std::to_string(tfs::DEFAULT_DATABASE_BATCH_SIZE) + ")."}},
+    {"--sync",
+     {false,
+      "After hashing, delete the hashes stored in the database for files "
+      "under the given directories that no longer exist. Requires --database "
+      "(default: off)."}},
+    {"--vacuum",
+     {false,
+      "After --sync, give the space freed by deleted hashes back to the file "
+      "system. The first vacuum of a database created by an older version of "
+      "the program rebuilds it (default: off)."}},
+    {"--stats",
+     {true,
+      "Write counters of the work done (bytes read, files hashed, rehashes, "
+      "and database hits and misses), the wall and CPU time of each phase, "
+      "and the peak resident set size to the specified file as JSON "
+      "(default: no stats written)."}},
+    {"--trace",
+     {true,
+      "Record what each thread does over time and write it to the specified "
+      "file in the Chrome trace event format, which can be loaded in "
+      "Perfetto. Records hashing of each file (with each block size tried) "
+      "and database operations. Each thread keeps only its last " +
+          std::to_string(tfs::TRACE_BUFFER_CAPACITY) +
+          " spans (default: no trace written)."}}};
 
 struct Config {
   std::size_t numThreads = DEFAULT_NUM_THREADS;
   bool verbose = false;
   std::string database;
+  std::size_t databaseBatchSize = tfs::DEFAULT_DATABASE_BATCH_SIZE;
+  KnownHashLookup knownHashLookup = DEFAULT_KNOWN_HASH_LOOKUP;
+  bool sync = false;
+  bool vacuum = false;
+  std::string stats;
+  std::string trace;
 
   Config(const tlo::CommandLine &commandLine) {
     if (commandLine.specifiedOption("--num-threads")) {
@@ -48,51 +114,92 @@ struct Config {
     if (commandLine.specifiedOption("--database")) {
       database = commandLine.getOptionValue("--database");
     }
+
+    if (commandLine.specifiedOption("--database-batch-size")) {
+      databaseBatchSize = commandLine.getOptionValueAsULong(
+          "--database-batch-size", MIN_DATABASE_BATCH_SIZE,
+          MAX_DATABASE_BATCH_SIZE);
+    }
+
+    if (commandLine.specifiedOption("--known-hash-lookup")) {
+      std::string string = commandLine.getOptionValue("--known-hash-lookup");
+
+      if (string == "auto") {
+        knownHashLookup = KnownHashLookup::AUTO;
+      } else if (string == "preload") {
+        knownHashLookup = KnownHashLookup::PRELOAD;
+      } else if (string == "lookup") {
+        knownHashLookup = KnownHashLookup::LOOKUP;
+      } else {
+        throw std::runtime_error("Error: \"" + string +
+                                 "\" is not a recognized known hash lookup.");
+      }
+    }
+
+    if (commandLine.specifiedOption("--sync")) {
+      if (database.empty()) {
+        throw std::runtime_error("Error: --sync requires --database.");
+      }
+
+      sync = true;
+    }
+
+    if (commandLine.specifiedOption("--vacuum")) {
+      if (!sync) {
+        throw std::runtime_error("Error: --vacuum requires --sync.");
+      }
+
+      vacuum = true;
+    }
+
+    if (commandLine.specifiedOption("--stats")) {
+      stats = commandLine.getOptionValue("--stats");
+    }
+
+    if (commandLine.specifiedOption("--trace")) {
+      trace = commandLine.getOptionValue("--trace");
+    }
   }
 };
 
 constexpr int MAX_SECOND_DIFFERENCE = 1;
 
+// Only called on the database's writer thread.
 class DatabaseEventHandler : public tfs::FuzzyHashDatabase::EventHandler {
- private:
-  const std::size_t numHashesToInsert;
-  const std::size_t numHashesToUpdate;
-
-  std::size_t numHashesInserted = 0;
-  std::size_t numHashesUpdated = 0;
-
  public:
-  DatabaseEventHandler(std::size_t numHashesToInsert_,
-                       std::size_t numHashesToUpdate_)
-      : numHashesToInsert(numHashesToInsert_),
-        numHashesToUpdate(numHashesToUpdate_) {}
+  std::size_t numHashesStored = 0;
 
-  void onRowInsert() override {
-    numHashesInserted++;
+  void onRowUpsert() override { numHashesStored++; }
+};
 
-    std::cerr << "Inserted " << numHashesInserted << ' '
-              << (numHashesInserted == 1 ? "hash" : "hashes") << " out of "
-              << numHashesToInsert << '.' << std::endl;
+bool shouldLookUpKnownHashes(const Config &config, std::size_t numFilesToHash,
+                             tfs::FuzzyHashDatabase &hashDatabase) {
+  if (config.knownHashLookup == KnownHashLookup::AUTO) {
+    return numFilesToHash > MAX_PRELOADED_HASHES ||
+           hashDatabase.getNumHashes() >=
+               LOOKUP_DATABASE_RATIO * numFilesToHash;
   }
 
-  void onRowUpdate() override {
-    numHashesUpdated++;
-
-    std::cerr << "Updated " << numHashesUpdated << ' '
-              << (numHashesUpdated == 1 ? "hash" : "hashes") << " out of "
-              << numHashesToUpdate << '.' << std::endl;
-  }
-};
+  return config.knownHashLookup == KnownHashLookup::LOOKUP;
+}
 
 class AbstractHashEventHandler : public tfs::FuzzyHashEventHandler {
  protected:
   const bool verbose;
   const std::size_t numFilesToHash;
+  const std::string databasePath;
 
+  DatabaseEventHandler databaseEventHandler;
   tfs::FuzzyHashDatabase hashDatabase;
   tfs::FuzzyHashRowSet knownHashes;
-  tfs::FuzzyHashRowSet newHashes;
-  tfs::FuzzyHashRowSet modifiedHashes;
+
+  // If true, known hashes are looked up in lookupDatabases instead of
+  // knownHashes. Each thread uses its own connection, since the connection of
+  // hashDatabase is used by its writer thread.
+  bool lookingUpKnownHashes = false;
+  std::mutex lookupDatabasesMutex;
+  std::unordered_map<std::thread::id, std::unique_ptr<tfs::FuzzyHashDatabase>>
+      lookupDatabases;
 
   std::size_t numFilesHashed = 0;
   bool previousOutputEndsWithNewline = true;
@@ -104,23 +211,64 @@ class AbstractHashEventHandler : public tfs::FuzzyHashEventHandler {
               << numFilesToHash << '.' << std::endl;
   }
 
+  tfs::FuzzyHashDatabase &getLookupDatabase() {
+    const std::lock_guard<std::mutex> lookupDatabasesLockGuard(
+        lookupDatabasesMutex);
+    auto &lookupDatabase = lookupDatabases[std::this_thread::get_id()];
+
+    if (!lookupDatabase) {
+      lookupDatabase = std::make_unique<tfs::FuzzyHashDatabase>();
+      lookupDatabase->open(databasePath);
+    }
+
+    return *lookupDatabase;
+  }
+
+  bool findKnownHash(tfs::FuzzyHashRow &result, const fs::path &filePath) {
+    if (lookingUpKnownHashes) {
+      return getLookupDatabase().getHashForFile(result, filePath);
+    }
+
+    auto iterator = knownHashes.find(tfs::FuzzyHashRow(filePath.u8string()));
+
+    if (iterator == knownHashes.end()) {
+      return false;
+    }
+
+    result = *iterator;
+    return true;
+  }
+
  public:
   AbstractHashEventHandler(const Config &config,
                            const std::vector<fs::path> &paths,
                            std::size_t numFilesToHash_)
-      : verbose(config.verbose), numFilesToHash(numFilesToHash_) {
+      : verbose(config.verbose),
+        numFilesToHash(numFilesToHash_),
+        databasePath(config.database) {
     if (!config.database.empty()) {
       if (verbose) {
         std::cerr << "Opening database." << std::endl;
       }
 
       hashDatabase.open(config.database);
+      hashDatabase.setBatchSize(config.databaseBatchSize);
 
-      if (verbose) {
-        std::cerr << "Getting known hashes from database." << std::endl;
+      lookingUpKnownHashes =
+          shouldLookUpKnownHashes(config, numFilesToHash, hashDatabase);
+
+      if (!lookingUpKnownHashes) {
+        if (verbose) {
+          std::cerr << "Getting known hashes from database." << std::endl;
+        }
+
+        hashDatabase.getHashesForPaths(knownHashes, paths, config.numThreads);
       }
 
-      hashDatabase.getHashesForPaths(knownHashes, paths);
+      // New and modified hashes are stored while files are still being
+      // hashed.
+      hashDatabase.setEventHandler(databaseEventHandler);
+      hashDatabase.startWriting();
     }
   }
 
@@ -141,19 +289,33 @@ class AbstractHashEventHandler : public tfs::FuzzyHashEventHandler {
 
   bool shouldHashFile(const fs::path &filePath, std::uintmax_t fileSize,
                       const std::string &fileLastWriteTime) override {
-    auto iterator = knownHashes.find(tfs::FuzzyHashRow(filePath.u8string()));
+    tfs::FuzzyHashRow knownHash;
+    tfs::StatCounters &counters = tfs::threadStatCounters();
 
-    if (iterator != knownHashes.end() && iterator->fileSize == fileSize &&
-        tlo::equalLocalTimestamps(iterator->fileLastWriteTime,
+    if (findKnownHash(knownHash, filePath) && knownHash.fileSize == fileSize &&
+        tlo::equalLocalTimestamps(knownHash.fileLastWriteTime,
                                   fileLastWriteTime, MAX_SECOND_DIFFERENCE)) {
+      counters.databaseHits++;
       onBlockHash();
-      onFileHash(*iterator);
+      onFileHash(knownHash);
       return false;
     }
 
+    if (hashDatabase.isOpen()) {
+      counters.databaseMisses++;
+    }
+
     return true;
   }
 
+  void collect(tfs::FuzzyHash &&hash, std::uintmax_t fileSize,
+               std::string &&fileLastWriteTime) override {
+    if (hashDatabase.isOpen()) {
+      hashDatabase.queueHash(tfs::FuzzyHashRow(std::move(hash), fileSize,
+                                               std::move(fileLastWriteTime)));
+    }
+  }
+
   void finishOutput() const {
     if (!previousOutputEndsWithNewline) {
       std::cerr << std::endl;
@@ -162,24 +324,59 @@ class AbstractHashEventHandler : public tfs::FuzzyHashEventHandler {
 
   void updateDatabase() {
     if (hashDatabase.isOpen()) {
-      DatabaseEventHandler databaseEventHandler(newHashes.size(),
-                                                modifiedHashes.size());
-
       if (verbose) {
-        hashDatabase.setEventHandler(databaseEventHandler);
+        std::cerr << "Finishing storing hashes in database." << std::endl;
       }
 
+      hashDatabase.finishWriting();
+
       if (verbose) {
-        std::cerr << "Adding new hashes to database." << std::endl;
+        const std::size_t numHashesStored =
+            databaseEventHandler.numHashesStored;
+
+        std::cerr << "Stored " << numHashesStored << " new or modified "
+                  << (numHashesStored == 1 ? "hash" : "hashes") << '.'
+                  << std::endl;
+      }
+    }
+  }
+
+  // Deletes the hashes of files under the directories among paths that are
+  // not in filePaths. Does nothing if hashing was interrupted.
+  void syncDatabase(const Config &config, const std::vector<fs::path> &paths,
+                    const std::vector<fs::path> &filePaths) {
+    if (tlo::stopRequested.load()) {
+      return;
+    }
+
+    std::vector<fs::path> directoryPaths;
+
+    for (const auto &path : paths) {
+      if (fs::is_directory(path)) {
+        directoryPaths.push_back(path);
       }
+    }
 
-      hashDatabase.insertHashes(newHashes);
+    if (verbose) {
+      std::cerr << "Deleting hashes of missing files from database."
+                << std::endl;
+    }
+
+    const std::size_t numHashesDeleted =
+        hashDatabase.deleteHashesForMissingFiles(directoryPaths, filePaths);
 
+    if (verbose) {
+      std::cerr << "Deleted " << numHashesDeleted << ' '
+                << (numHashesDeleted == 1 ? "hash" : "hashes") << '.'
+                << std::endl;
+    }
+
+    if (config.vacuum && !tlo::stopRequested.load()) {
       if (verbose) {
-        std::cerr << "Updating existing hashes in database." << std::endl;
+        std::cerr << "Vacuuming database." << std::endl;
       }
 
-      hashDatabase.updateHashes(modifiedHashes);
+      hashDatabase.vacuum();
     }
   }
 };
@@ -194,18 +391,6 @@ class HashEventHandler : public AbstractHashEventHandler {
       previousOutputEndsWithNewline = false;
     }
   }
-
-  void collect(tfs::FuzzyHash &&hash, std::uintmax_t fileSize,
-               std::string &&fileLastWriteTime) override {
-    tfs::FuzzyHashRow row(std::move(hash), fileSize,
-                          std::move(fileLastWriteTime));
-
-    if (knownHashes.find(row) == knownHashes.end()) {
-      newHashes.insert(std::move(row));
-    } else {
-      modifiedHashes.insert(std::move(row));
-    }
-  }
 };
 
 class SynchronizingHashEventHandler : public AbstractHashEventHandler {
@@ -213,8 +398,6 @@ class SynchronizingHashEventHandler : public AbstractHashEventHandler {
   std::mutex outputMutex;
   std::thread::id previousOutputtingThread;
 
-  std::mutex newHashesMutex;
-
  public:
   using AbstractHashEventHandler::AbstractHashEventHandler;
 
@@ -244,20 +427,6 @@ class SynchronizingHashEventHandler : public AbstractHashEventHandler {
     AbstractHashEventHandler::onFileHash(hash);
     previousOutputtingThread = std::this_thread::get_id();
   }
-
-  void collect(tfs::FuzzyHash &&hash, std::uintmax_t fileSize,
-               std::string &&fileLastWriteTime) override {
-    tfs::FuzzyHashRow row(std::move(hash), fileSize,
-                          std::move(fileLastWriteTime));
-
-    const std::lock_guard<std::mutex> newHashesLockGuard(newHashesMutex);
-
-    if (knownHashes.find(row) == knownHashes.end()) {
-      newHashes.insert(std::move(row));
-    } else {
-      modifiedHashes.insert(std::move(row));
-    }
-  }
 };
 
 std::unique_ptr<AbstractHashEventHandler> makeHashEventHandler(
@@ -288,9 +457,20 @@ int main(int argc, char **argv) {
     tlo::registerInterruptSignalHandler(tloRequestStop);
 
     const Config config(commandLine);
+    tfs::PhaseTimer phaseTimer;
+
+    if (!config.trace.empty()) {
+      tfs::startTracing();
+    }
+
+    phaseTimer.startPhase("buildFileList");
+
     const auto paths =
         tlo::stringsToPaths(commandLine.arguments(), tlo::PathType::CANONICAL);
     const std::vector<fs::path> filePaths = tlo::buildFileList(paths);
+
+    phaseTimer.startPhase("getKnownHashes");
+
     std::unique_ptr<AbstractHashEventHandler> hashEventHandler =
         makeHashEventHandler(config, paths, filePaths.size());
 
@@ -298,9 +478,24 @@ int main(int argc, char **argv) {
       std::cerr << "Hashing files." << std::endl;
     }
 
+    phaseTimer.startPhase("hash");
     tfs::fuzzyHash(filePaths, *hashEventHandler, config.numThreads);
     hashEventHandler->finishOutput();
+    phaseTimer.startPhase("updateDatabase");
     hashEventHandler->updateDatabase();
+
+    if (config.sync) {
+      phaseTimer.startPhase("sync");
+      hashEventHandler->syncDatabase(config, paths, filePaths);
+    }
+
+    if (!config.stats.empty()) {
+      tfs::writeStats(config.stats, phaseTimer);
+    }
+
+    if (!config.trace.empty()) {
+      tfs::writeTrace(config.trace);
+    }
   } catch (const std::exception &exception) {
     std::cerr << exception.what() << std::endl;
 
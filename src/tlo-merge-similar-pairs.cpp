@@ -0,0 +1,216 @@
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <tlo-cpp/command-line.hpp>
+#include <tlo-cpp/filesystem.hpp>
+#include <tlo-cpp/stop.hpp>
+#include <tlo-file-similarity/cluster.hpp>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+namespace {
+const std::map<std::string, tlo::OptionAttributes> VALID_OPTIONS{
+    {"--clusters",
+     {false,
+      "Merge outputs of tlo-find-similar-hashes run with "
+      "--output-format=clusters. Clusters from different shards that share a "
+      "file are merged into one cluster. Otherwise, the lines of the outputs "
+      "are copied unchanged, which merges the regular, csv, tsv, and jsonl "
+      "formats. The binary format cannot be merged by this program. Since "
+      "every shard numbers the hashes the same way, binary outputs can be "
+      "merged by concatenating them and keeping the path table of any one "
+      "shard (default: off)."}},
+    {"--verbose",
+     {false,
+      "Allow program to print status updates to stderr (default: off)."}}};
+
+struct Config {
+  bool verbose = false;
+  bool clusters = false;
+
+  Config(const tlo::CommandLine &commandLine) {
+    if (commandLine.specifiedOption("--verbose")) {
+      verbose = true;
+    }
+
+    if (commandLine.specifiedOption("--clusters")) {
+      clusters = true;
+    }
+  }
+};
+
+// Each shard of tlo-find-similar-hashes outputs a disjoint set of similar
+// pairs, so the outputs are combined by writing out every pair from every
+// output in the order the outputs were given.
+std::size_t mergeSimilarPairs(const fs::path &textFilePath) {
+  std::ifstream ifstream(textFilePath, std::ifstream::in);
+
+  if (!ifstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" +
+                             textFilePath.u8string() + "\".");
+  }
+
+  std::size_t numSimilarPairs = 0;
+  std::string line;
+
+  while (std::getline(ifstream, line)) {
+    if (tlo::stopRequested.load()) {
+      break;
+    }
+
+    std::cout << line << '\n';
+    numSimilarPairs++;
+  }
+
+  return numSimilarPairs;
+}
+
+class ClusterMerger {
+ private:
+  std::vector<std::string> paths;
+  std::unordered_map<std::string, std::size_t> pathsToIndexes;
+  std::vector<std::pair<std::size_t, std::size_t>> links;
+
+  std::size_t getIndex(std::string &&path) {
+    auto iterator = pathsToIndexes.find(path);
+
+    if (iterator != pathsToIndexes.end()) {
+      return iterator->second;
+    }
+
+    std::size_t index = paths.size();
+
+    paths.push_back(path);
+    pathsToIndexes.emplace(std::move(path), index);
+    return index;
+  }
+
+ public:
+  // Returns the number of clusters read.
+  std::size_t readClusters(const fs::path &textFilePath) {
+    std::ifstream ifstream(textFilePath, std::ifstream::in);
+
+    if (!ifstream.is_open()) {
+      throw std::runtime_error("Error: Failed to open \"" +
+                               textFilePath.u8string() + "\".");
+    }
+
+    std::size_t numClusters = 0;
+    std::string line;
+
+    while (std::getline(ifstream, line)) {
+      if (tlo::stopRequested.load()) {
+        break;
+      }
+
+      tfs::Cluster cluster = tfs::parseCluster(line);
+      std::size_t representative = getIndex(std::move(cluster.front()));
+
+      for (std::size_t i = 1; i < cluster.size(); ++i) {
+        links.emplace_back(representative, getIndex(std::move(cluster[i])));
+      }
+
+      numClusters++;
+    }
+
+    return numClusters;
+  }
+
+  // Returns the number of merged clusters.
+  std::size_t printClusters() {
+    tfs::ConcurrentDisjointSets sets(paths.size());
+
+    for (const auto &link : links) {
+      sets.unite(link.first, link.second);
+    }
+
+    std::vector<const std::string *> pathPointers;
+
+    for (const auto &path : paths) {
+      pathPointers.push_back(&path);
+    }
+
+    std::vector<tfs::Cluster> clusters =
+        tfs::collectClusters(sets, pathPointers);
+
+    for (const auto &cluster : clusters) {
+      tfs::printCluster(std::cout, cluster);
+      std::cout << '\n';
+    }
+
+    return clusters.size();
+  }
+};
+}  // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const tlo::CommandLine commandLine(argc, argv, VALID_OPTIONS);
+
+    if (commandLine.arguments().empty()) {
+      std::cerr << "Usage: " << commandLine.program()
+                << " [options] <text file with similar pairs>...\n"
+                << std::endl;
+      commandLine.printValidOptions(std::cerr);
+
+      return 1;
+    }
+
+    tlo::registerInterruptSignalHandler(tloRequestStop);
+
+    const Config config(commandLine);
+    const auto paths = tlo::stringsToPaths(commandLine.arguments());
+    const auto [allFiles, iterator] = tlo::allFiles(paths);
+    if (!allFiles) {
+      throw std::runtime_error("Error: \"" + iterator->string() +
+                               "\" is not a file.");
+    }
+
+    if (config.clusters) {
+      ClusterMerger merger;
+      std::size_t numClustersRead = 0;
+
+      for (const auto &path : paths) {
+        if (config.verbose) {
+          std::cerr << "Reading \"" << path.u8string() << "\"." << std::endl;
+        }
+
+        numClustersRead += merger.readClusters(path);
+      }
+
+      std::size_t numClusters = merger.printClusters();
+
+      std::cout.flush();
+
+      if (config.verbose) {
+        std::cerr << "Merged " << numClustersRead << ' '
+                  << (numClustersRead == 1 ? "cluster" : "clusters")
+                  << " into " << numClusters << '.' << std::endl;
+      }
+    } else {
+      std::size_t numSimilarPairs = 0;
+
+      for (const auto &path : paths) {
+        if (config.verbose) {
+          std::cerr << "Merging \"" << path.u8string() << "\"." << std::endl;
+        }
+
+        numSimilarPairs += mergeSimilarPairs(path);
+      }
+
+      std::cout.flush();
+
+      if (config.verbose) {
+        std::cerr << "Merged " << numSimilarPairs << " similar "
+                  << (numSimilarPairs == 1 ? "pair" : "pairs") << '.'
+                  << std::endl;
+      }
+    }
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+}
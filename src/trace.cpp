@@ -0,0 +1,201 @@
+#include "tlo-file-similarity/trace.hpp"
+#include "tlo-file-similarity/writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace tfs {
+std::atomic<bool> tracing{false};
+
+namespace {
+std::chrono::steady_clock::time_point traceStartTime;
+
+// Nanoseconds since startTracing() was called.
+std::int64_t traceTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - traceStartTime)
+      .count();
+}
+
+struct TraceEvent {
+  const char *name;
+  const char *category;
+  std::string detail;
+  std::int64_t startTime;
+  std::int64_t duration;
+};
+
+// The spans recorded by one thread. Once events is full, it is used as a ring
+// buffer where nextIndex is the index of the oldest span.
+struct TraceBuffer {
+  std::size_t threadIndex = 0;
+  std::vector<TraceEvent> events;
+  std::size_t nextIndex = 0;
+
+  void add(TraceEvent &&event) {
+    if (events.size() < TRACE_BUFFER_CAPACITY) {
+      events.push_back(std::move(event));
+    } else {
+      events[nextIndex] = std::move(event);
+      nextIndex = (nextIndex + 1) % TRACE_BUFFER_CAPACITY;
+    }
+  }
+};
+
+// Buffers of running threads, and the buffers of threads that have exited.
+struct TraceRegistry {
+  std::mutex mutex;
+  std::size_t numThreads = 0;
+  std::vector<const TraceBuffer *> runningThreadBuffers;
+  std::vector<TraceBuffer> exitedThreadBuffers;
+};
+
+TraceRegistry &traceRegistry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+// Adds its buffer to the registry while the thread runs and moves it to the
+// buffers of exited threads when the thread exits.
+class RegisteredTraceBuffer {
+ public:
+  TraceBuffer buffer;
+
+  RegisteredTraceBuffer() {
+    TraceRegistry &registry = traceRegistry();
+    const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+
+    buffer.threadIndex = registry.numThreads++;
+    registry.runningThreadBuffers.push_back(&buffer);
+  }
+
+  RegisteredTraceBuffer(const RegisteredTraceBuffer &) = delete;
+  RegisteredTraceBuffer &operator=(const RegisteredTraceBuffer &) = delete;
+
+  ~RegisteredTraceBuffer() {
+    TraceRegistry &registry = traceRegistry();
+    const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+    auto &running = registry.runningThreadBuffers;
+
+    running.erase(std::find(running.begin(), running.end(), &buffer));
+    registry.exitedThreadBuffers.push_back(std::move(buffer));
+  }
+};
+
+TraceBuffer &threadTraceBuffer() {
+  thread_local RegisteredTraceBuffer registeredBuffer;
+
+  return registeredBuffer.buffer;
+}
+}  // namespace
+
+void startTracing() {
+  traceStartTime = std::chrono::steady_clock::now();
+  tracing.store(true, std::memory_order_release);
+}
+
+TraceSpan::TraceSpan(const char *name_, const char *category_)
+    : name(name_), category(category_) {
+  if (tracing.load(std::memory_order_acquire)) {
+    startTime = traceTime();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (startTime >= 0) {
+    const std::int64_t endTime = traceTime();
+
+    threadTraceBuffer().add(
+        {name, category, std::move(detail), startTime, endTime - startTime});
+  }
+}
+
+namespace {
+// Trace event timestamps are in microseconds.
+void writeMicroseconds(BufferedWriter &writer, std::int64_t nanoseconds) {
+  const auto value = static_cast<std::uint64_t>(nanoseconds);
+  const auto fraction = value % 1000;
+
+  writer.writeUnsigned(value / 1000);
+  writer.write('.');
+  writer.write(static_cast<char>('0' + fraction / 100));
+  writer.write(static_cast<char>('0' + fraction / 10 % 10));
+  writer.write(static_cast<char>('0' + fraction % 10));
+}
+
+void writeTraceBuffer(BufferedWriter &writer, const TraceBuffer &buffer,
+                      bool &firstEvent) {
+  auto writeSeparator = [&] {
+    writer.write(firstEvent ? "\n" : ",\n");
+    firstEvent = false;
+  };
+
+  writeSeparator();
+  writer.write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+  writer.writeUnsigned(buffer.threadIndex);
+  writer.write(",\"args\":{\"name\":\"thread ");
+  writer.writeUnsigned(buffer.threadIndex);
+  writer.write("\"}}");
+
+  for (std::size_t i = 0; i < buffer.events.size(); ++i) {
+    const TraceEvent &event =
+        buffer.events[(buffer.nextIndex + i) % buffer.events.size()];
+
+    writeSeparator();
+    writer.write("{\"name\":");
+    writer.writeJsonString(event.name);
+    writer.write(",\"cat\":");
+    writer.writeJsonString(event.category);
+    writer.write(",\"ph\":\"X\",\"ts\":");
+    writeMicroseconds(writer, event.startTime);
+    writer.write(",\"dur\":");
+    writeMicroseconds(writer, event.duration);
+    writer.write(",\"pid\":1,\"tid\":");
+    writer.writeUnsigned(buffer.threadIndex);
+
+    if (!event.detail.empty()) {
+      writer.write(",\"args\":{\"detail\":");
+      writer.writeJsonString(event.detail);
+      writer.write('}');
+    }
+
+    writer.write('}');
+  }
+}
+}  // namespace
+
+void writeTrace(std::ostream &os) {
+  TraceRegistry &registry = traceRegistry();
+  const std::lock_guard<std::mutex> lockGuard(registry.mutex);
+  BufferedWriter writer(os);
+  bool firstEvent = true;
+
+  writer.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  for (const auto &buffer : registry.exitedThreadBuffers) {
+    writeTraceBuffer(writer, buffer, firstEvent);
+  }
+
+  for (const TraceBuffer *buffer : registry.runningThreadBuffers) {
+    writeTraceBuffer(writer, *buffer, firstEvent);
+  }
+
+  writer.write("\n]}\n");
+}
+
+void writeTrace(const std::filesystem::path &filePath) {
+  std::ofstream ofstream(filePath, std::ofstream::out | std::ofstream::binary);
+
+  if (!ofstream.is_open()) {
+    throw std::runtime_error("Error: Failed to open \"" + filePath.u8string() +
+                             "\".");
+  }
+
+  writeTrace(ofstream);
+}
+}  // namespace tfs
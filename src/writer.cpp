@@ -0,0 +1,103 @@
+#include "tlo-file-similarity/writer.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <system_error>
+
+namespace tfs {
+namespace {
+// Default precision of a stream.
+constexpr int DEFAULT_PRECISION = 6;
+
+// Enough for any 64-bit unsigned integer and any double in general format.
+constexpr std::size_t NUMBER_BUFFER_SIZE = 32;
+
+static_assert(std::numeric_limits<double>::is_iec559,
+              "doubles must be IEEE 754 binary64 values");
+}  // namespace
+
+BufferedWriter::BufferedWriter(std::ostream &os_, std::size_t capacity_)
+    : os(os_), capacity(capacity_) {
+  buffer.reserve(capacity + NUMBER_BUFFER_SIZE);
+}
+
+BufferedWriter::~BufferedWriter() { flush(); }
+
+void BufferedWriter::flushIfFull() {
+  if (buffer.size() >= capacity) {
+    os.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+  }
+}
+
+void BufferedWriter::write(char character) {
+  buffer.push_back(character);
+  flushIfFull();
+}
+
+void BufferedWriter::write(std::string_view string) {
+  buffer.append(string);
+  flushIfFull();
+}
+
+void BufferedWriter::writeUnsigned(std::uint64_t value) {
+  char number[NUMBER_BUFFER_SIZE];
+  auto result = std::to_chars(number, number + sizeof(number), value);
+
+  buffer.append(number, result.ptr);
+  flushIfFull();
+}
+
+void BufferedWriter::writeDouble(double value) {
+  char number[NUMBER_BUFFER_SIZE];
+  auto result = std::to_chars(number, number + sizeof(number), value,
+                              std::chars_format::general, DEFAULT_PRECISION);
+
+  buffer.append(number, result.ptr);
+  flushIfFull();
+}
+
+void BufferedWriter::writeJsonString(std::string_view string) {
+  constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+  buffer.push_back('"');
+
+  for (const char character : string) {
+    if (character == '"' || character == '\\') {
+      buffer.push_back('\\');
+      buffer.push_back(character);
+    } else if (static_cast<unsigned char>(character) < 0x20) {
+      buffer.append("\\u00");
+      buffer.push_back(HEX_DIGITS[(character >> 4) & 0xF]);
+      buffer.push_back(HEX_DIGITS[character & 0xF]);
+    } else {
+      buffer.push_back(character);
+    }
+  }
+
+  buffer.push_back('"');
+  flushIfFull();
+}
+
+void BufferedWriter::writeLittleEndian(std::uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    buffer.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+
+  flushIfFull();
+}
+
+void BufferedWriter::writeLittleEndian(double value) {
+  std::uint64_t bits;
+
+  std::memcpy(&bits, &value, sizeof(bits));
+  writeLittleEndian(bits);
+}
+
+void BufferedWriter::flush() {
+  os.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  os.flush();
+  buffer.clear();
+}
+}  // namespace tfs
@@ -0,0 +1,91 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <tlo-file-similarity/database.hpp>
+
+#include "test.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+using tfs_test::check;
+using tfs_test::selectInt64;
+
+tfs::FuzzyHashRow makeHash(const std::string &filePath) {
+  tfs::FuzzyHashRow hash;
+
+  hash.blockSize = 3;
+  hash.part1 = "abcdefgh";
+  hash.part2 = "abcd";
+  hash.filePath = filePath;
+  hash.fileSize = 100;
+  hash.fileLastWriteTime = "2020-01-01 00:00:00";
+  return hash;
+}
+
+void testNewDatabaseUsesIncrementalAutoVacuum(const fs::path &directory) {
+  const fs::path dbFilePath = directory / "new.db";
+
+  {
+    tfs::FuzzyHashDatabase database;
+
+    database.open(dbFilePath);
+  }
+
+  check(selectInt64(dbFilePath, "PRAGMA auto_vacuum;") == 2,
+        "new database uses incremental auto_vacuum");
+}
+
+void testDeleteHashesForMissingFiles(const fs::path &directory) {
+  const fs::path dbFilePath = directory / "sync.db";
+  const fs::path filesPath = directory / "files";
+  const fs::path siblingPath = directory / "files2";
+  tfs::FuzzyHashDatabase database;
+  tfs::FuzzyHashRowSet hashes;
+
+  hashes.insert(makeHash((filesPath / "kept.txt").u8string()));
+  hashes.insert(makeHash((filesPath / "deleted.txt").u8string()));
+  hashes.insert(makeHash((filesPath / "sub" / "deleted.txt").u8string()));
+  hashes.insert(makeHash((siblingPath / "other.txt").u8string()));
+
+  database.open(dbFilePath);
+  database.setBatchSize(1);
+  database.insertHashes(hashes);
+
+  const std::size_t numHashesDeleted = database.deleteHashesForMissingFiles(
+      {filesPath}, {filesPath / "kept.txt"});
+  tfs::FuzzyHashRow hash;
+
+  check(numHashesDeleted == 2, "hashes of missing files are deleted");
+  check(database.getNumHashes() == 2, "other hashes are kept");
+  check(database.getHashForFile(hash, filesPath / "kept.txt"),
+        "hash of listed file is kept");
+  check(database.getHashForFile(hash, siblingPath / "other.txt"),
+        "hash in sibling directory with the same prefix is kept");
+
+  database.vacuum();
+  check(database.getNumHashes() == 2, "vacuum keeps hashes");
+}
+}  // namespace
+
+int main() {
+  const fs::path directory =
+      fs::temp_directory_path() / "tlo-fs-database-test";
+
+  try {
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    testNewDatabaseUsesIncrementalAutoVacuum(directory);
+    testDeleteHashesForMissingFiles(directory);
+
+    fs::remove_all(directory);
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <string>
+#include <tlo-file-similarity/compare.hpp>
+#include <tlo-file-similarity/distance.hpp>
+#include <utility>
+#include <vector>
+
+#include "test.hpp"
+
+namespace {
+using tfs_test::check;
+
+constexpr int NUM_RANDOM_PAIRS = 20000;
+
+const std::string BASE64_CHARACTERS =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Generates pairs of strings of base64 characters, like the parts of fuzzy
+// hashes, of length 0 to MAX_BIT_PARALLEL_LENGTH. Half of the pairs are made
+// similar by editing a copy of the first string, so that matches and
+// transpositions are common.
+class RandomPairGenerator {
+ private:
+  std::mt19937 engine{20200101};
+
+  std::size_t randomSize(std::size_t max) {
+    return std::uniform_int_distribution<std::size_t>(0, max)(engine);
+  }
+
+  char randomCharacter(std::size_t alphabetSize) {
+    return BASE64_CHARACTERS[randomSize(alphabetSize - 1)];
+  }
+
+  std::string randomString(std::size_t alphabetSize) {
+    std::string string(randomSize(tfs::MAX_BIT_PARALLEL_LENGTH), ' ');
+
+    for (char &character : string) {
+      character = randomCharacter(alphabetSize);
+    }
+
+    return string;
+  }
+
+  std::string edit(std::string string, std::size_t alphabetSize) {
+    const std::size_t numEdits = randomSize(8);
+
+    for (std::size_t i = 0; i < numEdits; ++i) {
+      const std::size_t position = randomSize(string.size());
+
+      switch (randomSize(3)) {
+        case 0:
+          if (string.size() < tfs::MAX_BIT_PARALLEL_LENGTH) {
+            string.insert(position, 1, randomCharacter(alphabetSize));
+          }
+          break;
+        case 1:
+          if (position < string.size()) {
+            string.erase(position, 1);
+          }
+          break;
+        case 2:
+          if (position < string.size()) {
+            string[position] = randomCharacter(alphabetSize);
+          }
+          break;
+        default:
+          if (position + 1 < string.size()) {
+            std::swap(string[position], string[position + 1]);
+          }
+          break;
+      }
+    }
+
+    return string;
+  }
+
+ public:
+  std::pair<std::string, std::string> next() {
+    // A small alphabet makes repeated characters, and so many equally long
+    // alignments, likely.
+    const std::size_t alphabetSize =
+        randomSize(1) == 0 ? 4 : BASE64_CHARACTERS.size();
+    std::string string1 = randomString(alphabetSize);
+    std::string string2 = randomSize(1) == 0 ? edit(string1, alphabetSize)
+                                             : randomString(alphabetSize);
+
+    return {std::move(string1), std::move(string2)};
+  }
+};
+
+std::size_t referenceLcsLength(const std::string &string1,
+                               const std::string &string2) {
+  std::vector<std::vector<std::size_t>> lengths(
+      string1.size() + 1, std::vector<std::size_t>(string2.size() + 1));
+
+  for (std::size_t i = 1; i <= string1.size(); ++i) {
+    for (std::size_t j = 1; j <= string2.size(); ++j) {
+      lengths[i][j] = string1[i - 1] == string2[j - 1]
+                          ? lengths[i - 1][j - 1] + 1
+                          : std::max(lengths[i - 1][j], lengths[i][j - 1]);
+    }
+  }
+
+  return lengths[string1.size()][string2.size()];
+}
+
+std::size_t referenceLevenshteinDistance(const std::string &string1,
+                                         const std::string &string2) {
+  std::vector<std::vector<std::size_t>> distances(
+      string1.size() + 1, std::vector<std::size_t>(string2.size() + 1));
+
+  for (std::size_t i = 0; i <= string1.size(); ++i) {
+    for (std::size_t j = 0; j <= string2.size(); ++j) {
+      if (i == 0 || j == 0) {
+        distances[i][j] = i + j;
+      } else {
+        distances[i][j] = std::min(
+            {distances[i - 1][j] + 1, distances[i][j - 1] + 1,
+             distances[i - 1][j - 1] + (string1[i - 1] != string2[j - 1])});
+      }
+    }
+  }
+
+  return distances[string1.size()][string2.size()];
+}
+
+std::size_t referenceOsaDistance(const std::string &string1,
+                                 const std::string &string2) {
+  std::vector<std::vector<std::size_t>> distances(
+      string1.size() + 1, std::vector<std::size_t>(string2.size() + 1));
+
+  for (std::size_t i = 0; i <= string1.size(); ++i) {
+    for (std::size_t j = 0; j <= string2.size(); ++j) {
+      if (i == 0 || j == 0) {
+        distances[i][j] = i + j;
+        continue;
+      }
+
+      distances[i][j] = std::min(
+          {distances[i - 1][j] + 1, distances[i][j - 1] + 1,
+           distances[i - 1][j - 1] + (string1[i - 1] != string2[j - 1])});
+
+      if (i > 1 && j > 1 && string1[i - 1] == string2[j - 2] &&
+          string1[i - 2] == string2[j - 1]) {
+        distances[i][j] =
+            std::min(distances[i][j], distances[i - 2][j - 2] + 1);
+      }
+    }
+  }
+
+  return distances[string1.size()][string2.size()];
+}
+
+std::string describe(const std::string &string1, const std::string &string2) {
+  return "\"" + string1 + "\" and \"" + string2 + "\"";
+}
+
+void testKnownDistances() {
+  check(tfs::lcsLength("ABCBDAB", "BDCABA") == 4,
+        "LCS length of ABCBDAB and BDCABA");
+  check(tfs::levenshteinDistance("kitten", "sitting") == 3,
+        "Levenshtein distance between kitten and sitting");
+  check(tfs::levenshteinDistance("", "abc") == 3,
+        "Levenshtein distance to the empty string");
+  check(tfs::osaDistance("ca", "abc") == 3,
+        "OSA distance does not edit a transposed substring again");
+  check(tfs::osaDistance("abcd", "abdc") == 1,
+        "OSA distance counts a transposition as one edit");
+}
+
+void testRandomPairs() {
+  RandomPairGenerator generator;
+
+  for (int i = 0; i < NUM_RANDOM_PAIRS; ++i) {
+    const auto [string1, string2] = generator.next();
+
+    const std::size_t lcsLength = referenceLcsLength(string1, string2);
+
+    check(tfs::lcsLength(string1, string2) == lcsLength,
+          "LCS length of " + describe(string1, string2));
+    check(tfs::levenshteinDistance(string1, string2) ==
+              referenceLevenshteinDistance(string1, string2),
+          "Levenshtein distance between " + describe(string1, string2));
+    check(tfs::osaDistance(string1, string2) ==
+              referenceOsaDistance(string1, string2),
+          "OSA distance between " + describe(string1, string2));
+
+    // Alternates between a minimum just above, at and just below the length.
+    const std::size_t minLcsLength =
+        lcsLength + 1 - std::min<std::size_t>(i % 3, lcsLength + 1);
+    const std::size_t cutoffLcsLength =
+        tfs::lcsLength(string1, string2, minLcsLength);
+
+    check(cutoffLcsLength >= minLcsLength ? cutoffLcsLength == lcsLength
+                                          : lcsLength < minLcsLength,
+          "LCS length of " + describe(string1, string2) + " with minimum " +
+              std::to_string(minLcsLength));
+  }
+}
+
+// The score with a minimum must be exact if it reaches the minimum, which
+// includes a minimum equal to the exact score, and below the minimum
+// otherwise.
+void testLcsScoreWithMinimum() {
+  RandomPairGenerator generator;
+  std::mt19937 engine(20200102);
+  std::uniform_real_distribution<double> minScores(0.0, 100.0);
+
+  for (int i = 0; i < NUM_RANDOM_PAIRS; ++i) {
+    const auto [string1, string2] = generator.next();
+    const double score = tfs::compareWithLcsDistance(string1, string2);
+
+    for (double minScore : {score, minScores(engine), minScores(engine)}) {
+      const double cutoffScore =
+          tfs::compareWithLcsDistance(string1, string2, minScore);
+
+      check(score >= minScore ? cutoffScore == score : cutoffScore < minScore,
+            "LCS score of " + describe(string1, string2) + " with minimum " +
+                std::to_string(minScore));
+    }
+  }
+}
+}  // namespace
+
+int main() {
+  try {
+    testKnownDistances();
+    testRandomPairs();
+    testLcsScoreWithMinimum();
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
@@ -0,0 +1,51 @@
+# Generates a tree of small files, starts tlo-find-similar-files on it with
+# several hashing threads, interrupts it while hashing threads are waiting for
+# room in the queue, and checks that it exits.
+#
+# Run with cmake -D TLO_FIND_SIMILAR_FILES=<path> -D TLO_FS_GEN=<path>
+#   -D WORK_DIR=<path> -P interrupt-test.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+
+execute_process(
+  COMMAND "${TLO_FS_GEN}" --num-clusters=4000 --min-file-size=256
+    --max-file-size=1024 "${WORK_DIR}/files"
+  RESULT_VARIABLE result
+  OUTPUT_QUIET
+  ERROR_VARIABLE error
+)
+
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "tlo-fs-gen failed: ${error}")
+endif()
+
+# Waits up to 30 seconds for the program to exit after the interrupt, then
+# kills it so a hang does not leave it running.
+set(script [=[
+"$0" --num-threads=4 "$1" > /dev/null &
+pid=$!
+sleep 3
+kill -INT "$pid"
+i=0
+while kill -0 "$pid" 2> /dev/null; do
+  if [ "$i" -ge 30 ]; then
+    kill -KILL "$pid"
+    echo "Still running 30 seconds after the interrupt."
+    exit 1
+  fi
+  sleep 1
+  i=$((i + 1))
+done
+]=])
+
+execute_process(
+  COMMAND sh -c "${script}" "${TLO_FIND_SIMILAR_FILES}" "${WORK_DIR}/files"
+  RESULT_VARIABLE result
+  OUTPUT_VARIABLE output
+)
+
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "tlo-find-similar-files did not stop: ${output}")
+endif()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
@@ -0,0 +1,46 @@
+# Generates a tree of files and hashes it into a new database with
+# --known-hash-lookup=lookup and several threads, so each hashing thread opens
+# its own connection while the writer thread has a transaction open. Then hashes
+# the tree again and checks that no hash is stored again.
+#
+# Run with cmake -D TLO_FUZZY_HASH=<path> -D TLO_FS_GEN=<path>
+#   -D WORK_DIR=<path> -P lookup-test.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+
+execute_process(
+  COMMAND "${TLO_FS_GEN}" --num-clusters=100 --min-file-size=1024
+    --max-file-size=4096 "${WORK_DIR}/files"
+  RESULT_VARIABLE result
+  OUTPUT_QUIET
+  ERROR_VARIABLE error
+)
+
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "tlo-fs-gen failed: ${error}")
+endif()
+
+function(run_fuzzy_hash)
+  execute_process(
+    COMMAND "${TLO_FUZZY_HASH}" "--database=${WORK_DIR}/hashes.db"
+      --known-hash-lookup=lookup --num-threads=4 --verbose "${WORK_DIR}/files"
+    RESULT_VARIABLE result
+    OUTPUT_QUIET
+    ERROR_VARIABLE error
+  )
+
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "tlo-fuzzy-hash failed: ${error}")
+  endif()
+
+  set(error "${error}" PARENT_SCOPE)
+endfunction()
+
+run_fuzzy_hash()
+
+run_fuzzy_hash()
+if (NOT error MATCHES "Stored 0 new or modified hashes\\.")
+  message(FATAL_ERROR "Known hashes were not looked up:\n${error}")
+endif()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
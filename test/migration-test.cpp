@@ -0,0 +1,78 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <tlo-cpp/sqlite3.hpp>
+#include <tlo-file-similarity/database.hpp>
+
+#include "test.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+using tfs_test::check;
+using tfs_test::selectInt64;
+
+void testMigrationFromVersion0(const fs::path &directory) {
+  const fs::path dbFilePath = directory / "version0.db";
+  const std::string filePath = (directory / "files" / "a.txt").u8string();
+
+  {
+    tlo::Sqlite3Connection connection(dbFilePath);
+
+    tlo::Sqlite3Statement(connection, R"sql(CREATE TABLE FuzzyHash (
+  blockSize INTEGER NOT NULL,
+  part1 TEXT NOT NULL,
+  part2 TEXT NOT NULL,
+  filePath TEXT PRIMARY KEY NOT NULL,
+  fileSize INTEGER NOT NULL,
+  fileLastWriteTime TEXT NOT NULL
+);)sql")
+        .step();
+
+    tlo::Sqlite3Statement insert(
+        connection,
+        "INSERT INTO FuzzyHash VALUES(3, 'abcdefgh', 'abcd', :filePath, 100, "
+        "'2020-01-01 00:00:00');");
+
+    insert.bindUtf8Text(":filePath", filePath);
+    insert.step();
+  }
+
+  tfs::FuzzyHashDatabase database;
+  tfs::FuzzyHashRow hash;
+
+  database.open(dbFilePath);
+  check(database.getHashForFile(hash, filePath),
+        "hash of version 0 database is migrated");
+  check(hash.part1 == "abcdefgh" && hash.part2 == "abcd" &&
+            hash.fileSize == 100,
+        "migrated hash keeps its columns");
+  check(selectInt64(dbFilePath,
+                    "SELECT COUNT(*) FROM sqlite_master WHERE name = "
+                    "'FuzzyHash';") == 0,
+        "version 0 table is dropped");
+  check(selectInt64(dbFilePath, "PRAGMA user_version;") == 1,
+        "migrated database is marked as version 1");
+}
+}  // namespace
+
+int main() {
+  const fs::path directory =
+      fs::temp_directory_path() / "tlo-fs-migration-test";
+
+  try {
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    testMigrationFromVersion0(directory);
+
+    fs::remove_all(directory);
+  } catch (const std::exception &exception) {
+    std::cerr << exception.what() << std::endl;
+
+    return 1;
+  }
+
+  std::cout << "All tests passed." << std::endl;
+  return 0;
+}
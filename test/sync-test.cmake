@@ -0,0 +1,44 @@
+# Hashes a copy of the samples into a database, deletes one of the copies, and
+# checks that tlo-fuzzy-hash --sync deletes its hash and only its hash.
+#
+# Run with cmake -D TLO_FUZZY_HASH=<path> -D SAMPLES_DIR=<path>
+#   -D WORK_DIR=<path> -P sync-test.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(COPY "${SAMPLES_DIR}/" DESTINATION "${WORK_DIR}/files")
+set(database "${WORK_DIR}/hashes.db")
+
+function(run_fuzzy_hash)
+  execute_process(
+    COMMAND "${TLO_FUZZY_HASH}" "--database=${database}" ${ARGN}
+      "${WORK_DIR}/files"
+    RESULT_VARIABLE result
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE error
+  )
+
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "tlo-fuzzy-hash failed: ${error}")
+  endif()
+
+  set(output "${output}" PARENT_SCOPE)
+  set(error "${error}" PARENT_SCOPE)
+endfunction()
+
+run_fuzzy_hash()
+file(REMOVE "${WORK_DIR}/files/Original.txt")
+
+run_fuzzy_hash(--sync --verbose)
+if (NOT error MATCHES "Deleted 1 hash\\.")
+  message(FATAL_ERROR "--sync kept the hash of a deleted file:\n${error}")
+endif()
+
+run_fuzzy_hash(--sync --vacuum --verbose)
+if (NOT error MATCHES "Deleted 0 hashes\\.")
+  message(FATAL_ERROR "--sync deleted hashes of existing files:\n${error}")
+endif()
+if (output MATCHES "Original\\.txt" OR NOT output MATCHES "Moved-Some-Lines")
+  message(FATAL_ERROR "Unexpected hashes after --sync:\n${output}")
+endif()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
@@ -0,0 +1,36 @@
+#ifndef TLO_FS_TEST_HPP
+#define TLO_FS_TEST_HPP
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tlo-cpp/sqlite3.hpp>
+
+// Helpers shared by the test programs. Each test program runs its checks from
+// main() and exits with 1 at the first failed check.
+namespace tfs_test {
+// Throws std::runtime_error naming the check if condition is false.
+inline void check(bool condition, const std::string &description) {
+  if (!condition) {
+    throw std::runtime_error("Error: Check failed: " + description + ".");
+  }
+}
+
+// Returns the first column of the first row of the result of running sql on
+// a new connection to the database at dbFilePath.
+inline sqlite3_int64 selectInt64(const std::filesystem::path &dbFilePath,
+                                 std::string_view sql) {
+  tlo::Sqlite3Connection connection(dbFilePath);
+  tlo::Sqlite3Statement statement(connection, sql);
+
+  statement.step();
+
+  const sqlite3_int64 value = statement.columnAsInt64(0);
+
+  statement.reset();
+  return value;
+}
+}  // namespace tfs_test
+
+#endif  // TLO_FS_TEST_HPP